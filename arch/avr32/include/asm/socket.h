@@ -62,4 +62,6 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_ZEROCOPY             60
+
 #endif /* __ASM_AVR32_SOCKET_H */
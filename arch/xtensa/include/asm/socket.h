@@ -73,4 +73,6 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_ZEROCOPY             60
+
 #endif	/* _XTENSA_SOCKET_H */
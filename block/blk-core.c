@@ -531,7 +531,13 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 		return NULL;
 	}
 
+	if (blk_latency_hist_init(q)) {
+		kmem_cache_free(blk_requestq_cachep, q);
+		return NULL;
+	}
+
 	if (blk_throtl_init(q)) {
+		blk_latency_hist_exit(q);
 		kmem_cache_free(blk_requestq_cachep, q);
 		return NULL;
 	}
@@ -1798,6 +1804,46 @@ static void blk_account_io_completion(struct request *req, unsigned int bytes)
 	}
 }
 
+#ifdef CONFIG_BLK_LATENCY_HIST
+int blk_latency_hist_init(struct request_queue *q)
+{
+	q->latency_hist = kzalloc_node(sizeof(*q->latency_hist), GFP_KERNEL,
+				       q->node);
+	return q->latency_hist ? 0 : -ENOMEM;
+}
+
+void blk_latency_hist_exit(struct request_queue *q)
+{
+	kfree(q->latency_hist);
+	q->latency_hist = NULL;
+}
+
+/*
+ * Account the time between @start and @end (in ns) to the @type histogram
+ * of the class of @req. queue_lock must be held.
+ */
+static void blk_account_io_latency(struct request *req, int type,
+				   u64 start, u64 end)
+{
+	struct blk_latency_hist *hist = req->q->latency_hist;
+	unsigned int bucket;
+
+	if (!hist || !start || end < start)
+		return;
+
+	bucket = fls64(div_u64(end - start, NSEC_PER_USEC));
+	if (bucket >= BLK_LAT_HIST_BUCKETS)
+		bucket = BLK_LAT_HIST_BUCKETS - 1;
+
+	hist->count[type][rq_data_dir(req)][rq_is_sync(req)][bucket]++;
+}
+#else
+static inline void blk_account_io_latency(struct request *req, int type,
+					  u64 start, u64 end)
+{
+}
+#endif
+
 static void blk_account_io_done(struct request *req)
 {
 	/*
@@ -1941,6 +1987,9 @@ void blk_dequeue_request(struct request *rq)
 	if (blk_account_rq(rq)) {
 		q->in_flight[rq_is_sync(rq)]++;
 		set_io_start_time_ns(rq);
+		blk_account_io_latency(rq, BLK_LAT_QUEUE,
+				       rq_start_time_ns(rq),
+				       rq_io_start_time_ns(rq));
 	}
 }
 
@@ -2215,6 +2264,10 @@ static void blk_finish_request(struct request *req, int error)
 
 	blk_account_io_done(req);
 
+	if (blk_account_rq(req) && req != &req->q->flush_rq)
+		blk_account_io_latency(req, BLK_LAT_SERVICE,
+				       rq_io_start_time_ns(req), sched_clock());
+
 	if (req->end_io)
 		req->end_io(req, error);
 	else {
@@ -265,6 +265,66 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+#ifdef CONFIG_BLK_LATENCY_HIST
+static ssize_t queue_latency_hist_show(struct request_queue *q, char *page)
+{
+	static const char *const cls[2][2] = {
+		{ "r_async", "r_sync" }, { "w_async", "w_sync" },
+	};
+	struct blk_latency_hist *hist = q->latency_hist;
+	char label[16];
+	ssize_t ret = 0;
+	int type, rw, sync, i;
+
+	if (!hist || !q->queue_lock)
+		return -EINVAL;
+
+	ret += sprintf(page + ret, "%10s", "usecs");
+	for (type = 0; type < BLK_LAT_NR; type++)
+		for (rw = 0; rw < 2; rw++)
+			for (sync = 1; sync >= 0; sync--)
+				ret += sprintf(page + ret, " %c_%-9s",
+					       type == BLK_LAT_QUEUE ? 'q' : 's',
+					       cls[rw][sync]);
+	ret += sprintf(page + ret, "\n");
+
+	spin_lock_irq(q->queue_lock);
+	for (i = 0; i < BLK_LAT_HIST_BUCKETS; i++) {
+		if (i < BLK_LAT_HIST_BUCKETS - 1)
+			sprintf(label, "<%lu", 1UL << i);
+		else
+			sprintf(label, ">=%lu", 1UL << (i - 1));
+		ret += sprintf(page + ret, "%10s", label);
+
+		for (type = 0; type < BLK_LAT_NR; type++)
+			for (rw = 0; rw < 2; rw++)
+				for (sync = 1; sync >= 0; sync--)
+					ret += sprintf(page + ret, " %11llu",
+						(unsigned long long)
+						hist->count[type][rw][sync][i]);
+		ret += sprintf(page + ret, "\n");
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+/* Any write clears the histograms */
+static ssize_t
+queue_latency_hist_store(struct request_queue *q, const char *page,
+			 size_t count)
+{
+	if (!q->latency_hist || !q->queue_lock)
+		return -EINVAL;
+
+	spin_lock_irq(q->queue_lock);
+	memset(q->latency_hist, 0, sizeof(*q->latency_hist));
+	spin_unlock_irq(q->queue_lock);
+
+	return count;
+}
+#endif
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -379,6 +439,14 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+#ifdef CONFIG_BLK_LATENCY_HIST
+static struct queue_sysfs_entry queue_latency_hist_entry = {
+	.attr = {.name = "latency_hist", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_latency_hist_show,
+	.store = queue_latency_hist_store,
+};
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -401,6 +469,9 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+#ifdef CONFIG_BLK_LATENCY_HIST
+	&queue_latency_hist_entry.attr,
+#endif
 	NULL,
 };
 
@@ -472,6 +543,7 @@ static void blk_release_queue(struct kobject *kobj)
 	blk_sync_queue(q);
 
 	blk_throtl_exit(q);
+	blk_latency_hist_exit(q);
 
 	if (rl->rq_pool)
 		mempool_destroy(rl->rq_pool);
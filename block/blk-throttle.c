@@ -226,13 +226,75 @@ done:
 	return tg;
 }
 
-static struct throtl_grp * throtl_get_tg(struct throtl_data *td)
+/*
+ * Buffered writes are submitted by the flusher threads, not by the tasks
+ * that dirtied the pages. Remember the blkio cgroup of the last task that
+ * dirtied a page of @mapping so that its writeback can be charged to it.
+ *
+ * Block device mappings hold the metadata of whole filesystems, dirtied
+ * by everyone.  Their writeback stays with the submitter, so one
+ * throttled cgroup can't hold it back.
+ */
+void blk_throtl_mark_dirtier(struct address_space *mapping)
+{
+	unsigned short id;
+
+	if (!mapping->host || S_ISBLK(mapping->host->i_mode))
+		return;
+
+	rcu_read_lock();
+	id = css_id(task_subsys_state(current, blkio_subsys_id));
+	rcu_read_unlock();
+
+	/* Avoid dirtying the cacheline for every page */
+	if (mapping->dirtier_blkcg_id != id)
+		mapping->dirtier_blkcg_id = id;
+}
+
+/*
+ * Find the cgroup @bio should be charged to. Async writes belong to the
+ * cgroup that dirtied the page cache they write back, everything else to
+ * the submitter. Must be called under rcu_read_lock().
+ */
+static struct cgroup *throtl_bio_cgroup(struct bio *bio)
+{
+	struct cgroup_subsys_state *css;
+	struct address_space *mapping;
+	struct page *page;
+	unsigned short id;
+
+	if (bio_data_dir(bio) != WRITE || (bio->bi_rw & REQ_SYNC) ||
+	    !bio->bi_vcnt)
+		goto submitter;
+
+	page = bio_page(bio);
+	if (!page || PageAnon(page))
+		goto submitter;
+
+	mapping = page->mapping;
+	if (!mapping)
+		goto submitter;
+
+	id = mapping->dirtier_blkcg_id;
+	if (!id)
+		goto submitter;
+
+	css = css_lookup(&blkio_subsys, id);
+	if (css && !css_is_removed(css))
+		return css->cgroup;
+
+submitter:
+	return task_cgroup(current, blkio_subsys_id);
+}
+
+static struct throtl_grp * throtl_get_tg(struct throtl_data *td,
+					 struct bio *bio)
 {
 	struct cgroup *cgroup;
 	struct throtl_grp *tg = NULL;
 
 	rcu_read_lock();
-	cgroup = task_cgroup(current, blkio_subsys_id);
+	cgroup = throtl_bio_cgroup(bio);
 	tg = throtl_find_alloc_tg(td, cgroup);
 	if (!tg)
 		tg = &td->root_tg;
@@ -1003,7 +1065,7 @@ int blk_throtl_bio(struct request_queue *q, struct bio **biop)
 	}
 
 	spin_lock_irq(q->queue_lock);
-	tg = throtl_get_tg(td);
+	tg = throtl_get_tg(td, bio);
 
 	if (tg->nr_queued[rw]) {
 		/*
@@ -25,6 +25,32 @@ void blk_delete_timer(struct request *);
 void blk_add_timer(struct request *);
 void __generic_unplug_device(struct request_queue *);
 
+enum blk_lat_hist_type {
+	BLK_LAT_QUEUE = 0,	/* insertion to dispatch */
+	BLK_LAT_SERVICE,	/* dispatch to completion */
+	BLK_LAT_NR,
+};
+
+#ifdef CONFIG_BLK_LATENCY_HIST
+/* log2 buckets of microseconds, the last one also counts everything above */
+#define BLK_LAT_HIST_BUCKETS	24
+
+/* Protected by the queue lock */
+struct blk_latency_hist {
+	/* indexed by [type][rq_data_dir()][rq_is_sync()][bucket] */
+	u64 count[BLK_LAT_NR][2][2][BLK_LAT_HIST_BUCKETS];
+};
+
+int blk_latency_hist_init(struct request_queue *q);
+void blk_latency_hist_exit(struct request_queue *q);
+#else
+static inline int blk_latency_hist_init(struct request_queue *q)
+{
+	return 0;
+}
+static inline void blk_latency_hist_exit(struct request_queue *q) { }
+#endif
+
 /*
  * Internal atomic flags for request handling
  */
@@ -0,0 +1,926 @@
+/*
+ * Flash Group Queueing IO scheduler
+ * Based on the SIO, Deadline and CFQ IO schedulers.
+ *
+ * Requests are queued per blkio cgroup. Groups with pending requests are
+ * kept in a service tree ordered by virtual disk time, and the group with
+ * the smallest vdisktime gets a time slice proportional to its blkio weight.
+ * The disk time it actually uses is charged back scaled by the inverse of
+ * its weight, so over time each cgroup receives a share of the device that
+ * matches its weight.
+ *
+ * Unlike CFQ there is no idling of any kind: flash has no seek penalty, so
+ * as soon as the active group runs out of requests its slice is ended and
+ * the next group is served. A sync request arriving for a group that is
+ * behind the active one preempts a slice serving only async requests, which
+ * keeps foreground reads responsive while background writeback proceeds.
+ *
+ * Inside a group requests are not sorted; they are served from fifo lists
+ * with SIO-style deadlines, preferring sync over async and reads over
+ * writes.
+ */
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/rbtree.h>
+#include <linux/ktime.h>
+#include "blk-cgroup.h"
+
+enum { ASYNC, SYNC };
+
+/* Tunables */
+static const int sync_read_expire  = HZ / 4;	/* max time before a sync read is submitted. */
+static const int sync_write_expire = HZ;	/* max time before a sync write is submitted. */
+static const int async_read_expire  = 2 * HZ;	/* ditto for async, these limits are SOFT! */
+static const int async_write_expire = 8 * HZ;	/* ditto for async, these limits are SOFT! */
+
+static const int writes_starved = 2;		/* max times reads can starve a write */
+static const int fifo_batch     = 8;		/* # of requests served before checking deadlines */
+
+static const int group_slice_sync  = HZ / 10;	/* base slice of a group with sync requests */
+static const int group_slice_async = HZ / 25;	/* base slice of a group with async requests only */
+
+struct fgq_data;
+
+struct fgq_group {
+	/* service tree node, keyed by vdisktime */
+	struct rb_node rb_node;
+	u64 vdisktime;
+	unsigned int weight;
+
+	/* Request queues */
+	struct list_head fifo_list[2][2];
+	unsigned int nr_queued[2];
+
+	/* Attributes */
+	unsigned int batched;
+	unsigned int starved;
+
+	/* slice bookkeeping while this group is active */
+	ktime_t slice_start;
+	unsigned long slice_start_jiffies;
+	unsigned long slice_end;
+	bool slice_sync;
+
+	/* joint cgroup/elevator reference plus one per allocated request */
+	int ref;
+	struct hlist_node fd_node;
+	struct fgq_data *fd;
+	struct blkio_group blkg;
+};
+
+/* Elevator data */
+struct fgq_data {
+	struct request_queue *queue;
+
+	/* groups with pending requests, except the active one */
+	struct rb_root service_tree;
+	struct rb_node *left;
+	u64 min_vdisktime;
+
+	struct fgq_group *active_group;
+	struct fgq_group root_group;
+	struct hlist_head group_list;
+
+	unsigned int nr_queued;
+
+	/* Settings */
+	int fifo_expire[2][2];
+	int fifo_batch;
+	int writes_starved;
+	int group_slice[2];
+
+	struct rcu_head rcu;
+};
+
+#define RQ_FGQG(rq)	((struct fgq_group *) ((rq)->elevator_private))
+
+#define fgq_group_empty(fg)	((fg)->nr_queued[SYNC] + (fg)->nr_queued[ASYNC] == 0)
+
+static inline struct fgq_group *fgqg_of_blkg(struct blkio_group *blkg)
+{
+	if (blkg)
+		return container_of(blkg, struct fgq_group, blkg);
+	return NULL;
+}
+
+static void fgq_init_group(struct fgq_data *fd, struct fgq_group *fg)
+{
+	INIT_LIST_HEAD(&fg->fifo_list[SYNC][READ]);
+	INIT_LIST_HEAD(&fg->fifo_list[SYNC][WRITE]);
+	INIT_LIST_HEAD(&fg->fifo_list[ASYNC][READ]);
+	INIT_LIST_HEAD(&fg->fifo_list[ASYNC][WRITE]);
+	RB_CLEAR_NODE(&fg->rb_node);
+	fg->fd = fd;
+	fg->ref = 1;
+}
+
+/*
+ * Service tree handling
+ */
+
+static inline s64 fgq_group_key(struct fgq_data *fd, struct fgq_group *fg)
+{
+	return fg->vdisktime - fd->min_vdisktime;
+}
+
+static void fgq_update_min_vdisktime(struct fgq_data *fd)
+{
+	u64 vdisktime = fd->min_vdisktime;
+	struct fgq_group *fg;
+
+	if (fd->active_group)
+		vdisktime = fd->active_group->vdisktime;
+
+	if (fd->left) {
+		fg = rb_entry(fd->left, struct fgq_group, rb_node);
+		if (!fd->active_group || (s64)(fg->vdisktime - vdisktime) < 0)
+			vdisktime = fg->vdisktime;
+	}
+
+	/* min_vdisktime only ever moves forward */
+	if ((s64)(vdisktime - fd->min_vdisktime) > 0)
+		fd->min_vdisktime = vdisktime;
+}
+
+static void fgq_service_tree_add(struct fgq_data *fd, struct fgq_group *fg)
+{
+	struct rb_node **node = &fd->service_tree.rb_node;
+	struct rb_node *parent = NULL;
+	struct fgq_group *__fg;
+	s64 key = fgq_group_key(fd, fg);
+	int left = 1;
+
+	while (*node != NULL) {
+		parent = *node;
+		__fg = rb_entry(parent, struct fgq_group, rb_node);
+
+		if (key < fgq_group_key(fd, __fg))
+			node = &parent->rb_left;
+		else {
+			node = &parent->rb_right;
+			left = 0;
+		}
+	}
+
+	if (left)
+		fd->left = &fg->rb_node;
+
+	rb_link_node(&fg->rb_node, parent, node);
+	rb_insert_color(&fg->rb_node, &fd->service_tree);
+}
+
+static void fgq_service_tree_del(struct fgq_data *fd, struct fgq_group *fg)
+{
+	if (fd->left == &fg->rb_node)
+		fd->left = rb_next(&fg->rb_node);
+
+	rb_erase(&fg->rb_node, &fd->service_tree);
+	RB_CLEAR_NODE(&fg->rb_node);
+}
+
+/*
+ * A group that becomes busy again starts no earlier than the current
+ * min_vdisktime, so sleeping groups cannot hoard credit, but it is not
+ * pushed behind the busy groups either: an interactive reader that was
+ * idle gets served next.
+ */
+static void fgq_group_activate(struct fgq_data *fd, struct fgq_group *fg)
+{
+	if (fg == fd->active_group || !RB_EMPTY_NODE(&fg->rb_node))
+		return;
+
+	if ((s64)(fg->vdisktime - fd->min_vdisktime) < 0)
+		fg->vdisktime = fd->min_vdisktime;
+
+	fgq_service_tree_add(fd, fg);
+}
+
+static inline u64 fgq_scale_slice(s64 delta, unsigned int weight)
+{
+	u64 d = delta * BLKIO_WEIGHT_DEFAULT;
+
+	do_div(d, weight);
+	return d;
+}
+
+static void fgq_slice_expired(struct fgq_data *fd)
+{
+	struct fgq_group *fg = fd->active_group;
+	s64 used;
+
+	if (!fg)
+		return;
+
+	/* charge at least one microsecond so that every slice costs */
+	used = ktime_to_ns(ktime_sub(ktime_get(), fg->slice_start));
+	if (used < NSEC_PER_USEC)
+		used = NSEC_PER_USEC;
+
+	fg->vdisktime += fgq_scale_slice(used, fg->weight);
+	blkiocg_update_timeslice_used(&fg->blkg,
+				      jiffies - fg->slice_start_jiffies);
+
+	fd->active_group = NULL;
+	if (!fgq_group_empty(fg))
+		fgq_service_tree_add(fd, fg);
+
+	fgq_update_min_vdisktime(fd);
+}
+
+static void fgq_set_active_group(struct fgq_data *fd)
+{
+	struct fgq_group *fg;
+	int slice;
+
+	if (!fd->left)
+		return;
+
+	fg = rb_entry(fd->left, struct fgq_group, rb_node);
+	fgq_service_tree_del(fd, fg);
+
+	fg->slice_sync = fg->nr_queued[SYNC] != 0;
+	slice = fd->group_slice[fg->slice_sync];
+	slice = max_t(int, 1, slice * fg->weight / BLKIO_WEIGHT_DEFAULT);
+
+	fg->slice_start = ktime_get();
+	fg->slice_start_jiffies = jiffies;
+	fg->slice_end = jiffies + slice;
+	fg->batched = 0;
+
+	fd->active_group = fg;
+	fgq_update_min_vdisktime(fd);
+}
+
+/*
+ * Group lookup and lifetime
+ */
+
+static struct fgq_group *
+fgq_find_alloc_group(struct fgq_data *fd, struct cgroup *cgroup, int create)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgroup);
+	struct backing_dev_info *bdi = &fd->queue->backing_dev_info;
+	struct fgq_group *fg;
+	unsigned int major, minor;
+	dev_t dev = 0;
+
+	if (blkcg == &blkio_root_cgroup)
+		return &fd->root_group;
+
+	fg = fgqg_of_blkg(blkiocg_lookup_group(blkcg, fd));
+	if (fg && !fg->blkg.dev && bdi->dev && dev_name(bdi->dev)) {
+		sscanf(dev_name(bdi->dev), "%u:%u", &major, &minor);
+		fg->blkg.dev = MKDEV(major, minor);
+	}
+	if (fg || !create)
+		return fg;
+
+	fg = kzalloc_node(sizeof(*fg), GFP_ATOMIC, fd->queue->node);
+	if (!fg)
+		return NULL;
+
+	fgq_init_group(fd, fg);
+
+	/*
+	 * bdi->dev may not be set up yet, in which case the device number is
+	 * filled in by a later lookup, see above.
+	 */
+	if (bdi->dev) {
+		sscanf(dev_name(bdi->dev), "%u:%u", &major, &minor);
+		dev = MKDEV(major, minor);
+	}
+	blkiocg_add_blkio_group(blkcg, &fg->blkg, (void *)fd, dev,
+				BLKIO_POLICY_PROP);
+	fg->weight = blkcg_get_weight(blkcg, fg->blkg.dev);
+	fg->vdisktime = fd->min_vdisktime;
+
+	hlist_add_head(&fg->fd_node, &fd->group_list);
+
+	return fg;
+}
+
+/*
+ * Find the group current belongs to, creating it if asked to. Falls back to
+ * the root group if allocation fails. request_queue lock must be held.
+ */
+static struct fgq_group *fgq_get_group(struct fgq_data *fd, int create)
+{
+	struct cgroup *cgroup;
+	struct fgq_group *fg;
+
+	rcu_read_lock();
+	cgroup = task_cgroup(current, blkio_subsys_id);
+	fg = fgq_find_alloc_group(fd, cgroup, create);
+	if (!fg && create)
+		fg = &fd->root_group;
+	rcu_read_unlock();
+
+	return fg;
+}
+
+static void fgq_put_group(struct fgq_group *fg)
+{
+	BUG_ON(fg->ref <= 0);
+	fg->ref--;
+	if (fg->ref)
+		return;
+
+	BUG_ON(!fgq_group_empty(fg));
+	BUG_ON(!RB_EMPTY_NODE(&fg->rb_node));
+	BUG_ON(fg == &fg->fd->root_group);
+	kfree(fg);
+}
+
+static void fgq_destroy_group(struct fgq_data *fd, struct fgq_group *fg)
+{
+	/* Something wrong if we are trying to remove same group twice */
+	BUG_ON(hlist_unhashed(&fg->fd_node));
+
+	hlist_del_init(&fg->fd_node);
+
+	/* Drop the creation reference, requests still hold theirs */
+	fgq_put_group(fg);
+}
+
+/*
+ * The cgroup this group belongs to is going away. No new requests will be
+ * allocated for it, pending ones keep it alive until they are freed.
+ *
+ * Called under rcu_read_lock(), which keeps "key" valid, see
+ * cfq_unlink_blkio_group().
+ */
+static void fgq_unlink_blkio_group(void *key, struct blkio_group *blkg)
+{
+	struct fgq_data *fd = key;
+	unsigned long flags;
+
+	spin_lock_irqsave(fd->queue->queue_lock, flags);
+	fgq_destroy_group(fd, fgqg_of_blkg(blkg));
+	spin_unlock_irqrestore(fd->queue->queue_lock, flags);
+}
+
+static void fgq_update_blkio_group_weight(void *key, struct blkio_group *blkg,
+					  unsigned int weight)
+{
+	fgqg_of_blkg(blkg)->weight = weight;
+}
+
+/*
+ * Request handling
+ */
+
+static int
+fgq_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
+{
+	struct fgq_data *fd = q->elevator->elevator_data;
+	struct fgq_group *fg;
+	unsigned long flags;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	fg = fgq_get_group(fd, 1);
+	fg->ref++;
+	spin_unlock_irqrestore(q->queue_lock, flags);
+
+	rq->elevator_private = fg;
+	return 0;
+}
+
+static void fgq_put_request(struct request *rq)
+{
+	struct fgq_group *fg = RQ_FGQG(rq);
+
+	if (fg) {
+		rq->elevator_private = NULL;
+		fgq_put_group(fg);
+	}
+}
+
+static inline struct fgq_group *
+fgq_rq_group(struct fgq_data *fd, struct request *rq)
+{
+	/* requests allocated while switching elevators carry no group */
+	return RQ_FGQG(rq) ? RQ_FGQG(rq) : &fd->root_group;
+}
+
+static int
+fgq_allow_merge(struct request_queue *q, struct request *rq, struct bio *bio)
+{
+	struct fgq_data *fd = q->elevator->elevator_data;
+
+	/* Never merge I/O of different cgroups */
+	return fgq_get_group(fd, 0) == fgq_rq_group(fd, rq);
+}
+
+static void
+fgq_add_request(struct request_queue *q, struct request *rq)
+{
+	struct fgq_data *fd = q->elevator->elevator_data;
+	struct fgq_group *fg = fgq_rq_group(fd, rq);
+	struct fgq_group *active = fd->active_group;
+	const int sync = rq_is_sync(rq);
+	const int data_dir = rq_data_dir(rq);
+
+	/*
+	 * Add request to the proper fifo list of its group and
+	 * set its expire time.
+	 */
+	rq_set_fifo_time(rq, jiffies + fd->fifo_expire[sync][data_dir]);
+	list_add_tail(&rq->queuelist, &fg->fifo_list[sync][data_dir]);
+	fg->nr_queued[sync]++;
+	fd->nr_queued++;
+
+	fgq_group_activate(fd, fg);
+
+	blkiocg_update_io_add_stats(&fg->blkg,
+				    active ? &active->blkg : NULL,
+				    data_dir, sync);
+
+	/*
+	 * A sync request for a group that is not ahead of the active one
+	 * preempts a slice that is only pushing async requests.
+	 */
+	if (sync && active && active != fg && !active->slice_sync &&
+	    (s64)(fg->vdisktime - active->vdisktime) <= 0)
+		fgq_slice_expired(fd);
+}
+
+static void
+fgq_remove_request(struct fgq_data *fd, struct request *rq)
+{
+	struct fgq_group *fg = fgq_rq_group(fd, rq);
+	const int sync = rq_is_sync(rq);
+
+	rq_fifo_clear(rq);
+	BUG_ON(!fg->nr_queued[sync]);
+	fg->nr_queued[sync]--;
+	fd->nr_queued--;
+
+	blkiocg_update_io_remove_stats(&fg->blkg, rq_data_dir(rq), sync);
+
+	if (fgq_group_empty(fg) && !RB_EMPTY_NODE(&fg->rb_node))
+		fgq_service_tree_del(fd, fg);
+}
+
+static void
+fgq_merged_requests(struct request_queue *q, struct request *rq,
+		    struct request *next)
+{
+	struct fgq_data *fd = q->elevator->elevator_data;
+
+	/*
+	 * If next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo.
+	 */
+	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist) &&
+	    fgq_rq_group(fd, rq) == fgq_rq_group(fd, next) &&
+	    rq_is_sync(rq) == rq_is_sync(next)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
+			list_move(&rq->queuelist, &next->queuelist);
+			rq_set_fifo_time(rq, rq_fifo_time(next));
+		}
+	}
+
+	/* Delete next request */
+	fgq_remove_request(fd, next);
+	blkiocg_update_io_merged_stats(&fgq_rq_group(fd, rq)->blkg,
+				       rq_data_dir(next), rq_is_sync(next));
+}
+
+static void
+fgq_bio_merged(struct request_queue *q, struct request *rq, struct bio *bio)
+{
+	struct fgq_data *fd = q->elevator->elevator_data;
+
+	blkiocg_update_io_merged_stats(&fgq_rq_group(fd, rq)->blkg,
+				       bio_data_dir(bio), rq_is_sync(rq));
+}
+
+static int
+fgq_queue_empty(struct request_queue *q)
+{
+	struct fgq_data *fd = q->elevator->elevator_data;
+
+	return !fd->nr_queued;
+}
+
+static struct request *
+fgq_expired_request(struct fgq_group *fg, int sync, int data_dir)
+{
+	struct list_head *list = &fg->fifo_list[sync][data_dir];
+	struct request *rq;
+
+	if (list_empty(list))
+		return NULL;
+
+	/* Retrieve request */
+	rq = rq_entry_fifo(list->next);
+
+	/* Request has expired */
+	if (time_after(jiffies, rq_fifo_time(rq)))
+		return rq;
+
+	return NULL;
+}
+
+static struct request *
+fgq_choose_expired_request(struct fgq_group *fg)
+{
+	struct request *rq;
+
+	/*
+	 * Check expired requests.
+	 * Asynchronous requests have priority over synchronous.
+	 * Write requests have priority over read.
+	 */
+	rq = fgq_expired_request(fg, ASYNC, WRITE);
+	if (rq)
+		return rq;
+	rq = fgq_expired_request(fg, ASYNC, READ);
+	if (rq)
+		return rq;
+
+	rq = fgq_expired_request(fg, SYNC, WRITE);
+	if (rq)
+		return rq;
+	rq = fgq_expired_request(fg, SYNC, READ);
+	if (rq)
+		return rq;
+
+	return NULL;
+}
+
+static struct request *
+fgq_choose_request(struct fgq_group *fg, int data_dir)
+{
+	struct list_head *sync = fg->fifo_list[SYNC];
+	struct list_head *async = fg->fifo_list[ASYNC];
+
+	/*
+	 * Retrieve request from available fifo list.
+	 * Synchronous requests have priority over asynchronous.
+	 * Read requests have priority over write.
+	 */
+	if (!list_empty(&sync[data_dir]))
+		return rq_entry_fifo(sync[data_dir].next);
+	if (!list_empty(&async[data_dir]))
+		return rq_entry_fifo(async[data_dir].next);
+
+	if (!list_empty(&sync[!data_dir]))
+		return rq_entry_fifo(sync[!data_dir].next);
+	if (!list_empty(&async[!data_dir]))
+		return rq_entry_fifo(async[!data_dir].next);
+
+	return NULL;
+}
+
+static struct request *
+fgq_group_next_request(struct fgq_data *fd, struct fgq_group *fg)
+{
+	struct request *rq = NULL;
+	int data_dir = READ;
+
+	/*
+	 * Retrieve any expired request after a batch of
+	 * requests.
+	 */
+	if (fg->batched > fd->fifo_batch) {
+		fg->batched = 0;
+		rq = fgq_choose_expired_request(fg);
+	}
+
+	if (!rq) {
+		if (fg->starved > fd->writes_starved)
+			data_dir = WRITE;
+
+		rq = fgq_choose_request(fg, data_dir);
+	}
+
+	return rq;
+}
+
+static void
+fgq_dispatch_request(struct fgq_data *fd, struct fgq_group *fg,
+		     struct request *rq)
+{
+	/*
+	 * Remove the request from the fifo list
+	 * and dispatch it.
+	 */
+	fgq_remove_request(fd, rq);
+	elv_dispatch_add_tail(rq->q, rq);
+
+	fg->batched++;
+
+	if (rq_data_dir(rq))
+		fg->starved = 0;
+	else
+		fg->starved++;
+
+	blkiocg_update_dispatch_stats(&fg->blkg, blk_rq_bytes(rq),
+				      rq_data_dir(rq), rq_is_sync(rq));
+}
+
+static int
+fgq_forced_dispatch(struct fgq_data *fd)
+{
+	struct fgq_group *fg;
+	struct request *rq;
+	int dispatched = 0;
+
+	fgq_slice_expired(fd);
+
+	while (fd->left) {
+		fg = rb_entry(fd->left, struct fgq_group, rb_node);
+		while ((rq = fgq_choose_request(fg, READ)) != NULL) {
+			fgq_dispatch_request(fd, fg, rq);
+			dispatched++;
+		}
+	}
+
+	BUG_ON(fd->nr_queued);
+	return dispatched;
+}
+
+static int
+fgq_dispatch_requests(struct request_queue *q, int force)
+{
+	struct fgq_data *fd = q->elevator->elevator_data;
+	struct fgq_group *fg;
+	struct request *rq;
+
+	if (unlikely(force))
+		return fgq_forced_dispatch(fd);
+
+	/* End the active slice if it ran out of time or requests */
+	fg = fd->active_group;
+	if (fg && (time_after_eq(jiffies, fg->slice_end) ||
+		   fgq_group_empty(fg)))
+		fgq_slice_expired(fd);
+
+	if (!fd->active_group)
+		fgq_set_active_group(fd);
+
+	fg = fd->active_group;
+	if (!fg)
+		return 0;
+
+	rq = fgq_group_next_request(fd, fg);
+	BUG_ON(!rq);
+
+	/* Dispatch request */
+	fgq_dispatch_request(fd, fg, rq);
+
+	/* No idling: give up the disk as soon as the group has nothing left */
+	if (fgq_group_empty(fg))
+		fgq_slice_expired(fd);
+
+	return 1;
+}
+
+static void
+fgq_completed_request(struct request_queue *q, struct request *rq)
+{
+	struct fgq_data *fd = q->elevator->elevator_data;
+
+	blkiocg_update_completion_stats(&fgq_rq_group(fd, rq)->blkg,
+					rq_start_time_ns(rq),
+					rq_io_start_time_ns(rq),
+					rq_data_dir(rq), rq_is_sync(rq));
+}
+
+static struct request *
+fgq_former_request(struct request_queue *q, struct request *rq)
+{
+	struct fgq_data *fd = q->elevator->elevator_data;
+	struct fgq_group *fg = fgq_rq_group(fd, rq);
+	const int sync = rq_is_sync(rq);
+	const int data_dir = rq_data_dir(rq);
+
+	if (rq->queuelist.prev == &fg->fifo_list[sync][data_dir])
+		return NULL;
+
+	/* Return former request */
+	return list_entry(rq->queuelist.prev, struct request, queuelist);
+}
+
+static struct request *
+fgq_latter_request(struct request_queue *q, struct request *rq)
+{
+	struct fgq_data *fd = q->elevator->elevator_data;
+	struct fgq_group *fg = fgq_rq_group(fd, rq);
+	const int sync = rq_is_sync(rq);
+	const int data_dir = rq_data_dir(rq);
+
+	if (rq->queuelist.next == &fg->fifo_list[sync][data_dir])
+		return NULL;
+
+	/* Return latter request */
+	return list_entry(rq->queuelist.next, struct request, queuelist);
+}
+
+static void *
+fgq_init_queue(struct request_queue *q)
+{
+	struct fgq_data *fd;
+
+	/* Allocate structure */
+	fd = kzalloc_node(sizeof(*fd), GFP_KERNEL, q->node);
+	if (!fd)
+		return NULL;
+
+	fd->queue = q;
+	fd->service_tree = RB_ROOT;
+	INIT_HLIST_HEAD(&fd->group_list);
+
+	/*
+	 * The root group is embedded and its initial reference is never
+	 * dropped, so fgq_put_group() never tries to free it.
+	 */
+	fgq_init_group(fd, &fd->root_group);
+	fd->root_group.weight = blkio_root_cgroup.weight;
+	rcu_read_lock();
+	blkiocg_add_blkio_group(&blkio_root_cgroup, &fd->root_group.blkg,
+				(void *)fd, 0, BLKIO_POLICY_PROP);
+	rcu_read_unlock();
+
+	/* Initialize data */
+	fd->fifo_expire[SYNC][READ] = sync_read_expire;
+	fd->fifo_expire[SYNC][WRITE] = sync_write_expire;
+	fd->fifo_expire[ASYNC][READ] = async_read_expire;
+	fd->fifo_expire[ASYNC][WRITE] = async_write_expire;
+	fd->fifo_batch = fifo_batch;
+	fd->writes_starved = writes_starved;
+	fd->group_slice[SYNC] = group_slice_sync;
+	fd->group_slice[ASYNC] = group_slice_async;
+
+	return fd;
+}
+
+static void fgq_free_data(struct rcu_head *head)
+{
+	kfree(container_of(head, struct fgq_data, rcu));
+}
+
+static void
+fgq_exit_queue(struct elevator_queue *e)
+{
+	struct fgq_data *fd = e->elevator_data;
+	struct request_queue *q = fd->queue;
+	struct hlist_node *pos, *n;
+	struct fgq_group *fg;
+
+	BUG_ON(fd->nr_queued);
+
+	spin_lock_irq(q->queue_lock);
+
+	hlist_for_each_entry_safe(fg, pos, n, &fd->group_list, fd_node) {
+		/*
+		 * If the cgroup removal path got to the group first it has
+		 * already destroyed it.
+		 */
+		if (!blkiocg_del_blkio_group(&fg->blkg))
+			fgq_destroy_group(fd, fg);
+	}
+	blkiocg_del_blkio_group(&fd->root_group.blkg);
+
+	spin_unlock_irq(q->queue_lock);
+
+	/* Wait for fg->blkg->key accessors to exit their grace periods. */
+	call_rcu(&fd->rcu, fgq_free_data);
+}
+
+/*
+ * sysfs code
+ */
+
+static ssize_t
+fgq_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+fgq_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct fgq_data *fd = e->elevator_data;				\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return fgq_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(fgq_sync_read_expire_show, fd->fifo_expire[SYNC][READ], 1);
+SHOW_FUNCTION(fgq_sync_write_expire_show, fd->fifo_expire[SYNC][WRITE], 1);
+SHOW_FUNCTION(fgq_async_read_expire_show, fd->fifo_expire[ASYNC][READ], 1);
+SHOW_FUNCTION(fgq_async_write_expire_show, fd->fifo_expire[ASYNC][WRITE], 1);
+SHOW_FUNCTION(fgq_fifo_batch_show, fd->fifo_batch, 0);
+SHOW_FUNCTION(fgq_writes_starved_show, fd->writes_starved, 0);
+SHOW_FUNCTION(fgq_group_slice_sync_show, fd->group_slice[SYNC], 1);
+SHOW_FUNCTION(fgq_group_slice_async_show, fd->group_slice[ASYNC], 1);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct fgq_data *fd = e->elevator_data;				\
+	int __data;							\
+	int ret = fgq_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(fgq_sync_read_expire_store, &fd->fifo_expire[SYNC][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(fgq_sync_write_expire_store, &fd->fifo_expire[SYNC][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(fgq_async_read_expire_store, &fd->fifo_expire[ASYNC][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(fgq_async_write_expire_store, &fd->fifo_expire[ASYNC][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(fgq_fifo_batch_store, &fd->fifo_batch, 0, INT_MAX, 0);
+STORE_FUNCTION(fgq_writes_starved_store, &fd->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(fgq_group_slice_sync_store, &fd->group_slice[SYNC], 1, INT_MAX, 1);
+STORE_FUNCTION(fgq_group_slice_async_store, &fd->group_slice[ASYNC], 1, INT_MAX, 1);
+#undef STORE_FUNCTION
+
+#define FGQ_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, fgq_##name##_show, \
+				      fgq_##name##_store)
+
+static struct elv_fs_entry fgq_attrs[] = {
+	FGQ_ATTR(sync_read_expire),
+	FGQ_ATTR(sync_write_expire),
+	FGQ_ATTR(async_read_expire),
+	FGQ_ATTR(async_write_expire),
+	FGQ_ATTR(fifo_batch),
+	FGQ_ATTR(writes_starved),
+	FGQ_ATTR(group_slice_sync),
+	FGQ_ATTR(group_slice_async),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_fgq = {
+	.ops = {
+		.elevator_merge_req_fn		= fgq_merged_requests,
+		.elevator_allow_merge_fn	= fgq_allow_merge,
+		.elevator_bio_merged_fn		= fgq_bio_merged,
+		.elevator_dispatch_fn		= fgq_dispatch_requests,
+		.elevator_add_req_fn		= fgq_add_request,
+		.elevator_queue_empty_fn	= fgq_queue_empty,
+		.elevator_completed_req_fn	= fgq_completed_request,
+		.elevator_former_req_fn		= fgq_former_request,
+		.elevator_latter_req_fn		= fgq_latter_request,
+		.elevator_set_req_fn		= fgq_set_request,
+		.elevator_put_req_fn		= fgq_put_request,
+		.elevator_init_fn		= fgq_init_queue,
+		.elevator_exit_fn		= fgq_exit_queue,
+	},
+
+	.elevator_attrs = fgq_attrs,
+	.elevator_name = "fgq",
+	.elevator_owner = THIS_MODULE,
+};
+
+static struct blkio_policy_type blkio_policy_fgq = {
+	.ops = {
+		.blkio_unlink_group_fn =	fgq_unlink_blkio_group,
+		.blkio_update_group_weight_fn =	fgq_update_blkio_group_weight,
+	},
+	.plid = BLKIO_POLICY_PROP,
+};
+
+static int __init fgq_init(void)
+{
+	elv_register(&iosched_fgq);
+	blkio_policy_register(&blkio_policy_fgq);
+
+	return 0;
+}
+
+static void __exit fgq_exit(void)
+{
+	blkio_policy_unregister(&blkio_policy_fgq);
+	elv_unregister(&iosched_fgq);
+	/* wait for the fgq_data of exited queues to be freed */
+	rcu_barrier();
+}
+
+module_init(fgq_init);
+module_exit(fgq_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Flash Group Queueing IO scheduler");
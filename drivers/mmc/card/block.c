@@ -56,6 +56,15 @@ static DEFINE_MUTEX(block_mutex);
  */
 static int perdev_minors = CONFIG_MMC_BLOCK_MINORS;
 
+/*
+ * Non-secure discards are queued and issued once the card has been idle
+ * for this many milliseconds. 0 issues them synchronously.
+ */
+static unsigned int discard_idle_ms = 500;
+
+/* Pending discard extents above which they are issued immediately */
+static unsigned int discard_max_extents = 128;
+
 /*
  * We've only got one major, so number of mmcblk devices is
  * limited to 256 / number of minors per device.
@@ -79,6 +88,21 @@ struct mmc_blk_data {
 
 	unsigned int	usage;
 	unsigned int	read_only;
+
+	/*
+	 * Discards deferred to idle time, sorted by sector and neither
+	 * overlapping nor adjacent. Protected by queue.thread_sem.
+	 */
+	struct list_head discard_list;
+	unsigned int	discard_extents;
+	unsigned int	discard_sectors;
+	unsigned long	discard_delay;	/* idle jiffies, 0 if not deferring */
+};
+
+struct mmc_blk_discard {
+	struct list_head list;
+	unsigned int	from;
+	unsigned int	nr;
 };
 
 static DEFINE_MUTEX(open_lock);
@@ -86,6 +110,14 @@ static DEFINE_MUTEX(open_lock);
 module_param(perdev_minors, int, 0444);
 MODULE_PARM_DESC(perdev_minors, "Minors numbers to allocate per device");
 
+module_param(discard_idle_ms, uint, 0444);
+MODULE_PARM_DESC(discard_idle_ms, "Idle time before deferred discards are issued, 0 to not defer");
+
+module_param(discard_max_extents, uint, 0644);
+MODULE_PARM_DESC(discard_max_extents, "Maximum number of deferred discard extents");
+
+static void mmc_blk_discard_free(struct mmc_blk_data *md);
+
 static struct mmc_blk_data *mmc_blk_get(struct gendisk *disk)
 {
 	struct mmc_blk_data *md;
@@ -109,6 +141,7 @@ static void mmc_blk_put(struct mmc_blk_data *md)
 		int devidx = md->disk->first_minor / perdev_minors;
 
 		blk_cleanup_queue(md->queue.queue);
+		mmc_blk_discard_free(md);
 
 		__clear_bit(devidx, dev_use);
 
@@ -263,6 +296,266 @@ static u32 get_card_status(struct mmc_card *card, struct request *req)
 	return cmd.resp[0];
 }
 
+/*
+ * Deferred discards
+ *
+ * ext4 online discard and similar users issue a discard for every freed
+ * extent, and an erase can keep the card busy for a long time. Instead of
+ * stalling the reads and writes queued behind them, non-secure discards
+ * are completed right away and remembered in md->discard_list, merged
+ * with adjacent and overlapping ranges. Once the queue has been idle for
+ * discard_idle_ms, they are issued one erase group aligned chunk at a
+ * time, checking for new requests in between.
+ *
+ * A discard is only a hint, so pending ranges may always be dropped, but
+ * they must never be issued after a write to the same sectors: writes
+ * cut their range out of the list before they are issued. Deferring also
+ * means discarded sectors can still read back old data, so the queue does
+ * not advertise discard_zeroes_data while deferring.
+ */
+
+static void mmc_blk_discard_del(struct mmc_blk_data *md,
+				struct mmc_blk_discard *d)
+{
+	list_del(&d->list);
+	md->discard_extents--;
+	kfree(d);
+}
+
+static void mmc_blk_discard_free(struct mmc_blk_data *md)
+{
+	struct mmc_blk_discard *d, *tmp;
+
+	list_for_each_entry_safe(d, tmp, &md->discard_list, list)
+		mmc_blk_discard_del(md, d);
+	md->discard_sectors = 0;
+}
+
+/*
+ * Add [from, from + nr) to the pending discards, merging it with any
+ * extent it overlaps or touches.
+ */
+static int mmc_blk_discard_add(struct mmc_blk_data *md, unsigned int from,
+			       unsigned int nr)
+{
+	unsigned int to = from + nr;
+	struct mmc_blk_discard *d, *tmp, *new;
+	struct list_head *pos = &md->discard_list;
+
+	list_for_each_entry_safe(d, tmp, &md->discard_list, list) {
+		if (d->from + d->nr < from) {
+			pos = &d->list;
+			continue;
+		}
+		if (d->from > to)
+			break;
+		/* overlapping or adjacent, absorb it */
+		from = min(from, d->from);
+		to = max(to, d->from + d->nr);
+		md->discard_sectors -= d->nr;
+		pos = d->list.prev;
+		mmc_blk_discard_del(md, d);
+	}
+
+	new = kmalloc(sizeof(*new), GFP_NOIO);
+	if (!new)
+		return -ENOMEM;
+
+	new->from = from;
+	new->nr = to - from;
+	list_add(&new->list, pos);
+	md->discard_extents++;
+	md->discard_sectors += new->nr;
+
+	return 0;
+}
+
+/*
+ * Drop [from, from + nr) from the pending discards, about to be written.
+ */
+static void mmc_blk_discard_cancel(struct mmc_blk_data *md, unsigned int from,
+				   unsigned int nr)
+{
+	unsigned int to = from + nr;
+	struct mmc_blk_discard *d, *tmp, *tail;
+
+	list_for_each_entry_safe(d, tmp, &md->discard_list, list) {
+		unsigned int end = d->from + d->nr;
+
+		if (end <= from)
+			continue;
+		if (d->from >= to)
+			break;
+
+		if (d->from < from && end > to) {
+			/*
+			 * The write splits the extent. If the tail cannot be
+			 * allocated, just forget about it.
+			 */
+			tail = kmalloc(sizeof(*tail), GFP_NOIO);
+			if (tail) {
+				tail->from = to;
+				tail->nr = end - to;
+				list_add(&tail->list, &d->list);
+				md->discard_extents++;
+			} else
+				md->discard_sectors -= end - to;
+			md->discard_sectors -= to - from;
+			d->nr = from - d->from;
+			break;
+		}
+
+		if (d->from < from) {
+			md->discard_sectors -= end - from;
+			d->nr = from - d->from;
+		} else if (end > to) {
+			md->discard_sectors -= to - d->from;
+			d->nr = end - to;
+			d->from = to;
+		} else {
+			md->discard_sectors -= d->nr;
+			mmc_blk_discard_del(md, d);
+		}
+	}
+}
+
+/*
+ * Issue the first chunk of the first pending extent. Erase groups fully
+ * covered are erased, at most pref_erase sectors at a time; partial
+ * groups at either end are trimmed if the card can, else dropped.
+ */
+static int mmc_blk_discard_issue_one(struct mmc_blk_data *md)
+{
+	struct mmc_card *card = md->queue.card;
+	struct mmc_blk_discard *d;
+	unsigned int group = card->erase_size;
+	unsigned int from, nr, rem, arg;
+	int err = 0;
+
+	if (list_empty(&md->discard_list))
+		return 0;
+
+	d = list_first_entry(&md->discard_list, struct mmc_blk_discard, list);
+	from = d->from;
+	nr = d->nr;
+	rem = from % group;
+
+	if (rem) {
+		nr = min(nr, group - rem);
+		arg = MMC_TRIM_ARG;
+	} else if (nr >= group) {
+		nr = min(rounddown(nr, group), card->pref_erase);
+		arg = MMC_ERASE_ARG;
+	} else
+		arg = MMC_TRIM_ARG;
+
+	if (arg == MMC_ERASE_ARG || mmc_can_trim(card)) {
+		mmc_claim_host(card->host);
+		err = mmc_erase(card, from, nr, arg);
+		mmc_release_host(card->host);
+		if (err)
+			printk(KERN_WARNING "%s: deferred discard of %u "
+			       "sectors at %u failed: %d\n",
+			       md->disk->disk_name, nr, from, err);
+	}
+
+	d->from += nr;
+	d->nr -= nr;
+	md->discard_sectors -= nr;
+	if (!d->nr)
+		mmc_blk_discard_del(md, d);
+
+	return err;
+}
+
+static void mmc_blk_discard_flush(struct mmc_blk_data *md)
+{
+	while (!list_empty(&md->discard_list))
+		mmc_blk_discard_issue_one(md);
+}
+
+static void mmc_blk_discard_set_idle(struct mmc_blk_data *md,
+				     unsigned long delay)
+{
+	md->queue.idle_delay = list_empty(&md->discard_list) ? 0 : delay;
+}
+
+/* Called by the queue thread once it has been idle for idle_delay */
+static void mmc_blk_idle(struct mmc_queue *mq)
+{
+	struct mmc_blk_data *md = mq->data;
+
+#ifdef CONFIG_MMC_BLOCK_DEFERRED_RESUME
+	/* Do not wake up a suspended card just to discard */
+	if (mmc_bus_needs_resume(mq->card->host)) {
+		mq->idle_delay = 0;
+		return;
+	}
+#endif
+
+	mmc_blk_discard_issue_one(md);
+
+	/* Still idle: continue right away, new requests are checked first */
+	mmc_blk_discard_set_idle(md, 1);
+}
+
+static int mmc_blk_defer_discard_rq(struct mmc_queue *mq, struct request *req)
+{
+	struct mmc_blk_data *md = mq->data;
+	int err;
+
+	err = mmc_blk_discard_add(md, blk_rq_pos(req), blk_rq_sectors(req));
+	if (err || md->discard_extents > discard_max_extents)
+		mmc_blk_discard_flush(md);
+
+	spin_lock_irq(&md->lock);
+	__blk_end_request(req, 0, blk_rq_bytes(req));
+	spin_unlock_irq(&md->lock);
+
+	return 1;
+}
+
+static ssize_t mmc_blk_discard_pending_show(struct device *dev,
+					    struct device_attribute *attr,
+					    char *buf)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	ssize_t ret;
+
+	if (!md)
+		return -ENODEV;
+
+	ret = sprintf(buf, "%u %u\n", md->discard_extents,
+		      md->discard_sectors);
+	mmc_blk_put(md);
+
+	return ret;
+}
+
+/* Writing anything issues all pending discards now, like FITRIM */
+static ssize_t mmc_blk_discard_pending_store(struct device *dev,
+					     struct device_attribute *attr,
+					     const char *buf, size_t count)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+
+	if (!md)
+		return -ENODEV;
+
+	/* Keep the queue thread out, like mmc_queue_suspend() */
+	down(&md->queue.thread_sem);
+	mmc_blk_discard_flush(md);
+	mmc_blk_discard_set_idle(md, 0);
+	up(&md->queue.thread_sem);
+
+	mmc_blk_put(md);
+
+	return count;
+}
+
+static DEVICE_ATTR(discard_pending, S_IRUGO | S_IWUSR,
+		   mmc_blk_discard_pending_show, mmc_blk_discard_pending_store);
+
 static int mmc_blk_issue_discard_rq(struct mmc_queue *mq, struct request *req)
 {
 	struct mmc_blk_data *md = mq->data;
@@ -270,6 +563,9 @@ static int mmc_blk_issue_discard_rq(struct mmc_queue *mq, struct request *req)
 	unsigned int from, nr, arg;
 	int err = 0;
 
+	if (md->discard_delay && mmc_can_erase(card))
+		return mmc_blk_defer_discard_rq(mq, req);
+
 	mmc_claim_host(card->host);
 
 	if (!mmc_can_erase(card)) {
@@ -653,8 +949,9 @@ mmc_blk_set_blksize(struct mmc_blk_data *md, struct mmc_card *card);
 
 static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 {
-#ifdef CONFIG_MMC_BLOCK_DEFERRED_RESUME
 	struct mmc_blk_data *md = mq->data;
+	int ret;
+#ifdef CONFIG_MMC_BLOCK_DEFERRED_RESUME
 	struct mmc_card *card = md->queue.card;
 
 	if (mmc_bus_needs_resume(card->host)) {
@@ -663,16 +960,26 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 	}
 #endif
 
+	if (!(req->cmd_flags & (REQ_DISCARD | REQ_FLUSH)) &&
+	    rq_data_dir(req) == WRITE)
+		mmc_blk_discard_cancel(md, blk_rq_pos(req),
+				       blk_rq_sectors(req));
+
 	if (req->cmd_flags & REQ_DISCARD) {
 		if (req->cmd_flags & REQ_SECURE)
-			return mmc_blk_issue_secdiscard_rq(mq, req);
+			ret = mmc_blk_issue_secdiscard_rq(mq, req);
 		else
-			return mmc_blk_issue_discard_rq(mq, req);
+			ret = mmc_blk_issue_discard_rq(mq, req);
 	} else if (req->cmd_flags & REQ_FLUSH) {
-		return mmc_blk_issue_flush(mq, req);
+		ret = mmc_blk_issue_flush(mq, req);
 	} else {
-		return mmc_blk_issue_rw_rq(mq, req);
+		ret = mmc_blk_issue_rw_rq(mq, req);
 	}
+
+	/* The card was busy, wait for it to become idle again */
+	mmc_blk_discard_set_idle(md, md->discard_delay);
+
+	return ret;
 }
 
 static inline int mmc_blk_readonly(struct mmc_card *card)
@@ -718,8 +1025,16 @@ static struct mmc_blk_data *mmc_blk_alloc(struct mmc_card *card)
 		goto err_putdisk;
 
 	md->queue.issue_fn = mmc_blk_issue_rq;
+	md->queue.idle_fn = mmc_blk_idle;
 	md->queue.data = md;
 
+	INIT_LIST_HEAD(&md->discard_list);
+	if (discard_idle_ms && mmc_can_erase(card)) {
+		md->discard_delay = msecs_to_jiffies(discard_idle_ms) ? : 1;
+		/* Deferred discards cannot guarantee reading back zeroes */
+		md->queue.queue->limits.discard_zeroes_data = 0;
+	}
+
 	md->disk->major	= MMC_BLOCK_MAJOR;
 	md->disk->first_minor = devidx * perdev_minors;
 	md->disk->fops = &mmc_bdops;
@@ -834,6 +1149,9 @@ static int mmc_blk_probe(struct mmc_card *card)
 	mmc_set_bus_resume_policy(card->host, 1);
 #endif
 	add_disk(md->disk);
+	if (device_create_file(disk_to_dev(md->disk), &dev_attr_discard_pending))
+		printk(KERN_WARNING "%s: unable to create discard_pending\n",
+		       md->disk->disk_name);
 	return 0;
 
  out:
@@ -848,6 +1166,9 @@ static void mmc_blk_remove(struct mmc_card *card)
 	struct mmc_blk_data *md = mmc_get_drvdata(card);
 
 	if (md) {
+		device_remove_file(disk_to_dev(md->disk),
+				   &dev_attr_discard_pending);
+
 		/* Stop new requests from getting into the queue */
 		del_gendisk(md->disk);
 
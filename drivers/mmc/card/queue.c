@@ -69,13 +69,22 @@ static int mmc_queue_thread(void *d)
 		spin_unlock_irq(q->queue_lock);
 
 		if (!req) {
+			unsigned long idle_delay = mq->idle_delay;
+
 			if (kthread_should_stop()) {
 				set_current_state(TASK_RUNNING);
 				break;
 			}
 			up(&mq->thread_sem);
-			schedule();
-			down(&mq->thread_sem);
+			if (!idle_delay) {
+				schedule();
+				down(&mq->thread_sem);
+			} else if (!schedule_timeout(idle_delay)) {
+				/* Nothing came in while we waited */
+				down(&mq->thread_sem);
+				mq->idle_fn(mq);
+			} else
+				down(&mq->thread_sem);
 			continue;
 		}
 		set_current_state(TASK_RUNNING);
@@ -11,6 +11,9 @@ struct mmc_queue {
 	unsigned int		flags;
 	struct request		*req;
 	int			(*issue_fn)(struct mmc_queue *, struct request *);
+	/* called once the queue has been idle for idle_delay jiffies */
+	void			(*idle_fn)(struct mmc_queue *);
+	unsigned long		idle_delay;	/* 0 if there is no idle work */
 	void			*data;
 	struct request_queue	*queue;
 	struct scatterlist	*sg;
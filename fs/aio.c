@@ -37,6 +37,7 @@
 #include <linux/mempool.h>
 #include <linux/hash.h>
 #include <linux/compat.h>
+#include <linux/cred.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -51,6 +52,7 @@
 static DEFINE_SPINLOCK(aio_nr_lock);
 unsigned long aio_nr;		/* current system wide number of aio requests */
 unsigned long aio_max_nr = 0x10000; /* system wide maximum number of aio requests */
+int aio_buffered = 1;		/* may buffered i/o and fsync use aio_buffered_wq */
 /*----end sysctl variables---*/
 
 static struct kmem_cache	*kiocb_cachep;
@@ -58,6 +60,28 @@ static struct kmem_cache	*kioctx_cachep;
 
 static struct workqueue_struct *aio_wq;
 
+/*
+ * Buffered reads and writes of regular files, and fsync through
+ * vfs_fsync(), would otherwise be run by io_submit.  Unless
+ * aio_buffered is off, most of them go to these workers instead.
+ * Reads of cached data and a few others still run in the submitter,
+ * see aio_defer_iocb().
+ *
+ * The workers mostly sleep on I/O, so allow a few per CPU to do so at
+ * once.  Further requests wait for a free worker.
+ */
+static struct workqueue_struct *aio_buffered_wq;
+#define AIO_BUFFERED_PER_CPU	4
+
+/* Longer reads are deferred without looking them up in the page cache */
+#define AIO_CACHED_READ_PAGES	64
+
+struct aio_buffered_work {
+	struct work_struct	work;
+	struct kiocb		*iocb;
+	const struct cred	*cred;
+};
+
 /* Used for rare fput completion. */
 static void aio_fput_routine(struct work_struct *);
 static DECLARE_WORK(fput_work, aio_fput_routine);
@@ -86,8 +110,11 @@ static int __init aio_setup(void)
 	kioctx_cachep = KMEM_CACHE(kioctx,SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 
 	aio_wq = create_workqueue("aio");
+	aio_buffered_wq = alloc_workqueue("aio_buffered", WQ_UNBOUND,
+			min_t(int, num_possible_cpus() * AIO_BUFFERED_PER_CPU,
+			      WQ_UNBOUND_MAX_ACTIVE));
 	abe_pool = mempool_create_kmalloc_pool(1, sizeof(struct aio_batch_entry));
-	BUG_ON(!aio_wq || !abe_pool);
+	BUG_ON(!aio_wq || !aio_buffered_wq || !abe_pool);
 
 	pr_debug("aio_setup: sizeof(struct page) = %d\n", (int)sizeof(struct page));
 
@@ -1007,21 +1034,21 @@ put_rq:
 }
 EXPORT_SYMBOL(aio_complete);
 
-/* aio_read_evt
- *	Pull an event off of the ioctx's event ring.  Returns the number of 
- *	events fetched (0 or 1 ;-)
+/* aio_read_evts
+ *	Pull up to nr events off of the ioctx's event ring, with one
+ *	update of the head for all of them.  Returns the number of
+ *	events fetched.
  *	FIXME: make this use cmpxchg.
- *	TODO: make the ringbuffer user mmap()able (requires FIXME).
  */
-static int aio_read_evt(struct kioctx *ioctx, struct io_event *ent)
+static int aio_read_evts(struct kioctx *ioctx, struct io_event *ent, int nr)
 {
 	struct aio_ring_info *info = &ioctx->ring_info;
 	struct aio_ring *ring;
-	unsigned long head;
+	unsigned long head, tail;
 	int ret = 0;
 
 	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
-	dprintk("in aio_read_evt h%lu t%lu m%lu\n",
+	dprintk("in aio_read_evts h%lu t%lu m%lu\n",
 		 (unsigned long)ring->head, (unsigned long)ring->tail,
 		 (unsigned long)ring->nr);
 
@@ -1031,20 +1058,23 @@ static int aio_read_evt(struct kioctx *ioctx, struct io_event *ent)
 	spin_lock(&info->ring_lock);
 
 	head = ring->head % info->nr;
-	if (head != ring->tail) {
+	tail = ring->tail;
+	smp_rmb(); /* read the tail before the events */
+	while (ret < nr && head != tail) {
 		struct io_event *evp = aio_ring_event(info, head, KM_USER1);
-		*ent = *evp;
+		ent[ret++] = *evp;
+		put_aio_ring_event(evp, KM_USER1);
 		head = (head + 1) % info->nr;
-		smp_mb(); /* finish reading the event before updatng the head */
+	}
+	if (ret) {
+		smp_mb(); /* finish reading the events before updating the head */
 		ring->head = head;
-		ret = 1;
-		put_aio_ring_event(evp, KM_USER1);
 	}
 	spin_unlock(&info->ring_lock);
 
 out:
 	kunmap_atomic(ring, KM_USER0);
-	dprintk("leaving aio_read_evt: %d  h%lu t%lu\n", ret,
+	dprintk("leaving aio_read_evts: %d  h%lu t%lu\n", ret,
 		 (unsigned long)ring->head, (unsigned long)ring->tail);
 	return ret;
 }
@@ -1095,35 +1125,33 @@ static int read_events(struct kioctx *ctx,
 	DECLARE_WAITQUEUE(wait, tsk);
 	int			ret;
 	int			i = 0;
-	struct io_event		ent;
+	struct io_event		ent[AIO_EVENTS_BATCH];
 	struct aio_timeout	to;
 	int			retry = 0;
 
 	/* needed to zero any padding within an entry (there shouldn't be 
 	 * any, but C is fun!
 	 */
-	memset(&ent, 0, sizeof(ent));
+	memset(ent, 0, sizeof(ent));
 retry:
 	ret = 0;
 	while (likely(i < nr)) {
-		ret = aio_read_evt(ctx, &ent);
+		ret = aio_read_evts(ctx, ent, min_t(long, nr - i,
+						    AIO_EVENTS_BATCH));
 		if (unlikely(ret <= 0))
 			break;
 
-		dprintk("read event: %Lx %Lx %Lx %Lx\n",
-			ent.data, ent.obj, ent.res, ent.res2);
-
 		/* Could we split the check in two? */
-		ret = -EFAULT;
-		if (unlikely(copy_to_user(event, &ent, sizeof(ent)))) {
-			dprintk("aio: lost an event due to EFAULT.\n");
+		if (unlikely(copy_to_user(event, ent, ret * sizeof(*ent)))) {
+			dprintk("aio: lost events due to EFAULT.\n");
+			ret = -EFAULT;
 			break;
 		}
-		ret = 0;
 
-		/* Good, event copied to userland, update counts. */
-		event ++;
-		i ++;
+		/* Good, events copied to userland, update counts. */
+		event += ret;
+		i += ret;
+		ret = 0;
 	}
 
 	if (min_nr <= i)
@@ -1154,7 +1182,8 @@ retry:
 		add_wait_queue_exclusive(&ctx->wait, &wait);
 		do {
 			set_task_state(tsk, TASK_INTERRUPTIBLE);
-			ret = aio_read_evt(ctx, &ent);
+			ret = aio_read_evts(ctx, ent, min_t(long, nr - i,
+							    AIO_EVENTS_BATCH));
 			if (ret)
 				break;
 			if (min_nr <= i)
@@ -1175,7 +1204,6 @@ retry:
 				ret = -EINTR;
 				break;
 			}
-			/*ret = aio_read_evt(ctx, &ent);*/
 		} while (1) ;
 
 		set_task_state(tsk, TASK_RUNNING);
@@ -1184,15 +1212,15 @@ retry:
 		if (unlikely(ret <= 0))
 			break;
 
-		ret = -EFAULT;
-		if (unlikely(copy_to_user(event, &ent, sizeof(ent)))) {
-			dprintk("aio: lost an event due to EFAULT.\n");
+		if (unlikely(copy_to_user(event, ent, ret * sizeof(*ent)))) {
+			dprintk("aio: lost events due to EFAULT.\n");
+			ret = -EFAULT;
 			break;
 		}
 
-		/* Good, event copied to userland, update counts. */
-		event ++;
-		i ++;
+		/* Good, events copied to userland, update counts. */
+		event += ret;
+		i += ret;
 	}
 
 	if (timeout)
@@ -1389,6 +1417,12 @@ static ssize_t aio_fsync(struct kiocb *iocb)
 	return ret;
 }
 
+/* Normally run by the aio_buffered workers, see aio_defer_iocb() */
+static ssize_t aio_vfs_fsync(struct kiocb *iocb)
+{
+	return vfs_fsync(iocb->ki_filp, iocb->ki_opcode == IOCB_CMD_FDSYNC);
+}
+
 static ssize_t aio_setup_vectored_rw(int type, struct kiocb *kiocb, bool compat)
 {
 	ssize_t ret;
@@ -1508,11 +1542,15 @@ static ssize_t aio_setup_iocb(struct kiocb *kiocb, bool compat)
 		ret = -EINVAL;
 		if (file->f_op->aio_fsync)
 			kiocb->ki_retry = aio_fdsync;
+		else if (file->f_op->fsync && aio_buffered)
+			kiocb->ki_retry = aio_vfs_fsync;
 		break;
 	case IOCB_CMD_FSYNC:
 		ret = -EINVAL;
 		if (file->f_op->aio_fsync)
 			kiocb->ki_retry = aio_fsync;
+		else if (file->f_op->fsync && aio_buffered)
+			kiocb->ki_retry = aio_vfs_fsync;
 		break;
 	default:
 		dprintk("EINVAL: io_submit: no operation provided\n");
@@ -1525,6 +1563,128 @@ static ssize_t aio_setup_iocb(struct kiocb *kiocb, bool compat)
 	return 0;
 }
 
+/*
+ * aio_buffered_work:
+ *	Runs a deferred iocb in the submitter's mm and with its
+ *	credentials, holding the reference to the iocb the submitter
+ *	gave us.
+ */
+static void aio_buffered_work(struct work_struct *work)
+{
+	struct aio_buffered_work *abw =
+		container_of(work, struct aio_buffered_work, work);
+	struct kiocb *iocb = abw->iocb;
+	struct kioctx *ctx = iocb->ki_ctx;
+	mm_segment_t oldfs = get_fs();
+	const struct cred *old_cred;
+
+	set_fs(USER_DS);
+	use_mm(ctx->mm);
+	old_cred = override_creds(abw->cred);
+
+	spin_lock_irq(&ctx->ctx_lock);
+	aio_run_iocb(iocb);
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	revert_creds(old_cred);
+	unuse_mm(ctx->mm);
+	set_fs(oldfs);
+
+	aio_put_req(iocb);
+	put_cred(abw->cred);
+	kfree(abw);
+}
+
+/*
+ * aio_read_cached:
+ *	Returns true if every page of the read, up to the end of the
+ *	file, is in the page cache and up to date.  Such a read only
+ *	copies, and a worker would add a context switch to it.
+ */
+static bool aio_read_cached(struct kiocb *iocb)
+{
+	struct address_space *mapping = iocb->ki_filp->f_mapping;
+	loff_t end = min_t(loff_t, iocb->ki_pos + iocb->ki_left,
+			   i_size_read(mapping->host));
+	pgoff_t index, last;
+
+	if (iocb->ki_pos >= end)
+		return true;
+
+	index = iocb->ki_pos >> PAGE_CACHE_SHIFT;
+	last = (end - 1) >> PAGE_CACHE_SHIFT;
+	if (last - index >= AIO_CACHED_READ_PAGES)
+		return false;
+
+	for (; index <= last; index++) {
+		struct page *page = find_get_page(mapping, index);
+		bool uptodate = page && PageUptodate(page);
+
+		if (page)
+			page_cache_release(page);
+		if (!uptodate)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * aio_defer_iocb:
+ *	Returns the work to queue the iocb on aio_buffered_wq with, or
+ *	NULL if the submitter runs it itself.  It does so when the
+ *	workers are turned off, for reads whose pages are all cached,
+ *	for writes that may hit RLIMIT_FSIZE, for requests the workers
+ *	don't handle, and when the work can't be allocated.  Writes and
+ *	fsync are always deferred otherwise, even if they would not
+ *	have blocked.
+ */
+static struct aio_buffered_work *aio_defer_iocb(struct kiocb *iocb)
+{
+	struct file *file = iocb->ki_filp;
+	struct aio_buffered_work *abw;
+	unsigned long limit;
+
+	if (!aio_buffered)
+		return NULL;
+
+	switch (iocb->ki_opcode) {
+	case IOCB_CMD_PWRITE:
+	case IOCB_CMD_PWRITEV:
+		/* RLIMIT_FSIZE and its SIGXFSZ are the submitter's */
+		limit = rlimit(RLIMIT_FSIZE);
+		if (limit != RLIM_INFINITY &&
+		    ((file->f_flags & O_APPEND) ||
+		     iocb->ki_pos + iocb->ki_left > limit))
+			return NULL;
+		/* fall through */
+	case IOCB_CMD_PREAD:
+	case IOCB_CMD_PREADV:
+		if (!S_ISREG(file->f_mapping->host->i_mode) ||
+		    (file->f_flags & O_DIRECT))
+			return NULL;
+		if ((iocb->ki_opcode == IOCB_CMD_PREAD ||
+		     iocb->ki_opcode == IOCB_CMD_PREADV) &&
+		    aio_read_cached(iocb))
+			return NULL;
+		break;
+	case IOCB_CMD_FSYNC:
+	case IOCB_CMD_FDSYNC:
+		if (iocb->ki_retry != aio_vfs_fsync)
+			return NULL;
+		break;
+	default:
+		return NULL;
+	}
+
+	abw = kmalloc(sizeof(*abw), GFP_KERNEL);
+	if (!abw)
+		return NULL;
+	INIT_WORK(&abw->work, aio_buffered_work);
+	abw->iocb = iocb;
+	abw->cred = get_current_cred();
+	return abw;
+}
+
 static void aio_batch_add(struct address_space *mapping,
 			  struct hlist_head *batch_hash)
 {
@@ -1577,6 +1737,7 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 			 struct iocb *iocb, struct hlist_head *batch_hash,
 			 bool compat)
 {
+	struct aio_buffered_work *abw;
 	struct kiocb *req;
 	struct file *file;
 	ssize_t ret;
@@ -1641,6 +1802,8 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	if (ret)
 		goto out_put_req;
 
+	abw = aio_defer_iocb(req);
+
 	spin_lock_irq(&ctx->ctx_lock);
 	/*
 	 * We could have raced with io_destroy() and are currently holding a
@@ -1657,7 +1820,15 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	if (ctx->dead) {
 		spin_unlock_irq(&ctx->ctx_lock);
 		ret = -EINVAL;
-		goto out_put_req;
+		goto out_free_work;
+	}
+	if (abw) {
+		/* the worker's reference */
+		req->ki_users++;
+		queue_work(aio_buffered_wq, &abw->work);
+		spin_unlock_irq(&ctx->ctx_lock);
+		aio_put_req(req);	/* drop extra ref to req */
+		return 0;
 	}
 	aio_run_iocb(req);
 	if (!list_empty(&ctx->run_list)) {
@@ -1675,6 +1846,11 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	aio_put_req(req);	/* drop extra ref to req */
 	return 0;
 
+out_free_work:
+	if (abw) {
+		put_cred(abw->cred);
+		kfree(abw);
+	}
 out_put_req:
 	aio_put_req(req);	/* drop extra ref to req */
 	aio_put_req(req);	/* drop i/o ref to req */
@@ -2002,6 +2002,125 @@ out:
 	return dentry;
 }
 
+/*
+ * Lookups in progress (FS_PARALLEL_LOOKUP).  The dentry being looked up
+ * is not in the dcache hash until ->lookup() adds it, other lookups of
+ * the same name find it here and wait until it is done.
+ */
+#define IN_LOOKUP_HASH_BITS	8
+
+struct in_lookup_bucket {
+	spinlock_t lock;
+	struct hlist_head head;
+	wait_queue_head_t wait;
+};
+static struct in_lookup_bucket in_lookup_hashtable[1 << IN_LOOKUP_HASH_BITS];
+
+static inline struct in_lookup_bucket *in_lookup_hash(struct dentry *parent,
+						       unsigned int hash)
+{
+	return in_lookup_hashtable +
+		hash_long((unsigned long)parent + hash, IN_LOOKUP_HASH_BITS);
+}
+
+static int d_in_lookup_match(struct dentry *dentry, struct dentry *parent,
+			     struct qstr *name)
+{
+	int match = 0;
+
+	spin_lock(&dentry->d_lock);
+	if (dentry->d_parent != parent || dentry->d_name.hash != name->hash)
+		goto out;
+	if (parent->d_flags & DCACHE_OP_COMPARE)
+		match = !parent->d_op->d_compare(parent, parent->d_inode,
+				dentry, dentry->d_inode,
+				dentry->d_name.len, dentry->d_name.name, name);
+	else
+		match = !dentry_cmp(dentry->d_name.name, dentry->d_name.len,
+				    name->name, name->len);
+out:
+	spin_unlock(&dentry->d_lock);
+	return match;
+}
+
+/**
+ * d_alloc_parallel - find a dentry or start looking it up
+ * @parent: parent dentry
+ * @name: qstr of the name, hashed
+ * @dl: filled in for d_lookup_done() when a lookup is started
+ *
+ * Returns the dentry for @name from the dcache, after waiting for any
+ * lookup of @name in progress.  If there is none, returns a new dentry
+ * for which d_in_lookup() is true: the caller passes it to ->lookup()
+ * and then calls d_lookup_done(@dl).
+ *
+ * Lookups of other names in the directory are not held up, the caller
+ * has to exclude changes to the directory.
+ */
+struct dentry *d_alloc_parallel(struct dentry *parent, struct qstr *name,
+				struct dentry_lookup *dl)
+{
+	struct in_lookup_bucket *b = in_lookup_hash(parent, name->hash);
+	struct dentry_lookup *p;
+	struct hlist_node *node;
+	struct dentry *new, *dentry;
+
+	new = d_alloc(parent, name);
+	if (unlikely(!new))
+		return ERR_PTR(-ENOMEM);
+again:
+	spin_lock(&b->lock);
+	hlist_for_each_entry(p, node, &b->head, d_node) {
+		dentry = p->dentry;
+		if (!d_in_lookup_match(dentry, parent, name))
+			continue;
+		dget(dentry);
+		spin_unlock(&b->lock);
+		wait_event(b->wait, !d_in_lookup(dentry));
+		dput(dentry);
+		goto again;
+	}
+
+	/* ->lookup() adds the dentry before d_lookup_done(), look here */
+	dentry = d_lookup(parent, name);
+	if (dentry) {
+		spin_unlock(&b->lock);
+		dput(new);
+		return dentry;
+	}
+
+	spin_lock(&new->d_lock);
+	new->d_flags |= DCACHE_PAR_LOOKUP;
+	spin_unlock(&new->d_lock);
+	dl->dentry = new;
+	dl->bucket = b;
+	hlist_add_head(&dl->d_node, &b->head);
+	spin_unlock(&b->lock);
+	return new;
+}
+EXPORT_SYMBOL(d_alloc_parallel);
+
+/**
+ * d_lookup_done - finish a lookup started by d_alloc_parallel()
+ * @dl: the lookup
+ *
+ * Wakes up the lookups of the same name waiting for it.
+ */
+void d_lookup_done(struct dentry_lookup *dl)
+{
+	struct in_lookup_bucket *b = dl->bucket;
+	struct dentry *dentry = dl->dentry;
+
+	spin_lock(&b->lock);
+	hlist_del(&dl->d_node);
+	spin_lock(&dentry->d_lock);
+	dentry->d_flags &= ~DCACHE_PAR_LOOKUP;
+	spin_unlock(&dentry->d_lock);
+	spin_unlock(&b->lock);
+	wake_up_all(&b->wait);
+}
+EXPORT_SYMBOL(d_lookup_done);
+
 /**
  * d_validate - verify dentry provided from insecure source (deprecated)
  * @dentry: The dentry alleged to be valid child of @dparent
@@ -3041,6 +3160,12 @@ static void __init dcache_init(void)
 {
 	int loop;
 
+	for (loop = 0; loop < ARRAY_SIZE(in_lookup_hashtable); loop++) {
+		spin_lock_init(&in_lookup_hashtable[loop].lock);
+		INIT_HLIST_HEAD(&in_lookup_hashtable[loop].head);
+		init_waitqueue_head(&in_lookup_hashtable[loop].wait);
+	}
+
 	/* 
 	 * A constructor could be added for stable state like the lists,
 	 * but it is probably not worth it because of the cache nature
@@ -37,17 +37,6 @@
 #include <asm/unaligned.h>
 #include "ecryptfs_kernel.h"
 
-static int
-ecryptfs_decrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv);
-static int
-ecryptfs_encrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv);
-
 /**
  * ecryptfs_to_hex
  * @dst: Buffer to take hex character representation of contents of
@@ -243,7 +232,7 @@ void ecryptfs_destroy_crypt_stat(struct ecryptfs_crypt_stat *crypt_stat)
 	struct ecryptfs_key_sig *key_sig, *key_sig_tmp;
 
 	if (crypt_stat->tfm)
-		crypto_free_blkcipher(crypt_stat->tfm);
+		crypto_free_ablkcipher(crypt_stat->tfm);
 	if (crypt_stat->hash_tfm)
 		crypto_free_hash(crypt_stat->hash_tfm);
 	list_for_each_entry_safe(key_sig, key_sig_tmp,
@@ -324,132 +313,202 @@ int virt_to_scatterlist(const void *addr, int size, struct scatterlist *sg,
 }
 
 /**
- * encrypt_scatterlist
- * @crypt_stat: Pointer to the crypt_stat struct to initialize.
- * @dest_sg: Destination of encrypted data
- * @src_sg: Data to be encrypted
- * @size: Length of data to be encrypted
- * @iv: iv to use during encryption
+ * ecryptfs_lower_offset_for_extent
  *
- * Returns the number of bytes encrypted; negative value on error
+ * Convert an eCryptfs page index into a lower byte offset
  */
-static int encrypt_scatterlist(struct ecryptfs_crypt_stat *crypt_stat,
-			       struct scatterlist *dest_sg,
-			       struct scatterlist *src_sg, int size,
-			       unsigned char *iv)
+static void ecryptfs_lower_offset_for_extent(loff_t *offset, loff_t extent_num,
+					     struct ecryptfs_crypt_stat *crypt_stat)
+{
+	(*offset) = ecryptfs_lower_header_size(crypt_stat)
+		    + (crypt_stat->extent_size * extent_num);
+}
+
+#define DECRYPT		0
+#define ENCRYPT		1
+
+/*
+ * Every extent has its own IV, so it takes a cipher request of its own.
+ * All the requests for a page (or a batch of pages) are handed to the
+ * cipher before waiting for any of them, so that an asynchronous
+ * implementation can work on several extents at once.  pending counts
+ * the requests in flight plus one held by the submitter.
+ */
+struct ecryptfs_crypt_batch {
+	struct list_head reqs;
+	atomic_t pending;
+	struct completion done;
+	int rc;
+};
+
+struct ecryptfs_extent_req {
+	struct list_head list;
+	struct ecryptfs_crypt_batch *batch;
+	struct scatterlist src_sg;
+	struct scatterlist dst_sg;
+	char iv[ECRYPTFS_MAX_IV_BYTES];
+	struct ablkcipher_request req;	/* must be last */
+};
+
+static void ecryptfs_init_batch(struct ecryptfs_crypt_batch *batch)
+{
+	INIT_LIST_HEAD(&batch->reqs);
+	atomic_set(&batch->pending, 1);
+	init_completion(&batch->done);
+	batch->rc = 0;
+}
+
+static void extent_crypt_complete(struct crypto_async_request *req, int rc)
+{
+	struct ecryptfs_extent_req *extent_req = req->data;
+	struct ecryptfs_crypt_batch *batch = extent_req->batch;
+
+	/* A backlogged request has been started, it completes later */
+	if (rc == -EINPROGRESS)
+		return;
+	if (rc)
+		batch->rc = rc;
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+/**
+ * ecryptfs_wait_batch
+ * @batch: The batch to wait for
+ *
+ * Waits for all the requests queued on @batch and frees them.
+ *
+ * Returns zero if all of them succeeded; negative on error
+ */
+static int ecryptfs_wait_batch(struct ecryptfs_crypt_batch *batch)
+{
+	struct ecryptfs_extent_req *extent_req, *tmp;
+
+	if (!atomic_dec_and_test(&batch->pending))
+		wait_for_completion(&batch->done);
+	list_for_each_entry_safe(extent_req, tmp, &batch->reqs, list) {
+		list_del(&extent_req->list);
+		kfree(extent_req);
+	}
+	return batch->rc;
+}
+
+/**
+ * ecryptfs_set_tfm_key
+ * @crypt_stat: The cryptographic context
+ *
+ * Sets the file encryption key on the cipher the first time it is
+ * needed; whoever replaces crypt_stat->key clears ECRYPTFS_KEY_SET.
+ *
+ * Returns zero on success; -EINVAL on error
+ */
+static int ecryptfs_set_tfm_key(struct ecryptfs_crypt_stat *crypt_stat)
 {
-	struct blkcipher_desc desc = {
-		.tfm = crypt_stat->tfm,
-		.info = iv,
-		.flags = CRYPTO_TFM_REQ_MAY_SLEEP
-	};
 	int rc = 0;
 
 	BUG_ON(!crypt_stat || !crypt_stat->tfm
 	       || !(crypt_stat->flags & ECRYPTFS_STRUCT_INITIALIZED));
-	if (unlikely(ecryptfs_verbosity > 0)) {
-		ecryptfs_printk(KERN_DEBUG, "Key size [%zd]; key:\n",
-				crypt_stat->key_size);
-		ecryptfs_dump_hex(crypt_stat->key,
-				  crypt_stat->key_size);
-	}
-	/* Consider doing this once, when the file is opened */
 	mutex_lock(&crypt_stat->cs_tfm_mutex);
 	if (!(crypt_stat->flags & ECRYPTFS_KEY_SET)) {
-		rc = crypto_blkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
-					     crypt_stat->key_size);
-		crypt_stat->flags |= ECRYPTFS_KEY_SET;
-	}
-	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error setting key; rc = [%d]\n",
-				rc);
-		mutex_unlock(&crypt_stat->cs_tfm_mutex);
-		rc = -EINVAL;
-		goto out;
+		if (unlikely(ecryptfs_verbosity > 0)) {
+			ecryptfs_printk(KERN_DEBUG, "Key size [%zd]; key:\n",
+					crypt_stat->key_size);
+			ecryptfs_dump_hex(crypt_stat->key,
+					  crypt_stat->key_size);
+		}
+		rc = crypto_ablkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
+					      crypt_stat->key_size);
+		if (rc) {
+			ecryptfs_printk(KERN_ERR, "Error setting key; "
+					"rc = [%d]\n", rc);
+			rc = -EINVAL;
+		} else
+			crypt_stat->flags |= ECRYPTFS_KEY_SET;
 	}
-	ecryptfs_printk(KERN_DEBUG, "Encrypting [%d] bytes.\n", size);
-	crypto_blkcipher_encrypt_iv(&desc, dest_sg, src_sg, size);
 	mutex_unlock(&crypt_stat->cs_tfm_mutex);
-out:
 	return rc;
 }
 
 /**
- * ecryptfs_lower_offset_for_extent
- *
- * Convert an eCryptfs page index into a lower byte offset
- */
-static void ecryptfs_lower_offset_for_extent(loff_t *offset, loff_t extent_num,
-					     struct ecryptfs_crypt_stat *crypt_stat)
-{
-	(*offset) = ecryptfs_lower_header_size(crypt_stat)
-		    + (crypt_stat->extent_size * extent_num);
-}
-
-/**
- * ecryptfs_encrypt_extent
- * @enc_extent_page: Allocated page into which to encrypt the data in
- *                   @page
+ * crypt_extent
  * @crypt_stat: crypt_stat containing cryptographic context for the
- *              encryption operation
- * @page: Page containing plaintext data extent to encrypt
+ *              operation
+ * @batch: The batch to queue the operation on
+ * @dst_page: The page to write the result of the operation into
+ * @src_page: The page containing the data to encrypt or decrypt
+ * @index: The eCryptfs page index, for use in generating the IV
  * @extent_offset: Page extent offset for use in generating IV
+ * @op: ENCRYPT or DECRYPT
  *
- * Encrypts one extent of data.
+ * Queues the encryption or decryption of one extent, which is at the
+ * same offset in both pages.  The result is only there once
+ * ecryptfs_wait_batch() has returned.
  *
  * Return zero on success; non-zero otherwise
  */
-static int ecryptfs_encrypt_extent(struct page *enc_extent_page,
-				   struct ecryptfs_crypt_stat *crypt_stat,
-				   struct page *page,
-				   unsigned long extent_offset)
+static int crypt_extent(struct ecryptfs_crypt_stat *crypt_stat,
+			struct ecryptfs_crypt_batch *batch,
+			struct page *dst_page, struct page *src_page,
+			pgoff_t index, unsigned long extent_offset, int op)
 {
+	struct ecryptfs_extent_req *extent_req;
+	unsigned int offset = extent_offset * crypt_stat->extent_size;
 	loff_t extent_base;
-	char extent_iv[ECRYPTFS_MAX_IV_BYTES];
 	int rc;
 
-	extent_base = (((loff_t)page->index)
+	extent_req = kmalloc(sizeof(*extent_req)
+			     + crypto_ablkcipher_reqsize(crypt_stat->tfm),
+			     GFP_NOFS);
+	if (!extent_req) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	extent_base = (((loff_t)index)
 		       * (PAGE_CACHE_SIZE / crypt_stat->extent_size));
-	rc = ecryptfs_derive_iv(extent_iv, crypt_stat,
+	rc = ecryptfs_derive_iv(extent_req->iv, crypt_stat,
 				(extent_base + extent_offset));
 	if (rc) {
 		ecryptfs_printk(KERN_ERR, "Error attempting to derive IV for "
 			"extent [0x%.16llx]; rc = [%d]\n",
 			(unsigned long long)(extent_base + extent_offset), rc);
+		kfree(extent_req);
 		goto out;
 	}
 	if (unlikely(ecryptfs_verbosity > 0)) {
-		ecryptfs_printk(KERN_DEBUG, "Encrypting extent "
-				"with iv:\n");
-		ecryptfs_dump_hex(extent_iv, crypt_stat->iv_bytes);
-		ecryptfs_printk(KERN_DEBUG, "First 8 bytes before "
-				"encryption:\n");
-		ecryptfs_dump_hex((char *)
-				  (page_address(page)
-				   + (extent_offset * crypt_stat->extent_size)),
-				  8);
-	}
-	rc = ecryptfs_encrypt_page_offset(crypt_stat, enc_extent_page, 0,
-					  page, (extent_offset
-						 * crypt_stat->extent_size),
-					  crypt_stat->extent_size, extent_iv);
-	if (rc < 0) {
-		printk(KERN_ERR "%s: Error attempting to encrypt page with "
-		       "page->index = [%ld], extent_offset = [%ld]; "
-		       "rc = [%d]\n", __func__, page->index, extent_offset,
-		       rc);
-		goto out;
-	}
+		ecryptfs_printk(KERN_DEBUG, "%s extent [0x%.16llx] with iv:\n",
+				op == ENCRYPT ? "Encrypting" : "Decrypting",
+				(unsigned long long)(extent_base
+						     + extent_offset));
+		ecryptfs_dump_hex(extent_req->iv, crypt_stat->iv_bytes);
+	}
+	extent_req->batch = batch;
+	list_add_tail(&extent_req->list, &batch->reqs);
+	sg_init_table(&extent_req->src_sg, 1);
+	sg_set_page(&extent_req->src_sg, src_page, crypt_stat->extent_size,
+		    offset);
+	sg_init_table(&extent_req->dst_sg, 1);
+	sg_set_page(&extent_req->dst_sg, dst_page, crypt_stat->extent_size,
+		    offset);
+	ablkcipher_request_set_tfm(&extent_req->req, crypt_stat->tfm);
+	ablkcipher_request_set_callback(&extent_req->req,
+					CRYPTO_TFM_REQ_MAY_BACKLOG
+					| CRYPTO_TFM_REQ_MAY_SLEEP,
+					extent_crypt_complete, extent_req);
+	ablkcipher_request_set_crypt(&extent_req->req, &extent_req->src_sg,
+				     &extent_req->dst_sg,
+				     crypt_stat->extent_size, extent_req->iv);
+	atomic_inc(&batch->pending);
+	if (op == ENCRYPT)
+		rc = crypto_ablkcipher_encrypt(&extent_req->req);
+	else
+		rc = crypto_ablkcipher_decrypt(&extent_req->req);
+	/* Queued or backlogged requests report through the callback */
+	if (rc != -EINPROGRESS && rc != -EBUSY)
+		extent_crypt_complete(&extent_req->req.base, rc);
 	rc = 0;
-	if (unlikely(ecryptfs_verbosity > 0)) {
-		ecryptfs_printk(KERN_DEBUG, "Encrypt extent [0x%.16llx]; "
-			"rc = [%d]\n",
-			(unsigned long long)(extent_base + extent_offset), rc);
-		ecryptfs_printk(KERN_DEBUG, "First 8 bytes after "
-				"encryption:\n");
-		ecryptfs_dump_hex((char *)(page_address(enc_extent_page)), 8);
-	}
 out:
+	if (rc)
+		batch->rc = rc;
 	return rc;
 }
 
@@ -459,7 +518,9 @@ out:
  *        decrypted content that needs to be encrypted (to a temporary
  *        page; not in place) and written out to the lower file
  *
- * Encrypt an eCryptfs page. This is done on a per-extent basis. Note
+ * Encrypt an eCryptfs page. Every extent is encrypted with its own IV;
+ * the extents are all queued to the cipher at once and the encrypted
+ * page is then written out with a single lower write. Note
  * that eCryptfs pages may straddle the lower pages -- for instance,
  * if the file was created on a machine with an 8K page size
  * (resulting in an 8K header), and then the file is copied onto a
@@ -473,9 +534,11 @@ int ecryptfs_encrypt_page(struct page *page)
 {
 	struct inode *ecryptfs_inode;
 	struct ecryptfs_crypt_stat *crypt_stat;
+	struct ecryptfs_crypt_batch batch;
 	char *enc_extent_virt;
 	struct page *enc_extent_page = NULL;
-	loff_t extent_offset;
+	unsigned long extent_offset;
+	loff_t offset;
 	int rc = 0;
 
 	ecryptfs_inode = page->mapping->host;
@@ -489,271 +552,139 @@ int ecryptfs_encrypt_page(struct page *page)
 				"encrypted extent\n");
 		goto out;
 	}
-	enc_extent_virt = kmap(enc_extent_page);
+	rc = ecryptfs_set_tfm_key(crypt_stat);
+	if (rc)
+		goto out;
+	ecryptfs_init_batch(&batch);
 	for (extent_offset = 0;
 	     extent_offset < (PAGE_CACHE_SIZE / crypt_stat->extent_size);
 	     extent_offset++) {
-		loff_t offset;
-
-		rc = ecryptfs_encrypt_extent(enc_extent_page, crypt_stat, page,
-					     extent_offset);
-		if (rc) {
-			printk(KERN_ERR "%s: Error encrypting extent; "
-			       "rc = [%d]\n", __func__, rc);
-			goto out;
-		}
-		ecryptfs_lower_offset_for_extent(
-			&offset, ((((loff_t)page->index)
-				   * (PAGE_CACHE_SIZE
-				      / crypt_stat->extent_size))
-				  + extent_offset), crypt_stat);
-		rc = ecryptfs_write_lower(ecryptfs_inode, enc_extent_virt,
-					  offset, crypt_stat->extent_size);
-		if (rc < 0) {
-			ecryptfs_printk(KERN_ERR, "Error attempting "
-					"to write lower page; rc = [%d]"
-					"\n", rc);
-			goto out;
-		}
-	}
-	rc = 0;
-out:
-	if (enc_extent_page) {
-		kunmap(enc_extent_page);
-		__free_page(enc_extent_page);
+		if (crypt_extent(crypt_stat, &batch, enc_extent_page, page,
+				 page->index, extent_offset, ENCRYPT))
+			break;
 	}
-	return rc;
-}
-
-static int ecryptfs_decrypt_extent(struct page *page,
-				   struct ecryptfs_crypt_stat *crypt_stat,
-				   struct page *enc_extent_page,
-				   unsigned long extent_offset)
-{
-	loff_t extent_base;
-	char extent_iv[ECRYPTFS_MAX_IV_BYTES];
-	int rc;
-
-	extent_base = (((loff_t)page->index)
-		       * (PAGE_CACHE_SIZE / crypt_stat->extent_size));
-	rc = ecryptfs_derive_iv(extent_iv, crypt_stat,
-				(extent_base + extent_offset));
+	rc = ecryptfs_wait_batch(&batch);
 	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error attempting to derive IV for "
-			"extent [0x%.16llx]; rc = [%d]\n",
-			(unsigned long long)(extent_base + extent_offset), rc);
+		printk(KERN_ERR "%s: Error encrypting page with "
+		       "page->index = [%ld]; rc = [%d]\n", __func__,
+		       page->index, rc);
 		goto out;
 	}
-	if (unlikely(ecryptfs_verbosity > 0)) {
-		ecryptfs_printk(KERN_DEBUG, "Decrypting extent "
-				"with iv:\n");
-		ecryptfs_dump_hex(extent_iv, crypt_stat->iv_bytes);
-		ecryptfs_printk(KERN_DEBUG, "First 8 bytes before "
-				"decryption:\n");
-		ecryptfs_dump_hex((char *)
-				  (page_address(enc_extent_page)
-				   + (extent_offset * crypt_stat->extent_size)),
-				  8);
-	}
-	rc = ecryptfs_decrypt_page_offset(crypt_stat, page,
-					  (extent_offset
-					   * crypt_stat->extent_size),
-					  enc_extent_page, 0,
-					  crypt_stat->extent_size, extent_iv);
+	ecryptfs_lower_offset_for_extent(
+		&offset, (((loff_t)page->index)
+			  * (PAGE_CACHE_SIZE / crypt_stat->extent_size)),
+		crypt_stat);
+	enc_extent_virt = kmap(enc_extent_page);
+	rc = ecryptfs_write_lower(ecryptfs_inode, enc_extent_virt, offset,
+				  PAGE_CACHE_SIZE);
+	kunmap(enc_extent_page);
 	if (rc < 0) {
-		printk(KERN_ERR "%s: Error attempting to decrypt to page with "
-		       "page->index = [%ld], extent_offset = [%ld]; "
-		       "rc = [%d]\n", __func__, page->index, extent_offset,
-		       rc);
+		ecryptfs_printk(KERN_ERR, "Error attempting "
+				"to write lower page; rc = [%d]"
+				"\n", rc);
 		goto out;
 	}
 	rc = 0;
-	if (unlikely(ecryptfs_verbosity > 0)) {
-		ecryptfs_printk(KERN_DEBUG, "Decrypt extent [0x%.16llx]; "
-			"rc = [%d]\n",
-			(unsigned long long)(extent_base + extent_offset), rc);
-		ecryptfs_printk(KERN_DEBUG, "First 8 bytes after "
-				"decryption:\n");
-		ecryptfs_dump_hex((char *)(page_address(page)
-					   + (extent_offset
-					      * crypt_stat->extent_size)), 8);
-	}
 out:
+	if (enc_extent_page)
+		__free_page(enc_extent_page);
 	return rc;
 }
 
 /**
- * ecryptfs_decrypt_page
- * @page: Page mapped from the eCryptfs inode for the file; data read
- *        and decrypted from the lower file will be written into this
- *        page
+ * ecryptfs_decrypt_pages
+ * @pages: Pages mapped from the eCryptfs inode for the file; data read
+ *         and decrypted from the lower file will be written into them
+ * @nr_pages: Number of pages, at most ECRYPTFS_MAX_DECRYPT_PAGES
  *
- * Decrypt an eCryptfs page. This is done on a per-extent basis. Note
- * that eCryptfs pages may straddle the lower pages -- for instance,
- * if the file was created on a machine with an 8K page size
- * (resulting in an 8K header), and then the file is copied onto a
- * host with a 32K page size, then when reading page 0 of the eCryptfs
- * file, 24K of page 0 of the lower file will be read and decrypted,
- * and then 8K of page 1 of the lower file will be read and decrypted.
+ * Decrypt a batch of eCryptfs pages. The lower data of each page is
+ * read with a single lower read, and its extents are queued to the
+ * cipher before the next page is read, so that an asynchronous cipher
+ * decrypts one page while the next is being read. The pages are only
+ * valid if the whole batch succeeded.
  *
  * Returns zero on success; negative on error
  */
-int ecryptfs_decrypt_page(struct page *page)
+int ecryptfs_decrypt_pages(struct page **pages, int nr_pages)
 {
 	struct inode *ecryptfs_inode;
 	struct ecryptfs_crypt_stat *crypt_stat;
+	struct ecryptfs_crypt_batch batch;
+	struct page *enc_pages[ECRYPTFS_MAX_DECRYPT_PAGES];
 	char *enc_extent_virt;
-	struct page *enc_extent_page = NULL;
 	unsigned long extent_offset;
+	loff_t offset;
+	int i, nr_enc = 0;
 	int rc = 0;
 
-	ecryptfs_inode = page->mapping->host;
+	BUG_ON(nr_pages > ECRYPTFS_MAX_DECRYPT_PAGES);
+	ecryptfs_inode = pages[0]->mapping->host;
 	crypt_stat =
 		&(ecryptfs_inode_to_private(ecryptfs_inode)->crypt_stat);
 	BUG_ON(!(crypt_stat->flags & ECRYPTFS_ENCRYPTED));
-	enc_extent_page = alloc_page(GFP_USER);
-	if (!enc_extent_page) {
-		rc = -ENOMEM;
-		ecryptfs_printk(KERN_ERR, "Error allocating memory for "
-				"encrypted extent\n");
+	rc = ecryptfs_set_tfm_key(crypt_stat);
+	if (rc)
 		goto out;
-	}
-	enc_extent_virt = kmap(enc_extent_page);
-	for (extent_offset = 0;
-	     extent_offset < (PAGE_CACHE_SIZE / crypt_stat->extent_size);
-	     extent_offset++) {
-		loff_t offset;
-
+	ecryptfs_init_batch(&batch);
+	for (i = 0; i < nr_pages; i++) {
+		enc_pages[i] = alloc_page(GFP_USER);
+		if (!enc_pages[i]) {
+			batch.rc = -ENOMEM;
+			ecryptfs_printk(KERN_ERR, "Error allocating memory "
+					"for encrypted extent\n");
+			break;
+		}
+		nr_enc++;
 		ecryptfs_lower_offset_for_extent(
-			&offset, ((page->index * (PAGE_CACHE_SIZE
-						  / crypt_stat->extent_size))
-				  + extent_offset), crypt_stat);
+			&offset, (((loff_t)pages[i]->index)
+				  * (PAGE_CACHE_SIZE / crypt_stat->extent_size)),
+			crypt_stat);
+		enc_extent_virt = kmap(enc_pages[i]);
 		rc = ecryptfs_read_lower(enc_extent_virt, offset,
-					 crypt_stat->extent_size,
-					 ecryptfs_inode);
+					 PAGE_CACHE_SIZE, ecryptfs_inode);
+		kunmap(enc_pages[i]);
 		if (rc < 0) {
 			ecryptfs_printk(KERN_ERR, "Error attempting "
 					"to read lower page; rc = [%d]"
 					"\n", rc);
-			goto out;
+			batch.rc = rc;
+			break;
 		}
-		rc = ecryptfs_decrypt_extent(page, crypt_stat, enc_extent_page,
-					     extent_offset);
-		if (rc) {
-			printk(KERN_ERR "%s: Error encrypting extent; "
-			       "rc = [%d]\n", __func__, rc);
-			goto out;
+		for (extent_offset = 0;
+		     extent_offset < (PAGE_CACHE_SIZE / crypt_stat->extent_size);
+		     extent_offset++) {
+			if (crypt_extent(crypt_stat, &batch, pages[i],
+					 enc_pages[i], pages[i]->index,
+					 extent_offset, DECRYPT))
+				break;
 		}
+		if (batch.rc)
+			break;
 	}
-out:
-	if (enc_extent_page) {
-		kunmap(enc_extent_page);
-		__free_page(enc_extent_page);
-	}
-	return rc;
-}
-
-/**
- * decrypt_scatterlist
- * @crypt_stat: Cryptographic context
- * @dest_sg: The destination scatterlist to decrypt into
- * @src_sg: The source scatterlist to decrypt from
- * @size: The number of bytes to decrypt
- * @iv: The initialization vector to use for the decryption
- *
- * Returns the number of bytes decrypted; negative value on error
- */
-static int decrypt_scatterlist(struct ecryptfs_crypt_stat *crypt_stat,
-			       struct scatterlist *dest_sg,
-			       struct scatterlist *src_sg, int size,
-			       unsigned char *iv)
-{
-	struct blkcipher_desc desc = {
-		.tfm = crypt_stat->tfm,
-		.info = iv,
-		.flags = CRYPTO_TFM_REQ_MAY_SLEEP
-	};
-	int rc = 0;
-
-	/* Consider doing this once, when the file is opened */
-	mutex_lock(&crypt_stat->cs_tfm_mutex);
-	rc = crypto_blkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
-				     crypt_stat->key_size);
-	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error setting key; rc = [%d]\n",
-				rc);
-		mutex_unlock(&crypt_stat->cs_tfm_mutex);
-		rc = -EINVAL;
-		goto out;
-	}
-	ecryptfs_printk(KERN_DEBUG, "Decrypting [%d] bytes.\n", size);
-	rc = crypto_blkcipher_decrypt_iv(&desc, dest_sg, src_sg, size);
-	mutex_unlock(&crypt_stat->cs_tfm_mutex);
-	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error decrypting; rc = [%d]\n",
-				rc);
-		goto out;
-	}
-	rc = size;
+	rc = ecryptfs_wait_batch(&batch);
+	if (rc)
+		printk(KERN_ERR "%s: Error decrypting page with "
+		       "page->index = [%ld]; rc = [%d]\n", __func__,
+		       pages[0]->index, rc);
+	for (i = 0; i < nr_enc; i++)
+		__free_page(enc_pages[i]);
 out:
 	return rc;
 }
 
 /**
- * ecryptfs_encrypt_page_offset
- * @crypt_stat: The cryptographic context
- * @dst_page: The page to encrypt into
- * @dst_offset: The offset in the page to encrypt into
- * @src_page: The page to encrypt from
- * @src_offset: The offset in the page to encrypt from
- * @size: The number of bytes to encrypt
- * @iv: The initialization vector to use for the encryption
+ * ecryptfs_decrypt_page
+ * @page: Page mapped from the eCryptfs inode for the file; data read
+ *        and decrypted from the lower file will be written into this
+ *        page
  *
- * Returns the number of bytes encrypted
- */
-static int
-ecryptfs_encrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv)
-{
-	struct scatterlist src_sg, dst_sg;
-
-	sg_init_table(&src_sg, 1);
-	sg_init_table(&dst_sg, 1);
-
-	sg_set_page(&src_sg, src_page, size, src_offset);
-	sg_set_page(&dst_sg, dst_page, size, dst_offset);
-	return encrypt_scatterlist(crypt_stat, &dst_sg, &src_sg, size, iv);
-}
-
-/**
- * ecryptfs_decrypt_page_offset
- * @crypt_stat: The cryptographic context
- * @dst_page: The page to decrypt into
- * @dst_offset: The offset in the page to decrypt into
- * @src_page: The page to decrypt from
- * @src_offset: The offset in the page to decrypt from
- * @size: The number of bytes to decrypt
- * @iv: The initialization vector to use for the decryption
+ * Decrypt an eCryptfs page, see ecryptfs_decrypt_pages().
  *
- * Returns the number of bytes decrypted
+ * Returns zero on success; negative on error
  */
-static int
-ecryptfs_decrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv)
+int ecryptfs_decrypt_page(struct page *page)
 {
-	struct scatterlist src_sg, dst_sg;
-
-	sg_init_table(&src_sg, 1);
-	sg_set_page(&src_sg, src_page, size, src_offset);
-
-	sg_init_table(&dst_sg, 1);
-	sg_set_page(&dst_sg, dst_page, size, dst_offset);
-
-	return decrypt_scatterlist(crypt_stat, &dst_sg, &src_sg, size, iv);
+	return ecryptfs_decrypt_pages(&page, 1);
 }
 
 #define ECRYPTFS_MAX_SCATTERLIST_LEN 4
@@ -790,8 +721,7 @@ int ecryptfs_init_crypt_ctx(struct ecryptfs_crypt_stat *crypt_stat)
 						    crypt_stat->cipher, "cbc");
 	if (rc)
 		goto out_unlock;
-	crypt_stat->tfm = crypto_alloc_blkcipher(full_alg_name, 0,
-						 CRYPTO_ALG_ASYNC);
+	crypt_stat->tfm = crypto_alloc_ablkcipher(full_alg_name, 0, 0);
 	kfree(full_alg_name);
 	if (IS_ERR(crypt_stat->tfm)) {
 		rc = PTR_ERR(crypt_stat->tfm);
@@ -801,7 +731,7 @@ int ecryptfs_init_crypt_ctx(struct ecryptfs_crypt_stat *crypt_stat)
 				crypt_stat->cipher);
 		goto out_unlock;
 	}
-	crypto_blkcipher_set_flags(crypt_stat->tfm, CRYPTO_TFM_REQ_WEAK_KEY);
+	crypto_ablkcipher_set_flags(crypt_stat->tfm, CRYPTO_TFM_REQ_WEAK_KEY);
 	rc = 0;
 out_unlock:
 	mutex_unlock(&crypt_stat->cs_tfm_mutex);
@@ -881,6 +811,7 @@ out:
 static void ecryptfs_generate_new_key(struct ecryptfs_crypt_stat *crypt_stat)
 {
 	get_random_bytes(crypt_stat->key, crypt_stat->key_size);
+	crypt_stat->flags &= ~ECRYPTFS_KEY_SET;
 	crypt_stat->flags |= ECRYPTFS_KEY_VALID;
 	ecryptfs_compute_root_iv(crypt_stat);
 	if (unlikely(ecryptfs_verbosity > 0)) {
@@ -243,6 +243,76 @@ out:
 	return rc;
 }
 
+static int ecryptfs_readpage_filler(void *data, struct page *page)
+{
+	return ecryptfs_readpage(data, page);
+}
+
+static void ecryptfs_end_decrypt_pages(struct page **pages, int nr_pages,
+				       int rc)
+{
+	int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (!rc)
+			SetPageUptodate(pages[i]);
+		unlock_page(pages[i]);
+		page_cache_release(pages[i]);
+	}
+}
+
+/**
+ * ecryptfs_readpages
+ * @file: An eCryptfs file
+ * @mapping: The eCryptfs inode mapping
+ * @pages: The pages to read, lowest index last
+ * @nr_pages: The number of pages
+ *
+ * Readahead. The lower data for all the pages is read ahead first, then
+ * the pages are decrypted ECRYPTFS_MAX_DECRYPT_PAGES at a time. Pages
+ * that fail to decrypt are left for ecryptfs_readpage() to retry.
+ *
+ * Returns zero on success; non-zero on error.
+ */
+static int ecryptfs_readpages(struct file *file, struct address_space *mapping,
+			      struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct ecryptfs_crypt_stat *crypt_stat =
+		&ecryptfs_inode_to_private(inode)->crypt_stat;
+	struct page *batch[ECRYPTFS_MAX_DECRYPT_PAGES];
+	struct page *page;
+	int nr = 0;
+
+	if (!(crypt_stat->flags & ECRYPTFS_ENCRYPTED)
+	    || (crypt_stat->flags & (ECRYPTFS_NEW_FILE
+				     | ECRYPTFS_VIEW_AS_ENCRYPTED)))
+		return read_cache_pages(mapping, pages,
+					ecryptfs_readpage_filler, file);
+
+	page = list_entry(pages->prev, struct page, lru);
+	ecryptfs_lower_readahead(inode, page->index, nr_pages);
+	while (!list_empty(pages)) {
+		page = list_entry(pages->prev, struct page, lru);
+		list_del(&page->lru);
+		if (add_to_page_cache_lru(page, mapping, page->index,
+					  GFP_KERNEL)) {
+			page_cache_release(page);
+			continue;
+		}
+		batch[nr++] = page;
+		if (nr == ECRYPTFS_MAX_DECRYPT_PAGES) {
+			ecryptfs_end_decrypt_pages(batch, nr,
+					ecryptfs_decrypt_pages(batch, nr));
+			nr = 0;
+		}
+	}
+	if (nr)
+		ecryptfs_end_decrypt_pages(batch, nr,
+					   ecryptfs_decrypt_pages(batch, nr));
+	return 0;
+}
+
 /**
  * Called with lower inode mutex held.
  */
@@ -558,6 +628,7 @@ static sector_t ecryptfs_bmap(struct address_space *mapping, sector_t block)
 const struct address_space_operations ecryptfs_aops = {
 	.writepage = ecryptfs_writepage,
 	.readpage = ecryptfs_readpage,
+	.readpages = ecryptfs_readpages,
 	.write_begin = ecryptfs_write_begin,
 	.write_end = ecryptfs_write_end,
 	.bmap = ecryptfs_bmap,
@@ -246,6 +246,39 @@ int ecryptfs_read_lower(char *data, loff_t offset, size_t size,
 	return rc;
 }
 
+/**
+ * ecryptfs_lower_readahead
+ * @ecryptfs_inode: The eCryptfs inode
+ * @index: The first eCryptfs page that is going to be read
+ * @nr_pages: The number of eCryptfs pages that are going to be read
+ *
+ * Starts reading the lower data for a range of encrypted eCryptfs
+ * pages, so that it is in the lower page cache by the time the pages
+ * are decrypted.
+ */
+void ecryptfs_lower_readahead(struct inode *ecryptfs_inode, pgoff_t index,
+			      unsigned long nr_pages)
+{
+	struct ecryptfs_inode_info *inode_info =
+		ecryptfs_inode_to_private(ecryptfs_inode);
+	struct file *lower_file = inode_info->lower_file;
+	pgoff_t lower_index, lower_last;
+	loff_t start;
+
+	if (!lower_file || !nr_pages)
+		return;
+	start = ecryptfs_lower_header_size(&inode_info->crypt_stat)
+		+ ((loff_t)index << PAGE_CACHE_SHIFT);
+	lower_index = start >> PAGE_CACHE_SHIFT;
+	lower_last = (start + ((loff_t)nr_pages << PAGE_CACHE_SHIFT) - 1)
+		     >> PAGE_CACHE_SHIFT;
+	mutex_lock(&inode_info->lower_file_mutex);
+	page_cache_sync_readahead(lower_file->f_mapping, &lower_file->f_ra,
+				  lower_file, lower_index,
+				  lower_last - lower_index + 1);
+	mutex_unlock(&inode_info->lower_file_mutex);
+}
+
 /**
  * ecryptfs_read_lower_page_segment
  * @page_for_ecryptfs: The page into which data for eCryptfs will be
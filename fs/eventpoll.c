@@ -33,6 +33,7 @@
 #include <linux/bitops.h>
 #include <linux/mutex.h>
 #include <linux/anon_inodes.h>
+#include <linux/percpu.h>
 #include <asm/uaccess.h>
 #include <asm/system.h>
 #include <asm/io.h>
@@ -45,14 +46,21 @@
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
- * 3) ep->lock (spinlock)
+ * 3) ep->rdlists per-CPU lock (spinlock)
  *
  * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
- * from inside the poll callback, that might be triggered from
- * a wake_up() that in turn might be called from IRQ context.
- * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * We need a spinlock because we queue items from inside the poll
+ * callback, that might be triggered from a wake_up() that in turn
+ * might be called from IRQ context. So we can't sleep inside the
+ * poll callback and hence we need a spinlock. The callback only ever
+ * takes the lock of the ready list of the CPU it runs on, so that
+ * events hitting the same epoll set from different CPUs do not
+ * contend; the per-CPU lists are merged into ep->rdllist, which
+ * belongs to the "mtx" holder, at event collection time.
+ * The EPI_READY bit of an item tells whether it is queued. Whoever
+ * sets it links the item, and only then, so the callback never
+ * touches an item that is on ep->rdllist or being collected.
+ * During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -71,7 +79,7 @@
  * constructing a cycle without either insert observing that it is
  * going to.
  * It is possible to drop the "ep->mtx" and to use the global
- * mutex "epmutex" (together with "ep->lock") to have it working,
+ * mutex "epmutex" (together with the ready list locks) to have it working,
  * but having "ep->mtx" will make the interface more scalable.
  * Events that require holding "epmutex" are very rare, while for
  * normal operations the epoll private "ep->mtx" will guarantee
@@ -79,15 +87,17 @@
  */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+/* Events allowed together with EPOLLEXCLUSIVE */
+#define EP_EXCLUSIVE_OK_BITS (EPOLLEXCLUSIVE | POLLIN | POLLOUT | \
+			      POLLERR | POLLHUP | EPOLLET)
 
 /* Maximum number of nesting allowed inside epoll sets */
 #define EP_MAX_NESTS 4
 
 #define EP_MAX_EVENTS (INT_MAX / sizeof(struct epoll_event))
 
-#define EP_UNACTIVE_PTR ((void *) -1L)
-
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
 
 struct epoll_filefd {
@@ -125,11 +135,8 @@ struct epitem {
 	/* List header used to link this structure to the eventpoll ready list */
 	struct list_head rdllink;
 
-	/*
-	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
-	 */
-	struct epitem *next;
+	/* EPI_READY is set while the item is on one of the ready lists */
+	unsigned long state;
 
 	/* The file descriptor information this item refers to */
 	struct epoll_filefd ffd;
@@ -150,15 +157,20 @@ struct epitem {
 	struct epoll_event event;
 };
 
+#define EPI_READY	0
+
+/* Items made ready by poll callbacks running on one CPU */
+struct ep_rdlist {
+	spinlock_t lock;
+	struct list_head list;
+};
+
 /*
  * This structure is stored inside the "private_data" member of the file
  * structure and rapresent the main data sructure for the eventpoll
  * interface.
  */
 struct eventpoll {
-	/* Protect the this structure access */
-	spinlock_t lock;
-
 	/*
 	 * This mutex is used to ensure that files are not removed
 	 * while epoll is using them. This is held during the event
@@ -173,19 +185,15 @@ struct eventpoll {
 	/* Wait queue used by file->poll() */
 	wait_queue_head_t poll_wait;
 
-	/* List of ready file descriptors */
+	/* List of ready file descriptors, protected by "mtx" */
 	struct list_head rdllist;
 
+	/* Per-CPU ready lists fed by the poll callback */
+	struct ep_rdlist __percpu *rdlists;
+
 	/* RB tree root used to store monitored fd structs */
 	struct rb_root rbr;
 
-	/*
-	 * This is a single linked list that chains all the "struct epitem" that
-	 * happened while transfering ready events to userspace w/out
-	 * holding ->lock.
-	 */
-	struct epitem *ovflist;
-
 	/* The user that created the eventpoll descriptor */
 	struct user_struct *user;
 };
@@ -443,6 +451,84 @@ static void ep_unregister_pollwait(struct eventpoll *ep, struct epitem *epi)
 	}
 }
 
+/*
+ * Moves the items queued by the poll callbacks onto ep->rdllist.
+ * Must be called with "mtx" held.
+ */
+static void ep_merge_ready(struct eventpoll *ep)
+{
+	struct ep_rdlist *rdl;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		rdl = per_cpu_ptr(ep->rdlists, cpu);
+		if (list_empty(&rdl->list))
+			continue;
+		spin_lock_irq(&rdl->lock);
+		list_splice_tail_init(&rdl->list, &ep->rdllist);
+		spin_unlock_irq(&rdl->lock);
+	}
+}
+
+/* Tells if there is anything on the ready lists, without locking them */
+static int ep_events_available(struct eventpoll *ep)
+{
+	int cpu;
+
+	if (!list_empty(&ep->rdllist))
+		return 1;
+	for_each_possible_cpu(cpu)
+		if (!list_empty(&per_cpu_ptr(ep->rdlists, cpu)->list))
+			return 1;
+	return 0;
+}
+
+/*
+ * Queues an item on ep->rdllist unless it is queued already.
+ * Must be called with "mtx" held.
+ */
+static int ep_queue_ready(struct eventpoll *ep, struct epitem *epi)
+{
+	if (test_and_set_bit(EPI_READY, &epi->state))
+		return 0;
+	list_add_tail(&epi->rdllink, &ep->rdllist);
+	return 1;
+}
+
+/*
+ * Takes an item off the ready lists. Must be called with "mtx" held,
+ * once the item's poll callbacks have been unregistered.
+ */
+static void ep_unqueue_ready(struct eventpoll *ep, struct epitem *epi)
+{
+	if (!test_bit(EPI_READY, &epi->state))
+		return;
+	ep_merge_ready(ep);
+	list_del_init(&epi->rdllink);
+	clear_bit(EPI_READY, &epi->state);
+}
+
+/*
+ * Wakes up (if active) both the eventpoll wait list and the ->poll()
+ * wait list. Returns nonzero if a task waiting in epoll_wait() has
+ * been woken up.
+ */
+static int ep_wake_waiters(struct eventpoll *ep)
+{
+	int woken = 0;
+
+	/* Pairs with set_current_state() in prepare_to_wait_exclusive() */
+	smp_mb();
+	if (waitqueue_active(&ep->wq)) {
+		wake_up(&ep->wq);
+		woken = 1;
+	}
+	if (waitqueue_active(&ep->poll_wait))
+		ep_poll_safewake(&ep->poll_wait);
+
+	return woken;
+}
+
 /**
  * ep_scan_ready_list - Scans the ready list in a way that makes possible for
  *                      the scan code, to call f_op->poll(). Also allows for
@@ -459,9 +545,7 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 					   struct list_head *, void *),
 			      void *priv)
 {
-	int error, pwake = 0;
-	unsigned long flags;
-	struct epitem *epi, *nepi;
+	int error, avail;
 	LIST_HEAD(txlist);
 
 	/*
@@ -471,69 +555,30 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	mutex_lock(&ep->mtx);
 
 	/*
-	 * Steal the ready list, and re-init the original one to the
-	 * empty list. Also, set ep->ovflist to NULL so that events
-	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
-	 * because we want the "sproc" callback to be able to do it
-	 * in a lockless way.
+	 * Collect the per-CPU ready lists and steal the result. The items
+	 * keep EPI_READY set while on "txlist", so events happening while
+	 * looping w/out locks do not touch them; the "sproc" callback
+	 * clears the bit before it polls an item, after which the poll
+	 * callback queues it again on its per-CPU list.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
+	ep_merge_ready(ep);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
-	spin_unlock_irqrestore(&ep->lock, flags);
 
 	/*
 	 * Now call the callback function.
 	 */
 	error = (*sproc)(ep, &txlist, priv);
 
-	spin_lock_irqsave(&ep->lock, flags);
-	/*
-	 * During the time we spent inside the "sproc" callback, some
-	 * other events might have been queued by the poll callback.
-	 * We re-insert them inside the main ready-list here.
-	 */
-	for (nepi = ep->ovflist; (epi = nepi) != NULL;
-	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
-		/*
-		 * We need to check if the item is already in the list.
-		 * During the "sproc" callback execution time, items are
-		 * queued into ->ovflist but the "txlist" might already
-		 * contain them, and the list_splice() below takes care of them.
-		 */
-		if (!ep_is_linked(&epi->rdllink))
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-	}
-	/*
-	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
-	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
-	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
-
 	/*
 	 * Quickly re-inject items left on "txlist".
 	 */
 	list_splice(&txlist, &ep->rdllist);
-
-	if (!list_empty(&ep->rdllist)) {
-		/*
-		 * Wake up (if active) both the eventpoll wait list and
-		 * the ->poll() wait list (delayed after we release the lock).
-		 */
-		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
-		if (waitqueue_active(&ep->poll_wait))
-			pwake++;
-	}
-	spin_unlock_irqrestore(&ep->lock, flags);
+	avail = ep_events_available(ep);
 
 	mutex_unlock(&ep->mtx);
 
-	/* We have to call this outside the lock */
-	if (pwake)
-		ep_poll_safewake(&ep->poll_wait);
+	if (avail)
+		ep_wake_waiters(ep);
 
 	return error;
 }
@@ -544,16 +589,16 @@ static int ep_scan_ready_list(struct eventpoll *ep,
  */
 static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 {
-	unsigned long flags;
 	struct file *file = epi->ffd.file;
 
 	/*
 	 * Removes poll wait queue hooks. We _have_ to do this without holding
-	 * the "ep->lock" otherwise a deadlock might occur. This because of the
-	 * sequence of the lock acquisition. Here we do "ep->lock" then the wait
-	 * queue head lock when unregistering the wait queue. The wakeup callback
-	 * will run by holding the wait queue head lock and will call our callback
-	 * that will try to get "ep->lock".
+	 * a ready list lock otherwise a deadlock might occur. This because of
+	 * the sequence of the lock acquisition. Here we would take the ready
+	 * list lock then the wait queue head lock when unregistering the wait
+	 * queue. The wakeup callback will run by holding the wait queue head
+	 * lock and will call our callback that will try to get the ready list
+	 * lock. Once unregistered, no callback can queue the item anymore.
 	 */
 	ep_unregister_pollwait(ep, epi);
 
@@ -565,10 +610,7 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
-	spin_lock_irqsave(&ep->lock, flags);
-	if (ep_is_linked(&epi->rdllink))
-		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	ep_unqueue_ready(ep, epi);
 
 	/* At this point it is safe to free the eventpoll item */
 	kmem_cache_free(epi_cache, epi);
@@ -610,7 +652,7 @@ static void ep_free(struct eventpoll *ep)
 	 * Walks through the whole tree by freeing each "struct epitem". At this
 	 * point we are sure no poll callbacks will be lingering around, and also by
 	 * holding "epmutex" we can be sure that no file cleanup code will hit
-	 * us during this operation. So we can avoid the lock on "ep->lock".
+	 * us during this operation. So we can avoid holding "ep->mtx".
 	 */
 	while ((rbp = rb_first(&ep->rbr)) != NULL) {
 		epi = rb_entry(rbp, struct epitem, rbn);
@@ -619,6 +661,7 @@ static void ep_free(struct eventpoll *ep)
 
 	mutex_unlock(&epmutex);
 	mutex_destroy(&ep->mtx);
+	free_percpu(ep->rdlists);
 	free_uid(ep->user);
 	kfree(ep);
 }
@@ -639,17 +682,25 @@ static int ep_read_events_proc(struct eventpoll *ep, struct list_head *head,
 	struct epitem *epi, *tmp;
 
 	list_for_each_entry_safe(epi, tmp, head, rdllink) {
+		/*
+		 * Unqueue the item before polling it, so that an event
+		 * racing with the poll queues it again.
+		 */
+		list_del_init(&epi->rdllink);
+		clear_bit(EPI_READY, &epi->state);
+		smp_mb__after_clear_bit();
+
 		if (epi->ffd.file->f_op->poll(epi->ffd.file, NULL) &
-		    epi->event.events)
+		    epi->event.events) {
+			if (!test_and_set_bit(EPI_READY, &epi->state))
+				list_add(&epi->rdllink, head);
 			return POLLIN | POLLRDNORM;
-		else {
-			/*
-			 * Item has been dropped into the ready list by the poll
-			 * callback, but it's not actually ready, as far as
-			 * caller requested events goes. We can remove it here.
-			 */
-			list_del_init(&epi->rdllink);
 		}
+		/*
+		 * Item has been dropped into the ready list by the poll
+		 * callback, but it's not actually ready, as far as
+		 * caller requested events goes. It stays removed.
+		 */
 	}
 
 	return 0;
@@ -734,7 +785,7 @@ void eventpoll_release_file(struct file *file)
 
 static int ep_alloc(struct eventpoll **pep)
 {
-	int error;
+	int error, cpu;
 	struct user_struct *user;
 	struct eventpoll *ep;
 
@@ -743,20 +794,29 @@ static int ep_alloc(struct eventpoll **pep)
 	ep = kzalloc(sizeof(*ep), GFP_KERNEL);
 	if (unlikely(!ep))
 		goto free_uid;
+	ep->rdlists = alloc_percpu(struct ep_rdlist);
+	if (unlikely(!ep->rdlists))
+		goto free_ep;
+	for_each_possible_cpu(cpu) {
+		struct ep_rdlist *rdl = per_cpu_ptr(ep->rdlists, cpu);
+
+		spin_lock_init(&rdl->lock);
+		INIT_LIST_HEAD(&rdl->list);
+	}
 
-	spin_lock_init(&ep->lock);
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT;
-	ep->ovflist = EP_UNACTIVE_PTR;
 	ep->user = user;
 
 	*pep = ep;
 
 	return 0;
 
+free_ep:
+	kfree(ep);
 free_uid:
 	free_uid(user);
 	return error;
@@ -798,12 +858,11 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
-	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
-
-	spin_lock_irqsave(&ep->lock, flags);
+	struct ep_rdlist *rdl;
+	unsigned long flags;
+	int ewake = 0;
 
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
@@ -812,7 +871,7 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
 	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+		goto out;
 
 	/*
 	 * Check the events coming with the callback. At this stage, not
@@ -821,41 +880,31 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * test for "key" != NULL before the event match test.
 	 */
 	if (key && !((unsigned long) key & epi->event.events))
-		goto out_unlock;
+		goto out;
 
 	/*
-	 * If we are trasfering events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happens during that period of time are
-	 * chained in ep->ovflist and requeued later on.
+	 * If this file is already queued, either on a ready list or on the
+	 * list being transferred to userspace, we have nothing to link.
+	 * Otherwise queue it on the ready list of this CPU; the wakeup has
+	 * the wait queue head locked, so we cannot migrate.
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-		}
-		goto out_unlock;
+	if (!test_and_set_bit(EPI_READY, &epi->state)) {
+		rdl = this_cpu_ptr(ep->rdlists);
+		spin_lock_irqsave(&rdl->lock, flags);
+		list_add_tail(&epi->rdllink, &rdl->list);
+		spin_unlock_irqrestore(&rdl->lock, flags);
 	}
 
-	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(&epi->rdllink))
-		list_add_tail(&epi->rdllink, &ep->rdllist);
+	ewake = ep_wake_waiters(ep);
 
+out:
 	/*
-	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
-	 * wait list.
+	 * An EPOLLEXCLUSIVE item sits on the target wait queue as an
+	 * exclusive waiter: tell the wakeup to go on to the next epoll
+	 * set unless we have actually woken a task for this event.
 	 */
-	if (waitqueue_active(&ep->wq))
-		wake_up_locked(&ep->wq);
-	if (waitqueue_active(&ep->poll_wait))
-		pwake++;
-
-out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
-
-	/* We have to call this outside the lock */
-	if (pwake)
-		ep_poll_safewake(&ep->poll_wait);
+	if (epi->event.events & EPOLLEXCLUSIVE)
+		return ewake;
 
 	return 1;
 }
@@ -874,7 +923,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -908,8 +960,7 @@ static void ep_rbtree_insert(struct eventpoll *ep, struct epitem *epi)
 static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		     struct file *tfile, int fd)
 {
-	int error, revents, pwake = 0;
-	unsigned long flags;
+	int error, revents;
 	long user_watches;
 	struct epitem *epi;
 	struct ep_pqueue epq;
@@ -924,11 +975,11 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	INIT_LIST_HEAD(&epi->rdllink);
 	INIT_LIST_HEAD(&epi->fllink);
 	INIT_LIST_HEAD(&epi->pwqlist);
+	epi->state = 0;
 	epi->ep = ep;
 	ep_set_ffd(&epi->ffd, tfile, fd);
 	epi->event = *event;
 	epi->nwait = 0;
-	epi->next = EP_UNACTIVE_PTR;
 
 	/* Initialize the poll table using the queue callback */
 	epq.epi = epi;
@@ -963,28 +1014,14 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	 */
 	ep_rbtree_insert(ep, epi);
 
-	/* We have to drop the new item inside our item list to keep track of it */
-	spin_lock_irqsave(&ep->lock, flags);
-
 	/* If the file is already "ready" we drop it inside the ready list */
-	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
-
+	if ((revents & event->events) && ep_queue_ready(ep, epi)) {
 		/* Notify waiting tasks that events are available */
-		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
-		if (waitqueue_active(&ep->poll_wait))
-			pwake++;
+		ep_wake_waiters(ep);
 	}
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
 	atomic_long_inc(&ep->user->epoll_watches);
 
-	/* We have to call this outside the lock */
-	if (pwake)
-		ep_poll_safewake(&ep->poll_wait);
-
 	return 0;
 
 error_unregister:
@@ -992,14 +1029,9 @@ error_unregister:
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * allocated wait queue.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
-	if (ep_is_linked(&epi->rdllink))
-		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	ep_unqueue_ready(ep, epi);
 
 	kmem_cache_free(epi_cache, epi);
 
@@ -1012,7 +1044,6 @@ error_unregister:
  */
 static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_event *event)
 {
-	int pwake = 0;
 	unsigned int revents;
 
 	/*
@@ -1033,24 +1064,11 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 * If the item is "hot" and it is not registered inside the ready
 	 * list, push it inside.
 	 */
-	if (revents & event->events) {
-		spin_lock_irq(&ep->lock);
-		if (!ep_is_linked(&epi->rdllink)) {
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-
-			/* Notify waiting tasks that events are available */
-			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
-			if (waitqueue_active(&ep->poll_wait))
-				pwake++;
-		}
-		spin_unlock_irq(&ep->lock);
+	if ((revents & event->events) && ep_queue_ready(ep, epi)) {
+		/* Notify waiting tasks that events are available */
+		ep_wake_waiters(ep);
 	}
 
-	/* We have to call this outside the lock */
-	if (pwake)
-		ep_poll_safewake(&ep->poll_wait);
-
 	return 0;
 }
 
@@ -1072,7 +1090,13 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 	     !list_empty(head) && eventcnt < esed->maxevents;) {
 		epi = list_first_entry(head, struct epitem, rdllink);
 
+		/*
+		 * Unqueue the item before polling it, so that an event
+		 * racing with the poll queues it again.
+		 */
 		list_del_init(&epi->rdllink);
+		clear_bit(EPI_READY, &epi->state);
+		smp_mb__after_clear_bit();
 
 		revents = epi->ffd.file->f_op->poll(epi->ffd.file, NULL) &
 			epi->event.events;
@@ -1086,7 +1110,8 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 		if (revents) {
 			if (__put_user(revents, &uevent->events) ||
 			    __put_user(epi->event.data, &uevent->data)) {
-				list_add(&epi->rdllink, head);
+				if (!test_and_set_bit(EPI_READY, &epi->state))
+					list_add(&epi->rdllink, head);
 				return eventcnt ? eventcnt : -EFAULT;
 			}
 			eventcnt++;
@@ -1103,9 +1128,9 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 				 * into ep->rdllist besides us. The epoll_ctl()
 				 * callers are locked out by
 				 * ep_scan_ready_list() holding "mtx" and the
-				 * poll callback will queue them in ep->ovflist.
+				 * poll callback uses the per-CPU lists.
 				 */
-				list_add_tail(&epi->rdllink, &ep->rdllist);
+				ep_queue_ready(ep, epi);
 			}
 		}
 	}
@@ -1139,9 +1164,8 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		   int maxevents, long timeout)
 {
 	int res, eavail, timed_out = 0;
-	unsigned long flags;
-	long slack;
-	wait_queue_t wait;
+	long slack = 0;
+	DEFINE_WAIT(wait);
 	ktime_t expires, *to = NULL;
 
 	if (timeout > 0) {
@@ -1155,46 +1179,39 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 	}
 
 retry:
-	spin_lock_irqsave(&ep->lock, flags);
-
 	res = 0;
-	if (list_empty(&ep->rdllist)) {
+	if (!ep_events_available(ep)) {
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
 		 * ep_poll_callback() when events will become available.
+		 * The wakeup takes us off the wait queue, so that the events
+		 * that follow it do not bother waking us up again until we
+		 * are done collecting: one wakeup per batch of events. And
+		 * it wakes up only one of the tasks waiting on this set.
 		 */
-		init_waitqueue_entry(&wait, current);
-		__add_wait_queue_exclusive(&ep->wq, &wait);
-
 		for (;;) {
 			/*
 			 * We don't want to sleep if the ep_poll_callback() sends us
 			 * a wakeup in between. That's why we set the task state
 			 * to TASK_INTERRUPTIBLE before doing the checks.
 			 */
-			set_current_state(TASK_INTERRUPTIBLE);
-			if (!list_empty(&ep->rdllist) || timed_out)
+			prepare_to_wait_exclusive(&ep->wq, &wait,
+						  TASK_INTERRUPTIBLE);
+			if (ep_events_available(ep) || timed_out)
 				break;
 			if (signal_pending(current)) {
 				res = -EINTR;
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
 			if (!schedule_hrtimeout_range(to, slack, HRTIMER_MODE_ABS))
 				timed_out = 1;
-
-			spin_lock_irqsave(&ep->lock, flags);
 		}
-		__remove_wait_queue(&ep->wq, &wait);
-
-		set_current_state(TASK_RUNNING);
+		finish_wait(&ep->wq, &wait);
 	}
 	/* Is it worth to try to dig for events ? */
-	eavail = !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
-
-	spin_unlock_irqrestore(&ep->lock, flags);
+	eavail = ep_events_available(ep);
 
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
@@ -1348,6 +1365,19 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	if (file == tfile || !is_file_epoll(file))
 		goto error_tgt_fput;
 
+	/*
+	 * EPOLLEXCLUSIVE can only be set on EPOLL_CTL_ADD, with a limited
+	 * set of events, and not for a nested epoll file: the exclusive
+	 * wakeup accounting of ep_poll_callback() does not hold there.
+	 */
+	if (ep_op_has_event(op) && (epds.events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD)
+			goto error_tgt_fput;
+		if (is_file_epoll(tfile) ||
+		    (epds.events & ~EP_EXCLUSIVE_OK_BITS))
+			goto error_tgt_fput;
+	}
+
 	/*
 	 * At this point it is safe to assume that the "private_data" contains
 	 * our own data structure.
@@ -1399,8 +1429,10 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
-			epds.events |= POLLERR | POLLHUP;
-			error = ep_modify(ep, epi, &epds);
+			if (!(epi->event.events & EPOLLEXCLUSIVE)) {
+				epds.events |= POLLERR | POLLHUP;
+				error = ep_modify(ep, epi, &epds);
+			}
 		} else
 			error = -ENOENT;
 		break;
@@ -626,6 +626,16 @@ struct ext4_inode {
 	__le32  i_version_hi;	/* high 32 bits for 64-bit version */
 };
 
+/*
+ * Payload of a journal fast commit block: a copy of one on-disk inode
+ */
+struct ext4_fc_inode {
+	__le32	fc_ino;		/* Inode number */
+	__le16	fc_inode_size;	/* Bytes in fc_raw, the fs inode size */
+	__le16	fc_reserved;
+	__u8	fc_raw[0];	/* struct ext4_inode */
+};
+
 struct move_extent {
 	__u32 reserved;		/* should be zero */
 	__u32 donor_fd;		/* donor file descriptor */
@@ -858,6 +868,12 @@ struct ext4_inode_info {
 	 */
 	tid_t i_sync_tid;
 	tid_t i_datasync_tid;
+
+	/*
+	 * Transaction in which the inode last changed along with other
+	 * metadata, so that a fast commit of the inode alone won't do.
+	 */
+	tid_t i_fc_ineligible_tid;
 };
 
 /*
@@ -895,6 +911,7 @@ struct ext4_inode_info {
 #define EXT4_MOUNT_POSIX_ACL		0x08000	/* POSIX Access Control Lists */
 #define EXT4_MOUNT_NO_AUTO_DA_ALLOC	0x10000	/* No auto delalloc mapping */
 #define EXT4_MOUNT_BARRIER		0x20000 /* Use block barriers */
+#define EXT4_MOUNT_FAST_COMMIT		0x40000 /* Fast commits for fsync */
 #define EXT4_MOUNT_QUOTA		0x80000 /* Some quota option set */
 #define EXT4_MOUNT_USRQUOTA		0x100000 /* "old" user quota */
 #define EXT4_MOUNT_GRPQUOTA		0x200000 /* "old" group quota */
@@ -1397,6 +1414,11 @@ static inline void ext4_clear_state_flags(struct ext4_inode_info *ei)
 #define EXT4_DEF_MIN_BATCH_TIME	0
 #define EXT4_DEF_MAX_BATCH_TIME	15000 /* 15ms */
 
+/*
+ * Default size of the journal fast commit area, in blocks
+ */
+#define EXT4_DEF_FC_BLOCKS	256
+
 /*
  * Minimum number of groups in a flexgroup before we separate out
  * directories into the first block group of a flexgroup
@@ -1674,6 +1696,10 @@ extern void ext4_htree_free_dir_info(struct dir_private_info *p);
 extern int ext4_sync_file(struct file *, int);
 extern int ext4_flush_completed_IO(struct inode *);
 
+/* fast_commit.c */
+extern int ext4_fc_commit(struct inode *);
+extern int ext4_fc_replay(journal_t *, void *, int);
+
 /* hash.c */
 extern int ext4fs_dirhash(const char *name, int len, struct
 			  dx_hash_info *hinfo);
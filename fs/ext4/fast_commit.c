@@ -0,0 +1,142 @@
+/*
+ * linux/fs/ext4/fast_commit.c
+ *
+ * Fast commits of inode-only changes.
+ *
+ * An fsync normally commits the running transaction, which writes out all
+ * the metadata it holds and, in ordered mode, the data of every inode that
+ * allocated blocks in it.  When all that the running transaction holds for
+ * the inode being synced is a change to its own on-disk inode -- new times
+ * after data was overwritten in place, a chmod, a size change within the
+ * blocks the file already had -- a copy of that on-disk inode is all
+ * recovery needs.  The copy goes to the fast commit area of the journal in
+ * one block, and recovery writes it back if the transaction never made it
+ * to disk.
+ *
+ * Anything that changes other metadata along with the inode (allocation,
+ * truncate, namespace and xattr changes, ...) makes the inode ineligible
+ * for the rest of the transaction, see ext4_fc_mark_ineligible().
+ */
+
+#include <linux/fs.h>
+#include <linux/jbd2.h>
+#include <linux/slab.h>
+
+#include "ext4.h"
+#include "ext4_jbd2.h"
+
+/*
+ * Try to make @inode stable with a fast commit.  Called by fsync with
+ * i_mutex held, once the data has been written.  Returns 0 on success;
+ * on error the caller has to commit the running transaction instead.
+ */
+int ext4_fc_commit(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	int size = EXT4_INODE_SIZE(sb);
+	struct ext4_fc_inode *fc;
+	struct ext4_iloc iloc;
+	void *raw, *copy;
+	tid_t tid;
+	int err;
+
+	if (!test_opt(sb, FAST_COMMIT) || !S_ISREG(inode->i_mode) ||
+	    inode->i_ino < EXT4_FIRST_INO(sb))
+		return -EAGAIN;
+
+	fc = kmalloc(sizeof(*fc) + 2 * size, GFP_NOFS);
+	if (!fc)
+		return -ENOMEM;
+	copy = fc->fc_raw + size;
+
+	/* Keeps block allocation, and so i_datasync_tid, away */
+	down_read(&ei->i_data_sem);
+	tid = ei->i_sync_tid;
+	err = -EAGAIN;
+	if (tid == ei->i_datasync_tid || tid == ei->i_fc_ineligible_tid)
+		goto out_sem;
+	err = ext4_get_inode_loc(inode, &iloc);
+	if (err)
+		goto out_sem;
+
+	/*
+	 * Not everybody updating the on-disk inode holds i_data_sem (atime,
+	 * i_disksize after writeback), copy it until two copies agree.
+	 */
+	raw = ext4_raw_inode(&iloc);
+	memcpy(fc->fc_raw, raw, size);
+	for (;;) {
+		memcpy(copy, raw, size);
+		if (!memcmp(copy, fc->fc_raw, size))
+			break;
+		memcpy(fc->fc_raw, copy, size);
+	}
+	brelse(iloc.bh);
+	up_read(&ei->i_data_sem);
+
+	fc->fc_ino = cpu_to_le32(inode->i_ino);
+	fc->fc_inode_size = cpu_to_le16(size);
+	fc->fc_reserved = 0;
+
+	/* Fails unless tid is still running, so the copy belongs to it */
+	err = jbd2_fc_write(EXT4_SB(sb)->s_journal, tid, fc,
+			    sizeof(*fc) + size);
+	kfree(fc);
+	return err;
+
+out_sem:
+	up_read(&ei->i_data_sem);
+	kfree(fc);
+	return err;
+}
+
+/*
+ * Journal recovery callback: write an inode copied by ext4_fc_commit()
+ * back to the inode table.  The rest of the filesystem has just been
+ * recovered to the state the copy was taken against.
+ */
+int ext4_fc_replay(journal_t *journal, void *data, int len)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_fc_inode *fc = data;
+	unsigned long ino = le32_to_cpu(fc->fc_ino);
+	int size = EXT4_INODE_SIZE(sb);
+	struct ext4_group_desc *gdp;
+	struct buffer_head *bh;
+	ext4_fsblk_t block;
+	int inodes_per_block, inode_offset;
+
+	if (len != sizeof(*fc) + size ||
+	    le16_to_cpu(fc->fc_inode_size) != size ||
+	    ino < EXT4_FIRST_INO(sb) || !ext4_valid_inum(sb, ino)) {
+		ext4_msg(sb, KERN_WARNING,
+			 "ignoring bad fast commit for inode %lu", ino);
+		return 0;
+	}
+
+	gdp = ext4_get_group_desc(sb, (ino - 1) / EXT4_INODES_PER_GROUP(sb),
+				  NULL);
+	if (!gdp)
+		return -EIO;
+
+	inodes_per_block = EXT4_BLOCK_SIZE(sb) / size;
+	inode_offset = (ino - 1) % EXT4_INODES_PER_GROUP(sb);
+	block = ext4_inode_table(sb, gdp) + inode_offset / inodes_per_block;
+
+	bh = sb_bread(sb, block);
+	if (!bh) {
+		ext4_msg(sb, KERN_ERR, "unable to read inode block %llu "
+			 "for fast commit of inode %lu", block, ino);
+		return -EIO;
+	}
+	lock_buffer(bh);
+	memcpy(bh->b_data + (inode_offset % inodes_per_block) * size,
+	       fc->fc_raw, size);
+	unlock_buffer(bh);
+	mark_buffer_dirty(bh);
+	brelse(bh);
+
+	jbd_debug(1, "EXT4-fs: fast commit of inode %lu replayed\n", ino);
+	return 0;
+}
@@ -198,10 +198,28 @@ int ext4_sync_file(struct file *file, int datasync)
 	if (ext4_should_journal_data(inode))
 		return ext4_force_commit(inode->i_sb);
 
+	/*
+	 * If all the running transaction holds for the inode is the inode
+	 * itself, a fast commit of it will do.  fdatasync only gets here
+	 * with blocks allocated in the running transaction, which rules
+	 * the fast commit out anyway.
+	 */
+	if (!datasync && !ext4_fc_commit(inode))
+		return 0;
+
 	commit_tid = datasync ? ei->i_datasync_tid : ei->i_sync_tid;
 	if (journal->j_flags & JBD2_BARRIER &&
 	    !jbd2_trans_will_send_data_barrier(journal, commit_tid))
 		needs_barrier = true;
+	/*
+	 * Don't sleep waiting for other fsyncers to join the transaction
+	 * with i_mutex held, writers to this file would wait too.  Whatever
+	 * they change meanwhile goes into this transaction or a later one,
+	 * commit_tid stays good either way.
+	 */
+	mutex_unlock(&inode->i_mutex);
+	jbd2_log_batch_sync(journal, commit_tid);
+	mutex_lock(&inode->i_mutex);
 	jbd2_log_start_commit(journal, commit_tid);
 	ret = jbd2_log_wait_commit(journal, commit_tid);
 	if (needs_barrier)
@@ -1029,6 +1029,7 @@ got:
 
 	ext4_clear_state_flags(ei); /* Only relevant on 32-bit archs */
 	ext4_set_inode_state(inode, EXT4_STATE_NEW);
+	ext4_fc_mark_ineligible(handle, inode);
 
 	ei->i_extra_isize = EXT4_SB(sb)->s_want_extra_isize;
 
@@ -5340,6 +5340,8 @@ int ext4_setattr(struct dentry *dentry, struct iattr *attr)
 			ext4_journal_stop(handle);
 			return error;
 		}
+		/* The quota files changed along with the inode */
+		ext4_fc_mark_ineligible(handle, inode);
 		/* Update corresponding info in inode so that everything is in
 		 * one transaction */
 		if (attr->ia_valid & ATTR_UID)
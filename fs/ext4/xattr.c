@@ -992,6 +992,7 @@ ext4_xattr_set_handle(handle_t *handle, struct inode *inode, int name_index,
 	error = ext4_journal_get_write_access(handle, is.iloc.bh);
 	if (error)
 		goto cleanup;
+	ext4_fc_mark_ineligible(handle, inode);
 
 	if (ext4_test_inode_state(inode, EXT4_STATE_NEW)) {
 		struct ext4_inode *raw_inode = ext4_raw_inode(&is.iloc);
@@ -13,11 +13,15 @@
 #include <linux/buffer_head.h>
 #include "fat.h"
 
-/* this must be > 0. */
-#define FAT_MAX_CACHE	8
-
+/*
+ * Each inode keeps the contiguous extents of its cluster chain seen so
+ * far in an rbtree indexed by file cluster, so that seeking in a large
+ * file doesn't have to walk the FAT from the nearest of a few cached
+ * points.  There is no limit on the number of extents per inode, the
+ * shrinker drops whole trees instead, oldest updated inode first.
+ */
 struct fat_cache {
-	struct list_head cache_list;
+	struct rb_node cache_node;
 	int nr_contig;	/* number of contiguous clusters */
 	int fcluster;	/* cluster number in the file. */
 	int dcluster;	/* cluster number on disk. */
@@ -30,164 +34,205 @@ struct fat_cache_id {
 	int dcluster;
 };
 
-static inline int fat_max_cache(struct inode *inode)
+static struct kmem_cache *fat_cache_cachep;
+
+/* Inodes with cached extents, protected by fat_cache_inodes_lock */
+static LIST_HEAD(fat_cache_inodes);
+static DEFINE_SPINLOCK(fat_cache_inodes_lock);
+static atomic_t fat_nr_caches = ATOMIC_INIT(0);
+
+static inline struct fat_cache *fat_cache_alloc(struct inode *inode)
+{
+	return kmem_cache_alloc(fat_cache_cachep, GFP_NOFS);
+}
+
+static inline void fat_cache_free(struct fat_cache *cache)
 {
-	return FAT_MAX_CACHE;
+	kmem_cache_free(fat_cache_cachep, cache);
 }
 
-static struct kmem_cache *fat_cache_cachep;
+/* Free all extents of an inode, the caller holds both locks */
+static void __fat_cache_drop(struct msdos_inode_info *i)
+{
+	struct rb_node *n;
+
+	while ((n = rb_first(&i->cache_tree)) != NULL) {
+		rb_erase(n, &i->cache_tree);
+		fat_cache_free(rb_entry(n, struct fat_cache, cache_node));
+	}
+	atomic_sub(i->nr_caches, &fat_nr_caches);
+	i->nr_caches = 0;
+	list_del_init(&i->cache_inodes);
+}
 
-static void init_once(void *foo)
+/*
+ * Lock order is ->cache_lock, then fat_cache_inodes_lock, hence the
+ * trylock.  An inode on the list can't go away under us, as eviction
+ * takes it off the list first.
+ */
+static int fat_cache_shrink(struct shrinker *shrink, int nr_to_scan,
+			    gfp_t gfp_mask)
 {
-	struct fat_cache *cache = (struct fat_cache *)foo;
+	struct msdos_inode_info *i, *tmp;
 
-	INIT_LIST_HEAD(&cache->cache_list);
+	if (nr_to_scan) {
+		spin_lock(&fat_cache_inodes_lock);
+		list_for_each_entry_safe(i, tmp, &fat_cache_inodes,
+					 cache_inodes) {
+			if (nr_to_scan <= 0)
+				break;
+			if (!spin_trylock(&i->cache_lock))
+				continue;
+			nr_to_scan -= i->nr_caches;
+			__fat_cache_drop(i);
+			spin_unlock(&i->cache_lock);
+		}
+		spin_unlock(&fat_cache_inodes_lock);
+	}
+	return (atomic_read(&fat_nr_caches) / 100) * sysctl_vfs_cache_pressure;
 }
 
+static struct shrinker fat_cache_shrinker = {
+	.shrink = fat_cache_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
 int __init fat_cache_init(void)
 {
 	fat_cache_cachep = kmem_cache_create("fat_cache",
 				sizeof(struct fat_cache),
 				0, SLAB_RECLAIM_ACCOUNT|SLAB_MEM_SPREAD,
-				init_once);
+				NULL);
 	if (fat_cache_cachep == NULL)
 		return -ENOMEM;
+	register_shrinker(&fat_cache_shrinker);
 	return 0;
 }
 
 void fat_cache_destroy(void)
 {
+	unregister_shrinker(&fat_cache_shrinker);
 	kmem_cache_destroy(fat_cache_cachep);
 }
 
-static inline struct fat_cache *fat_cache_alloc(struct inode *inode)
-{
-	return kmem_cache_alloc(fat_cache_cachep, GFP_NOFS);
-}
-
-static inline void fat_cache_free(struct fat_cache *cache)
-{
-	BUG_ON(!list_empty(&cache->cache_list));
-	kmem_cache_free(fat_cache_cachep, cache);
-}
-
-static inline void fat_cache_update_lru(struct inode *inode,
-					struct fat_cache *cache)
-{
-	if (MSDOS_I(inode)->cache_lru.next != &cache->cache_list)
-		list_move(&cache->cache_list, &MSDOS_I(inode)->cache_lru);
-}
-
 static int fat_cache_lookup(struct inode *inode, int fclus,
 			    struct fat_cache_id *cid,
 			    int *cached_fclus, int *cached_dclus)
 {
-	static struct fat_cache nohit = { .fcluster = 0, };
-
-	struct fat_cache *hit = &nohit, *p;
+	struct msdos_inode_info *i = MSDOS_I(inode);
+	struct fat_cache *hit = NULL, *p;
+	struct rb_node *n;
 	int offset = -1;
 
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-	list_for_each_entry(p, &MSDOS_I(inode)->cache_lru, cache_list) {
-		/* Find the cache of "fclus" or nearest cache. */
-		if (p->fcluster <= fclus && hit->fcluster < p->fcluster) {
+	spin_lock(&i->cache_lock);
+	/* Find the cache of "fclus" or nearest cache. */
+	n = i->cache_tree.rb_node;
+	while (n) {
+		p = rb_entry(n, struct fat_cache, cache_node);
+		if (fclus < p->fcluster)
+			n = n->rb_left;
+		else {
 			hit = p;
-			if ((hit->fcluster + hit->nr_contig) < fclus) {
-				offset = hit->nr_contig;
-			} else {
-				offset = fclus - hit->fcluster;
+			if (fclus == p->fcluster)
 				break;
-			}
+			n = n->rb_right;
 		}
 	}
-	if (hit != &nohit) {
-		fat_cache_update_lru(inode, hit);
+	if (hit) {
+		offset = min(fclus - hit->fcluster, hit->nr_contig);
 
-		cid->id = MSDOS_I(inode)->cache_valid_id;
+		cid->id = i->cache_valid_id;
 		cid->nr_contig = hit->nr_contig;
 		cid->fcluster = hit->fcluster;
 		cid->dcluster = hit->dcluster;
 		*cached_fclus = cid->fcluster + offset;
 		*cached_dclus = cid->dcluster + offset;
 	}
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&i->cache_lock);
 
 	return offset;
 }
 
-static struct fat_cache *fat_cache_merge(struct inode *inode,
-					 struct fat_cache_id *new)
+/*
+ * Find the same part as "new" in cluster-chain, or the place to link
+ * it in.  Returns the cache found, or NULL with *link and *parent set.
+ */
+static struct fat_cache *fat_cache_find(struct msdos_inode_info *i,
+					struct fat_cache_id *new,
+					struct rb_node ***link,
+					struct rb_node **parent)
 {
-	struct fat_cache *p;
-
-	list_for_each_entry(p, &MSDOS_I(inode)->cache_lru, cache_list) {
-		/* Find the same part as "new" in cluster-chain. */
-		if (p->fcluster == new->fcluster) {
-			BUG_ON(p->dcluster != new->dcluster);
-			if (new->nr_contig > p->nr_contig)
-				p->nr_contig = new->nr_contig;
-			return p;
+	struct rb_node **p = &i->cache_tree.rb_node;
+	struct fat_cache *cache;
+
+	*parent = NULL;
+	while (*p) {
+		*parent = *p;
+		cache = rb_entry(*p, struct fat_cache, cache_node);
+		if (new->fcluster < cache->fcluster)
+			p = &(*p)->rb_left;
+		else if (new->fcluster > cache->fcluster)
+			p = &(*p)->rb_right;
+		else {
+			BUG_ON(cache->dcluster != new->dcluster);
+			if (new->nr_contig > cache->nr_contig)
+				cache->nr_contig = new->nr_contig;
+			return cache;
 		}
 	}
+	*link = p;
 	return NULL;
 }
 
 static void fat_cache_add(struct inode *inode, struct fat_cache_id *new)
 {
-	struct fat_cache *cache, *tmp;
+	struct msdos_inode_info *i = MSDOS_I(inode);
+	struct fat_cache *cache;
+	struct rb_node **link, *parent;
 
 	if (new->fcluster == -1) /* dummy cache */
 		return;
 
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-	if (new->id != FAT_CACHE_VALID &&
-	    new->id != MSDOS_I(inode)->cache_valid_id)
+	spin_lock(&i->cache_lock);
+	if (new->id != FAT_CACHE_VALID && new->id != i->cache_valid_id)
 		goto out;	/* this cache was invalidated */
+	if (fat_cache_find(i, new, &link, &parent))
+		goto out;
+	spin_unlock(&i->cache_lock);
 
-	cache = fat_cache_merge(inode, new);
-	if (cache == NULL) {
-		if (MSDOS_I(inode)->nr_caches < fat_max_cache(inode)) {
-			MSDOS_I(inode)->nr_caches++;
-			spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
-
-			tmp = fat_cache_alloc(inode);
-			spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-			cache = fat_cache_merge(inode, new);
-			if (cache != NULL) {
-				MSDOS_I(inode)->nr_caches--;
-				fat_cache_free(tmp);
-				goto out_update_lru;
-			}
-			cache = tmp;
-		} else {
-			struct list_head *p = MSDOS_I(inode)->cache_lru.prev;
-			cache = list_entry(p, struct fat_cache, cache_list);
-		}
-		cache->fcluster = new->fcluster;
-		cache->dcluster = new->dcluster;
-		cache->nr_contig = new->nr_contig;
+	cache = fat_cache_alloc(inode);
+	if (!cache)
+		return;
+
+	spin_lock(&i->cache_lock);
+	if ((new->id != FAT_CACHE_VALID && new->id != i->cache_valid_id) ||
+	    fat_cache_find(i, new, &link, &parent)) {
+		fat_cache_free(cache);
+		goto out;
 	}
-out_update_lru:
-	fat_cache_update_lru(inode, cache);
+	cache->fcluster = new->fcluster;
+	cache->dcluster = new->dcluster;
+	cache->nr_contig = new->nr_contig;
+	rb_link_node(&cache->cache_node, parent, link);
+	rb_insert_color(&cache->cache_node, &i->cache_tree);
+	i->nr_caches++;
+	atomic_inc(&fat_nr_caches);
+
+	spin_lock(&fat_cache_inodes_lock);
+	list_move_tail(&i->cache_inodes, &fat_cache_inodes);
+	spin_unlock(&fat_cache_inodes_lock);
 out:
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&i->cache_lock);
 }
 
-/*
- * Cache invalidation occurs rarely, thus the LRU chain is not updated. It
- * fixes itself after a while.
- */
 static void __fat_cache_inval_inode(struct inode *inode)
 {
 	struct msdos_inode_info *i = MSDOS_I(inode);
-	struct fat_cache *cache;
 
-	while (!list_empty(&i->cache_lru)) {
-		cache = list_entry(i->cache_lru.next, struct fat_cache, cache_list);
-		list_del_init(&cache->cache_list);
-		i->nr_caches--;
-		fat_cache_free(cache);
-	}
+	spin_lock(&fat_cache_inodes_lock);
+	__fat_cache_drop(i);
+	spin_unlock(&fat_cache_inodes_lock);
+
 	/* Update. The copy of caches before this id is discarded. */
 	i->cache_valid_id++;
 	if (i->cache_valid_id == FAT_CACHE_VALID)
@@ -196,9 +241,9 @@ static void __fat_cache_inval_inode(struct inode *inode)
 
 void fat_cache_inval_inode(struct inode *inode)
 {
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_lock(&MSDOS_I(inode)->cache_lock);
 	__fat_cache_inval_inode(inode);
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&MSDOS_I(inode)->cache_lock);
 }
 
 static inline int cache_contiguous(struct fat_cache_id *cid, int dclus)
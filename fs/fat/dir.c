@@ -18,6 +18,7 @@
 #include <linux/time.h>
 #include <linux/buffer_head.h>
 #include <linux/compat.h>
+#include <linux/hash.h>
 #include <asm/uaccess.h>
 #include <linux/kernel.h>
 #include "fat.h"
@@ -333,106 +334,566 @@ parse_long:
 }
 
 /*
- * Return values: negative -> error, 0 -> not found, positive -> found,
- * value is the total amount of slots, including the shortname entry.
+ * Read the next record, i.e. the longname slots if any and the shortname
+ * entry they belong to, from *pos on.  Returns zero with *de pointing at
+ * the shortname entry and *nr_slots set to the number of longname slots,
+ * -ENOENT at the end of directory, or another negative error.
  */
-int fat_search_long(struct inode *inode, const unsigned char *name,
-		    int name_len, struct fat_slot_info *sinfo)
+static int fat_get_record(struct inode *dir, loff_t *pos,
+			  struct buffer_head **bh, struct msdos_dir_entry **de,
+			  wchar_t **unicode, unsigned char *nr_slots)
 {
-	struct super_block *sb = inode->i_sb;
-	struct msdos_sb_info *sbi = MSDOS_SB(sb);
-	struct buffer_head *bh = NULL;
-	struct msdos_dir_entry *de;
-	struct nls_table *nls_disk = sbi->nls_disk;
-	unsigned char nr_slots;
-	wchar_t bufuname[14];
-	wchar_t *unicode = NULL;
-	unsigned char work[MSDOS_NAME];
-	unsigned char bufname[FAT_MAX_SHORT_SIZE];
-	unsigned short opt_shortname = sbi->options.shortname;
-	loff_t cpos = 0;
-	int chl, i, j, last_u, err, len;
+	int status;
 
-	err = -ENOENT;
-	while (1) {
-		if (fat_get_entry(inode, &cpos, &bh, &de) == -1)
-			goto end_of_dir;
+	while (fat_get_entry(dir, pos, bh, de) >= 0) {
 parse_record:
-		nr_slots = 0;
-		if (de->name[0] == DELETED_FLAG)
+		*nr_slots = 0;
+		if ((*de)->name[0] == DELETED_FLAG)
 			continue;
-		if (de->attr != ATTR_EXT && (de->attr & ATTR_VOLUME))
+		if ((*de)->attr != ATTR_EXT && ((*de)->attr & ATTR_VOLUME))
 			continue;
-		if (de->attr != ATTR_EXT && IS_FREE(de->name))
+		if ((*de)->attr != ATTR_EXT && IS_FREE((*de)->name))
 			continue;
-		if (de->attr == ATTR_EXT) {
-			int status = fat_parse_long(inode, &cpos, &bh, &de,
-						    &unicode, &nr_slots);
-			if (status < 0) {
-				err = status;
-				goto end_of_dir;
-			} else if (status == PARSE_INVALID)
-				continue;
-			else if (status == PARSE_NOT_LONGNAME)
-				goto parse_record;
-			else if (status == PARSE_EOF)
-				goto end_of_dir;
-		}
+		if ((*de)->attr != ATTR_EXT)
+			return 0;
 
-		memcpy(work, de->name, sizeof(de->name));
-		/* see namei.c, msdos_format_name */
-		if (work[0] == 0x05)
-			work[0] = 0xE5;
-		for (i = 0, j = 0, last_u = 0; i < 8;) {
-			if (!work[i])
-				break;
-			chl = fat_shortname2uni(nls_disk, &work[i], 8 - i,
-						&bufuname[j++], opt_shortname,
-						de->lcase & CASE_LOWER_BASE);
-			if (chl <= 1) {
-				if (work[i] != ' ')
-					last_u = j;
-			} else {
+		status = fat_parse_long(dir, pos, bh, de, unicode, nr_slots);
+		if (status < 0) {
+			*bh = NULL;	/* released by fat_parse_long() */
+			return status;
+		} else if (status == PARSE_INVALID)
+			continue;
+		else if (status == PARSE_NOT_LONGNAME)
+			goto parse_record;
+		else if (status == PARSE_EOF)
+			break;
+		return 0;
+	}
+	return -ENOENT;
+}
+
+/*
+ * Convert the names of a record to the I/O charset.  The longname, if the
+ * record has one, is put in the second half of the unicode buffer.
+ * Returns zero if the record has no usable name.
+ */
+static int fat_record_names(struct msdos_sb_info *sbi,
+			    struct msdos_dir_entry *de, wchar_t *unicode,
+			    unsigned char nr_slots, unsigned char *shortname,
+			    int *short_len, unsigned char **longname,
+			    int *long_len)
+{
+	struct nls_table *nls_disk = sbi->nls_disk;
+	unsigned short opt_shortname = sbi->options.shortname;
+	unsigned char work[MSDOS_NAME];
+	wchar_t bufuname[14];
+	int chl, i, j, last_u;
+
+	memcpy(work, de->name, sizeof(de->name));
+	/* see namei.c, msdos_format_name */
+	if (work[0] == 0x05)
+		work[0] = 0xE5;
+	for (i = 0, j = 0, last_u = 0; i < 8;) {
+		if (!work[i])
+			break;
+		chl = fat_shortname2uni(nls_disk, &work[i], 8 - i,
+					&bufuname[j++], opt_shortname,
+					de->lcase & CASE_LOWER_BASE);
+		if (chl <= 1) {
+			if (work[i] != ' ')
 				last_u = j;
-			}
-			i += chl;
+		} else {
+			last_u = j;
 		}
-		j = last_u;
-		fat_short2uni(nls_disk, ".", 1, &bufuname[j++]);
-		for (i = 8; i < MSDOS_NAME;) {
-			if (!work[i])
-				break;
-			chl = fat_shortname2uni(nls_disk, &work[i],
-						MSDOS_NAME - i,
-						&bufuname[j++], opt_shortname,
-						de->lcase & CASE_LOWER_EXT);
-			if (chl <= 1) {
-				if (work[i] != ' ')
-					last_u = j;
-			} else {
+		i += chl;
+	}
+	j = last_u;
+	fat_short2uni(nls_disk, ".", 1, &bufuname[j++]);
+	for (i = 8; i < MSDOS_NAME;) {
+		if (!work[i])
+			break;
+		chl = fat_shortname2uni(nls_disk, &work[i],
+					MSDOS_NAME - i,
+					&bufuname[j++], opt_shortname,
+					de->lcase & CASE_LOWER_EXT);
+		if (chl <= 1) {
+			if (work[i] != ' ')
 				last_u = j;
-			}
-			i += chl;
+		} else {
+			last_u = j;
 		}
-		if (!last_u)
+		i += chl;
+	}
+	if (!last_u)
+		return 0;
+
+	bufuname[last_u] = 0x0000;
+	*short_len = fat_uni_to_x8(sbi, bufuname, shortname,
+				   FAT_MAX_SHORT_SIZE);
+	*long_len = 0;
+	if (nr_slots) {
+		int size = PATH_MAX - FAT_MAX_UNI_SIZE;
+
+		*longname = (unsigned char *)(unicode + FAT_MAX_UNI_CHARS);
+		*long_len = fat_uni_to_x8(sbi, unicode, *longname, size);
+	}
+	return 1;
+}
+
+static int fat_record_match(struct msdos_sb_info *sbi,
+			    struct msdos_dir_entry *de, wchar_t *unicode,
+			    unsigned char nr_slots,
+			    const unsigned char *name, int name_len)
+{
+	unsigned char bufname[FAT_MAX_SHORT_SIZE];
+	unsigned char *longname;
+	int short_len, long_len;
+
+	if (!fat_record_names(sbi, de, unicode, nr_slots, bufname, &short_len,
+			      &longname, &long_len))
+		return 0;
+
+	/* Compare shortname, then longname */
+	if (fat_name_match(sbi, name, name_len, bufname, short_len))
+		return 1;
+	return nr_slots &&
+		fat_name_match(sbi, name, name_len, longname, long_len);
+}
+
+/*
+ * Name index of large directories.
+ *
+ * The first lookup in a directory of FAT_INDEX_MIN_SIZE or more reads
+ * all of its records and hashes their names, and fat_add_entries() and
+ * fat_remove_entries() keep the index up to date from then on.  A lookup
+ * only reads the records whose names hash like the name it looks for,
+ * and a name that isn't in the index doesn't exist.  The index is
+ * serialized by lock_super(), like all the other directory operations.
+ */
+#define FAT_INDEX_MIN_SIZE	PAGE_SIZE
+#define FAT_INDEX_MIN_BITS	5
+#define FAT_INDEX_MAX_BITS	12
+
+/* Names of a record: shortname entry as is, and as displayed; longname */
+enum { FAT_NAME_RAW, FAT_NAME_SHORT, FAT_NAME_LONG, FAT_NAMES, };
+
+struct fat_dir_name {
+	struct hlist_node node;
+	u32 hash;
+	struct fat_dir_rec *rec;
+};
+
+struct fat_dir_rec {
+	struct hlist_node pos_node;	/* hashed by shortname entry position */
+	struct fat_dir_name name[FAT_NAMES];
+	unsigned int names;		/* bitmask of the valid name[] */
+	int nr_slots;			/* including the shortname entry */
+	loff_t slot_off;		/* position of the first slot */
+};
+
+struct fat_dir_index {
+	unsigned int nr_recs;
+	unsigned int bits;
+	struct hlist_head *pos_hash;
+	struct hlist_head *name_hash;	/* sorted by slot_off */
+};
+
+static inline loff_t fat_rec_de_pos(struct fat_dir_rec *rec)
+{
+	return rec->slot_off + ((rec->nr_slots - 1) << MSDOS_DIR_BITS);
+}
+
+static inline struct hlist_head *fat_pos_head(struct fat_dir_index *idx,
+					      loff_t de_pos)
+{
+	return &idx->pos_hash[hash_32(de_pos >> MSDOS_DIR_BITS, idx->bits)];
+}
+
+static inline struct hlist_head *fat_name_head(struct fat_dir_index *idx,
+					       u32 hash)
+{
+	return &idx->name_hash[hash_32(hash, idx->bits)];
+}
+
+static u32 fat_name_hash(struct msdos_sb_info *sbi,
+			 const unsigned char *name, int len)
+{
+	unsigned long hash = init_name_hash();
+
+	/* Must agree with fat_name_match() */
+	if (sbi->options.name_check != 's') {
+		while (len--)
+			hash = partial_name_hash(nls_tolower(sbi->nls_io,
+							     *name++), hash);
+	} else {
+		while (len--)
+			hash = partial_name_hash(*name++, hash);
+	}
+	return end_name_hash(hash);
+}
+
+static struct fat_dir_index *fat_index_alloc(unsigned int bits)
+{
+	struct fat_dir_index *idx;
+	int i;
+
+	idx = kmalloc(sizeof(*idx), GFP_NOFS);
+	if (!idx)
+		return NULL;
+	idx->pos_hash = kmalloc((2 << bits) * sizeof(struct hlist_head),
+				GFP_NOFS);
+	if (!idx->pos_hash) {
+		kfree(idx);
+		return NULL;
+	}
+	for (i = 0; i < (2 << bits); i++)
+		INIT_HLIST_HEAD(&idx->pos_hash[i]);
+	idx->name_hash = idx->pos_hash + (1 << bits);
+	idx->bits = bits;
+	idx->nr_recs = 0;
+	return idx;
+}
+
+static void fat_index_free(struct fat_dir_index *idx)
+{
+	struct fat_dir_rec *rec;
+	struct hlist_node *node, *tmp;
+	int i;
+
+	for (i = 0; i < (1 << idx->bits); i++) {
+		hlist_for_each_entry_safe(rec, node, tmp, &idx->pos_hash[i],
+					  pos_node)
+			kfree(rec);
+	}
+	kfree(idx->pos_hash);
+	kfree(idx);
+}
+
+void fat_dir_index_drop(struct inode *dir)
+{
+	struct msdos_inode_info *i = MSDOS_I(dir);
+
+	if (i->i_dir_index) {
+		fat_index_free(i->i_dir_index);
+		i->i_dir_index = NULL;
+	}
+}
+
+static void fat_index_hash(struct fat_dir_index *idx, struct fat_dir_rec *rec)
+{
+	struct fat_dir_name *dn;
+	struct hlist_node *node, *last;
+	struct hlist_head *head;
+	int n;
+
+	hlist_add_head(&rec->pos_node, fat_pos_head(idx, fat_rec_de_pos(rec)));
+
+	for (n = 0; n < FAT_NAMES; n++) {
+		if (!(rec->names & (1 << n)))
 			continue;
+		/* Keep the directory order, the first match wins */
+		head = fat_name_head(idx, rec->name[n].hash);
+		last = NULL;
+		hlist_for_each_entry(dn, node, head, node) {
+			if (dn->rec->slot_off > rec->slot_off)
+				break;
+			last = node;
+		}
+		if (last)
+			hlist_add_after(last, &rec->name[n].node);
+		else
+			hlist_add_head(&rec->name[n].node, head);
+	}
+}
 
-		/* Compare shortname */
-		bufuname[last_u] = 0x0000;
-		len = fat_uni_to_x8(sbi, bufuname, bufname, sizeof(bufname));
-		if (fat_name_match(sbi, name, name_len, bufname, len))
-			goto found;
+static void fat_index_unhash(struct fat_dir_rec *rec)
+{
+	int n;
 
+	hlist_del(&rec->pos_node);
+	for (n = 0; n < FAT_NAMES; n++) {
+		if (rec->names & (1 << n))
+			hlist_del(&rec->name[n].node);
+	}
+}
+
+static void fat_index_grow(struct fat_dir_index *idx)
+{
+	struct fat_dir_index *new;
+	struct fat_dir_rec *rec;
+	struct hlist_node *node, *tmp;
+	int i;
+
+	new = fat_index_alloc(idx->bits + 1);
+	if (!new)
+		return;		/* try again later */
+	for (i = 0; i < (1 << idx->bits); i++) {
+		hlist_for_each_entry_safe(rec, node, tmp, &idx->pos_hash[i],
+					  pos_node)
+			fat_index_hash(new, rec);
+	}
+	kfree(idx->pos_hash);
+	idx->pos_hash = new->pos_hash;
+	idx->name_hash = new->name_hash;
+	idx->bits = new->bits;
+	kfree(new);
+}
+
+static int fat_index_insert(struct fat_dir_index *idx,
+			    struct msdos_sb_info *sbi, loff_t slot_off,
+			    struct msdos_dir_entry *de, wchar_t *unicode,
+			    unsigned char nr_slots)
+{
+	unsigned char bufname[FAT_MAX_SHORT_SIZE];
+	unsigned char *longname;
+	int short_len, long_len, n;
+	struct fat_dir_rec *rec;
+
+	rec = kmalloc(sizeof(*rec), GFP_NOFS);
+	if (!rec)
+		return -ENOMEM;
+	rec->slot_off = slot_off;
+	rec->nr_slots = nr_slots + 1;
+	rec->names = 1 << FAT_NAME_RAW;
+	rec->name[FAT_NAME_RAW].hash = full_name_hash(de->name, MSDOS_NAME);
+
+	/* Only vfat looks up by the displayed names */
+	if (sbi->options.isvfat &&
+	    fat_record_names(sbi, de, unicode, nr_slots, bufname, &short_len,
+			     &longname, &long_len)) {
+		rec->names |= 1 << FAT_NAME_SHORT;
+		rec->name[FAT_NAME_SHORT].hash =
+			fat_name_hash(sbi, bufname, short_len);
 		if (nr_slots) {
-			void *longname = unicode + FAT_MAX_UNI_CHARS;
-			int size = PATH_MAX - FAT_MAX_UNI_SIZE;
+			rec->names |= 1 << FAT_NAME_LONG;
+			rec->name[FAT_NAME_LONG].hash =
+				fat_name_hash(sbi, longname, long_len);
+		}
+	}
+	for (n = 0; n < FAT_NAMES; n++)
+		rec->name[n].rec = rec;
 
-			/* Compare longname */
-			len = fat_uni_to_x8(sbi, unicode, longname, size);
-			if (fat_name_match(sbi, name, name_len, longname, len))
-				goto found;
+	fat_index_hash(idx, rec);
+	idx->nr_recs++;
+	if (idx->nr_recs > (2U << idx->bits) && idx->bits < FAT_INDEX_MAX_BITS)
+		fat_index_grow(idx);
+	return 0;
+}
+
+static struct fat_dir_index *fat_index_build(struct inode *dir)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(dir->i_sb);
+	struct fat_dir_index *idx;
+	struct buffer_head *bh = NULL;
+	struct msdos_dir_entry *de;
+	wchar_t *unicode = NULL;
+	unsigned char nr_slots;
+	loff_t cpos = 0;
+	int err;
+
+	idx = fat_index_alloc(FAT_INDEX_MIN_BITS);
+	if (!idx)
+		return NULL;
+
+	while (!(err = fat_get_record(dir, &cpos, &bh, &de, &unicode,
+				      &nr_slots))) {
+		err = fat_index_insert(idx, sbi,
+				       cpos - ((nr_slots + 1) << MSDOS_DIR_BITS),
+				       de, unicode, nr_slots);
+		if (err)
+			break;
+	}
+	brelse(bh);
+	if (unicode)
+		__putname(unicode);
+
+	if (err != -ENOENT) {
+		fat_index_free(idx);
+		return NULL;
+	}
+	return idx;
+}
+
+static struct fat_dir_index *fat_get_index(struct inode *dir)
+{
+	struct msdos_inode_info *i = MSDOS_I(dir);
+
+	if (!i->i_dir_index && dir->i_size >= FAT_INDEX_MIN_SIZE)
+		i->i_dir_index = fat_index_build(dir);
+	return i->i_dir_index;
+}
+
+/* Index the record just written by fat_add_entries() */
+static void fat_index_add(struct inode *dir, struct fat_slot_info *sinfo)
+{
+	struct fat_dir_index *idx = MSDOS_I(dir)->i_dir_index;
+	struct buffer_head *bh = NULL;
+	struct msdos_dir_entry *de;
+	wchar_t *unicode = NULL;
+	unsigned char nr_slots;
+	loff_t cpos = sinfo->slot_off;
+	int err;
+
+	if (!idx)
+		return;
+
+	err = fat_get_record(dir, &cpos, &bh, &de, &unicode, &nr_slots);
+	if (!err) {
+		if (cpos - ((nr_slots + 1) << MSDOS_DIR_BITS) != sinfo->slot_off)
+			err = -EIO;
+		else
+			err = fat_index_insert(idx, MSDOS_SB(dir->i_sb),
+					       sinfo->slot_off, de, unicode,
+					       nr_slots);
+	}
+	brelse(bh);
+	if (unicode)
+		__putname(unicode);
+
+	/* An incomplete index would hide names, rebuild it later */
+	if (err)
+		fat_dir_index_drop(dir);
+}
+
+/* Forget the record that fat_remove_entries() is removing */
+static void fat_index_remove(struct inode *dir, struct fat_slot_info *sinfo)
+{
+	struct fat_dir_index *idx = MSDOS_I(dir)->i_dir_index;
+	loff_t de_pos = sinfo->slot_off + ((sinfo->nr_slots - 1) << MSDOS_DIR_BITS);
+	struct fat_dir_rec *rec;
+	struct hlist_node *node;
+
+	if (!idx)
+		return;
+
+	hlist_for_each_entry(rec, node, fat_pos_head(idx, de_pos), pos_node) {
+		if (fat_rec_de_pos(rec) == de_pos) {
+			fat_index_unhash(rec);
+			kfree(rec);
+			idx->nr_recs--;
+			return;
+		}
+	}
+	fat_dir_index_drop(dir);
+}
+
+/* fat_search_long() with the index, fills sinfo like it */
+static int fat_index_search_long(struct inode *dir, struct fat_dir_index *idx,
+				 const unsigned char *name, int name_len,
+				 struct fat_slot_info *sinfo)
+{
+	struct super_block *sb = dir->i_sb;
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	u32 hash = fat_name_hash(sbi, name, name_len);
+	struct fat_dir_rec *rec, *last = NULL;
+	struct fat_dir_name *dn;
+	struct hlist_node *node;
+	struct buffer_head *bh;
+	struct msdos_dir_entry *de;
+	wchar_t *unicode = NULL;
+	unsigned char nr_slots;
+	loff_t cpos;
+	int err = -ENOENT;
+
+	hlist_for_each_entry(dn, node, fat_name_head(idx, hash), node) {
+		rec = dn->rec;
+		if (dn->hash != hash || dn == &rec->name[FAT_NAME_RAW] ||
+		    rec == last)
+			continue;
+		last = rec;
+
+		bh = NULL;
+		cpos = rec->slot_off;
+		err = fat_get_record(dir, &cpos, &bh, &de, &unicode, &nr_slots);
+		if (err == -ENOENT)
+			continue;
+		else if (err)
+			break;
+		if (cpos - ((nr_slots + 1) << MSDOS_DIR_BITS) == rec->slot_off &&
+		    fat_record_match(sbi, de, unicode, nr_slots,
+				     name, name_len)) {
+			nr_slots++;	/* include the de */
+			sinfo->slot_off = rec->slot_off;
+			sinfo->nr_slots = nr_slots;
+			sinfo->de = de;
+			sinfo->bh = bh;
+			sinfo->i_pos = fat_make_i_pos(sb, sinfo->bh, sinfo->de);
+			err = 0;
+			break;
+		}
+		brelse(bh);
+		err = -ENOENT;
+	}
+	if (unicode)
+		__putname(unicode);
+
+	return err;
+}
+
+/* fat_scan() with the index */
+static int fat_index_scan(struct inode *dir, struct fat_dir_index *idx,
+			  const unsigned char *name,
+			  struct fat_slot_info *sinfo)
+{
+	u32 hash = full_name_hash(name, MSDOS_NAME);
+	struct fat_dir_name *dn;
+	struct hlist_node *node;
+	loff_t de_pos;
+
+	hlist_for_each_entry(dn, node, fat_name_head(idx, hash), node) {
+		if (dn->hash != hash || dn != &dn->rec->name[FAT_NAME_RAW])
+			continue;
+
+		de_pos = fat_rec_de_pos(dn->rec);
+		sinfo->slot_off = de_pos;
+		sinfo->bh = NULL;
+		if (fat_get_entry(dir, &sinfo->slot_off, &sinfo->bh,
+				  &sinfo->de) < 0)
+			continue;
+		if (sinfo->slot_off == de_pos + sizeof(*sinfo->de) &&
+		    !IS_FREE(sinfo->de->name) &&
+		    !(sinfo->de->attr & ATTR_VOLUME) &&
+		    !strncmp(sinfo->de->name, name, MSDOS_NAME)) {
+			sinfo->slot_off = de_pos;
+			sinfo->nr_slots = 1;
+			sinfo->i_pos = fat_make_i_pos(dir->i_sb, sinfo->bh,
+						      sinfo->de);
+			return 0;
 		}
+		brelse(sinfo->bh);
+	}
+	sinfo->bh = NULL;
+	return -ENOENT;
+}
+
+/*
+ * Return values: negative -> error, 0 -> not found, positive -> found,
+ * value is the total amount of slots, including the shortname entry.
+ */
+int fat_search_long(struct inode *inode, const unsigned char *name,
+		    int name_len, struct fat_slot_info *sinfo)
+{
+	struct super_block *sb = inode->i_sb;
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct fat_dir_index *idx;
+	struct buffer_head *bh = NULL;
+	struct msdos_dir_entry *de;
+	unsigned char nr_slots;
+	wchar_t *unicode = NULL;
+	loff_t cpos = 0;
+	int err;
+
+	idx = fat_get_index(inode);
+	if (idx)
+		return fat_index_search_long(inode, idx, name, name_len, sinfo);
+
+	while (!(err = fat_get_record(inode, &cpos, &bh, &de, &unicode,
+				      &nr_slots))) {
+		if (fat_record_match(sbi, de, unicode, nr_slots,
+				     name, name_len))
+			goto found;
 	}
+	goto end_of_dir;
 
 found:
 	nr_slots++;	/* include the de */
@@ -934,6 +1395,11 @@ int fat_scan(struct inode *dir, const unsigned char *name,
 	     struct fat_slot_info *sinfo)
 {
 	struct super_block *sb = dir->i_sb;
+	struct fat_dir_index *idx;
+
+	idx = fat_get_index(dir);
+	if (idx)
+		return fat_index_scan(dir, idx, name, sinfo);
 
 	sinfo->slot_off = 0;
 	sinfo->bh = NULL;
@@ -992,6 +1458,8 @@ int fat_remove_entries(struct inode *dir, struct fat_slot_info *sinfo)
 	struct buffer_head *bh;
 	int err = 0, nr_slots;
 
+	fat_index_remove(dir, sinfo);
+
 	/*
 	 * First stage: Remove the shortname. By this, the directory
 	 * entry is removed.
@@ -1350,6 +1818,7 @@ found:
 	sinfo->de = de;
 	sinfo->bh = bh;
 	sinfo->i_pos = fat_make_i_pos(sb, sinfo->bh, sinfo->de);
+	fat_index_add(dir, sinfo);
 
 	return 0;
 
@@ -7,6 +7,7 @@
 #include <linux/fs.h>
 #include <linux/msdos_fs.h>
 #include <linux/blkdev.h>
+#include <linux/vmalloc.h>
 #include "fat.h"
 
 struct fatent_operations {
@@ -306,6 +307,14 @@ void fat_ent_access_init(struct super_block *sb)
 		sbi->fatent_ops = &fat12_ops;
 		break;
 	}
+
+	/*
+	 * The bitmap of free clusters gets filled in by the first full
+	 * scan of the FAT.  Without it, allocation scans the FAT itself.
+	 */
+	sbi->free_bitmap = vzalloc(BITS_TO_LONGS(sbi->max_cluster) *
+				   sizeof(unsigned long));
+	sbi->free_bitmap_valid = 0;
 }
 
 static inline int fat_ent_update_ptr(struct super_block *sb,
@@ -452,6 +461,42 @@ static void fat_collect_bhs(struct buffer_head **bhs, int *nr_bhs,
 	}
 }
 
+static int fat_scan_free_clusters(struct super_block *sb);
+
+/* Next free cluster from entry on, wrapping around, or -1 */
+static int fat_next_free(struct msdos_sb_info *sbi, int entry)
+{
+	unsigned long next;
+
+	if (entry >= sbi->max_cluster)
+		entry = FAT_START_ENT;
+	next = find_next_bit(sbi->free_bitmap, sbi->max_cluster, entry);
+	if (next >= sbi->max_cluster)
+		next = find_next_bit(sbi->free_bitmap, sbi->max_cluster,
+				     FAT_START_ENT);
+	return next < sbi->max_cluster ? next : -1;
+}
+
+/* Make the free entry at fatent the new end of the chain at prev_ent */
+static void fat_alloc_link(struct super_block *sb, struct fat_entry *fatent,
+			   struct fat_entry *prev_ent,
+			   struct buffer_head **bhs, int *nr_bhs)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct fatent_operations *ops = sbi->fatent_ops;
+
+	ops->ent_put(fatent, FAT_ENT_EOF);
+	if (prev_ent->nr_bhs)
+		ops->ent_put(prev_ent, fatent->entry);
+
+	fat_collect_bhs(bhs, nr_bhs, fatent);
+
+	sbi->prev_free = fatent->entry;
+	if (sbi->free_clusters != -1)
+		sbi->free_clusters--;
+	sb->s_dirt = 1;
+}
+
 int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 {
 	struct super_block *sb = inode->i_sb;
@@ -470,10 +515,50 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 		return -ENOSPC;
 	}
 
+	if (sbi->free_bitmap && !sbi->free_bitmap_valid) {
+		err = fat_scan_free_clusters(sb);
+		if (err) {
+			unlock_fat(sbi);
+			return err;
+		}
+		if (sbi->free_clusters < nr_cluster) {
+			unlock_fat(sbi);
+			return -ENOSPC;
+		}
+	}
+
 	err = nr_bhs = idx_clus = 0;
-	count = FAT_START_ENT;
 	fatent_init(&prev_ent);
 	fatent_init(&fatent);
+
+	if (sbi->free_bitmap_valid) {
+		int entry = sbi->prev_free + 1;
+
+		while ((entry = fat_next_free(sbi, entry)) >= 0) {
+			err = fat_ent_read(inode, &fatent, entry);
+			if (err < 0)
+				goto out;
+			__clear_bit(entry, sbi->free_bitmap);
+			if (err != FAT_ENT_FREE) {
+				/* stale bit, the entry is in use */
+				err = 0;
+				continue;
+			}
+
+			fat_alloc_link(sb, &fatent, &prev_ent, bhs, &nr_bhs);
+			cluster[idx_clus] = entry;
+			idx_clus++;
+			if (idx_clus == nr_cluster)
+				goto out;
+
+			/* fat_collect_bhs() holds the bhs of prev_ent */
+			prev_ent = fatent;
+			entry++;
+		}
+		goto out_nospc;
+	}
+
+	count = FAT_START_ENT;
 	fatent_set_entry(&fatent, sbi->prev_free + 1);
 	while (count < sbi->max_cluster) {
 		if (fatent.entry >= sbi->max_cluster)
@@ -489,16 +574,8 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 				int entry = fatent.entry;
 
 				/* make the cluster chain */
-				ops->ent_put(&fatent, FAT_ENT_EOF);
-				if (prev_ent.nr_bhs)
-					ops->ent_put(&prev_ent, entry);
-
-				fat_collect_bhs(bhs, &nr_bhs, &fatent);
-
-				sbi->prev_free = entry;
-				if (sbi->free_clusters != -1)
-					sbi->free_clusters--;
-				sb->s_dirt = 1;
+				fat_alloc_link(sb, &fatent, &prev_ent,
+					       bhs, &nr_bhs);
 
 				cluster[idx_clus] = entry;
 				idx_clus++;
@@ -517,6 +594,7 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 		} while (fat_ent_next(sbi, &fatent));
 	}
 
+out_nospc:
 	/* Couldn't allocate the free entries */
 	sbi->free_clusters = 0;
 	sbi->free_clus_valid = 1;
@@ -585,6 +663,8 @@ int fat_free_clusters(struct inode *inode, int cluster)
 		}
 
 		ops->ent_put(&fatent, FAT_ENT_FREE);
+		if (sbi->free_bitmap_valid)
+			__set_bit(fatent.entry, sbi->free_bitmap);
 		if (sbi->free_clusters != -1) {
 			sbi->free_clusters++;
 			sb->s_dirt = 1;
@@ -639,17 +719,22 @@ static void fat_ent_reada(struct super_block *sb, struct fat_entry *fatent,
 		sb_breadahead(sb, blocknr + i);
 }
 
-int fat_count_free_clusters(struct super_block *sb)
+/*
+ * Count the free clusters by reading the whole FAT, and fill in the free
+ * cluster bitmap while at it.  Called with fat_lock held.
+ */
+static int fat_scan_free_clusters(struct super_block *sb)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 	struct fatent_operations *ops = sbi->fatent_ops;
 	struct fat_entry fatent;
 	unsigned long reada_blocks, reada_mask, cur_block;
+	unsigned long *bitmap = sbi->free_bitmap;
 	int err = 0, free;
 
-	lock_fat(sbi);
-	if (sbi->free_clusters != -1 && sbi->free_clus_valid)
-		goto out;
+	if (bitmap)
+		memset(bitmap, 0, BITS_TO_LONGS(sbi->max_cluster) *
+		       sizeof(unsigned long));
 
 	reada_blocks = FAT_READA_SIZE >> sb->s_blocksize_bits;
 	reada_mask = reada_blocks - 1;
@@ -668,18 +753,32 @@ int fat_count_free_clusters(struct super_block *sb)
 
 		err = fat_ent_read_block(sb, &fatent);
 		if (err)
-			goto out;
+			return err;
 
 		do {
-			if (ops->ent_get(&fatent) == FAT_ENT_FREE)
+			if (ops->ent_get(&fatent) == FAT_ENT_FREE) {
 				free++;
+				if (bitmap)
+					__set_bit(fatent.entry, bitmap);
+			}
 		} while (fat_ent_next(sbi, &fatent));
 	}
 	sbi->free_clusters = free;
 	sbi->free_clus_valid = 1;
+	sbi->free_bitmap_valid = bitmap != NULL;
 	sb->s_dirt = 1;
 	fatent_brelse(&fatent);
-out:
+	return 0;
+}
+
+int fat_count_free_clusters(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	int err = 0;
+
+	lock_fat(sbi);
+	if (sbi->free_clusters == -1 || !sbi->free_clus_valid)
+		err = fat_scan_free_clusters(sb);
 	unlock_fat(sbi);
 	return err;
 }
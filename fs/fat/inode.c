@@ -26,6 +26,7 @@
 #include <linux/writeback.h>
 #include <linux/log2.h>
 #include <linux/hash.h>
+#include <linux/vmalloc.h>
 #include <asm/unaligned.h>
 #include "fat.h"
 
@@ -457,6 +458,7 @@ static void fat_evict_inode(struct inode *inode)
 	invalidate_inode_buffers(inode);
 	end_writeback(inode);
 	fat_cache_inval_inode(inode);
+	fat_dir_index_drop(inode);
 	fat_detach(inode);
 }
 
@@ -492,6 +494,7 @@ static void fat_put_super(struct super_block *sb)
 		fat_write_super(sb);
 
 	iput(sbi->fat_inode);
+	vfree(sbi->free_bitmap);
 
 	unload_nls(sbi->nls_disk);
 	unload_nls(sbi->nls_io);
@@ -530,10 +533,12 @@ static void init_once(void *foo)
 {
 	struct msdos_inode_info *ei = (struct msdos_inode_info *)foo;
 
-	spin_lock_init(&ei->cache_lru_lock);
+	spin_lock_init(&ei->cache_lock);
+	ei->cache_tree = RB_ROOT;
 	ei->nr_caches = 0;
+	INIT_LIST_HEAD(&ei->cache_inodes);
 	ei->cache_valid_id = FAT_CACHE_VALID + 1;
-	INIT_LIST_HEAD(&ei->cache_lru);
+	ei->i_dir_index = NULL;
 	INIT_HLIST_NODE(&ei->i_fat_hash);
 	inode_init_once(&ei->vfs_inode);
 }
@@ -1528,6 +1533,7 @@ out_fail:
 		iput(fat_inode);
 	if (root_inode)
 		iput(root_inode);
+	vfree(sbi->free_bitmap);
 	unload_nls(sbi->nls_io);
 	unload_nls(sbi->nls_disk);
 	if (sbi->options.iocharset != fat_default_iocharset)
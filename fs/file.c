@@ -301,6 +301,7 @@ struct files_struct *dup_fd(struct files_struct *oldf, int *errorp)
 		goto out;
 
 	atomic_set(&newf->count, 1);
+	INIT_LIST_HEAD(&newf->fborrowers);
 
 	spin_lock_init(&newf->file_lock);
 	newf->next_fd = 0;
@@ -423,6 +424,7 @@ struct files_struct init_files = {
 		.open_fds	= (fd_set *)&init_files.open_fds_init,
 	},
 	.file_lock	= __SPIN_LOCK_UNLOCKED(init_task.file_lock),
+	.fborrowers	= LIST_HEAD_INIT(init_files.fborrowers),
 };
 
 /*
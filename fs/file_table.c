@@ -290,7 +290,102 @@ struct file *fget(unsigned int fd)
 EXPORT_SYMBOL(fget);
 
 /*
- * Lightweight file lookup - no refcnt increment if fd table isn't shared.
+ * Borrowed files.
+ *
+ * Threads sharing a file table would all bounce the f_count of a shared
+ * file between their CPUs if fget_light() took a reference.  Instead a task
+ * borrows the file: it publishes it in current->fborrow and checks that the
+ * file is still in the table.  Closing a file removes it from the table
+ * before filp_close(), which gives a reference to each task that has it
+ * borrowed before the table's reference is dropped.  The task then drops
+ * that reference in fput_light().  The tasks that may borrow from a table
+ * are on its fborrowers list, a task joins it the first time it borrows.
+ *
+ * A task borrows one file at a time, nested lookups take a reference.
+ */
+#define FBORROW_LENT	1UL
+
+static inline struct file *fborrow_lent(struct file *file)
+{
+	return (struct file *)((unsigned long)file | FBORROW_LENT);
+}
+
+static int fget_borrow(struct files_struct *files, unsigned int fd,
+		       struct file *file)
+{
+	struct task_struct *tsk = current;
+
+	if (tsk->fborrow)
+		return 0;
+
+	if (unlikely(tsk->fborrow_files != files)) {
+		if (WARN_ON_ONCE(tsk->fborrow_files))
+			return 0;
+		spin_lock(&files->file_lock);
+		list_add(&tsk->fborrow_node, &files->fborrowers);
+		spin_unlock(&files->file_lock);
+		tsk->fborrow_files = files;
+	}
+
+	tsk->fborrow = file;
+	/* pairs with the barrier in files_lend_borrowed() */
+	smp_mb();
+	if (likely(fcheck_files(files, fd) == file))
+		return FPUT_BORROWED;
+
+	/* closed meanwhile: keep the reference if we were lent one */
+	if (xchg(&tsk->fborrow, NULL) == fborrow_lent(file))
+		return FPUT_REF;
+	return 0;
+}
+
+/**
+ * files_lend_borrowed - give a reference to the borrowers of a file
+ * @files: file table the file was removed from
+ * @file: the file
+ *
+ * Called by filp_close() before it drops the reference of @files on @file.
+ */
+void files_lend_borrowed(struct files_struct *files, struct file *file)
+{
+	struct task_struct *tsk;
+
+	/* pairs with the barrier in fget_borrow() */
+	smp_mb();
+	if (list_empty(&files->fborrowers))
+		return;
+
+	spin_lock(&files->file_lock);
+	list_for_each_entry(tsk, &files->fborrowers, fborrow_node) {
+		if (ACCESS_ONCE(tsk->fborrow) != file)
+			continue;
+		get_file(file);
+		/* not lent if it is done with the file already */
+		if (cmpxchg(&tsk->fborrow, file, fborrow_lent(file)) != file)
+			atomic_long_dec(&file->f_count);
+	}
+	spin_unlock(&files->file_lock);
+}
+
+/*
+ * Called before @tsk stops using its file table, when it cannot have a
+ * file borrowed.
+ */
+void files_forget_borrower(struct task_struct *tsk)
+{
+	struct files_struct *files = tsk->fborrow_files;
+
+	if (files) {
+		spin_lock(&files->file_lock);
+		list_del(&tsk->fborrow_node);
+		spin_unlock(&files->file_lock);
+		tsk->fborrow_files = NULL;
+	}
+}
+
+/*
+ * Lightweight file lookup - no refcnt increment if fd table isn't shared,
+ * or if the file can be borrowed (see above).
  *
  * You can use this instead of fget if you satisfy all of the following
  * conditions:
@@ -317,8 +412,11 @@ struct file *fget_light(unsigned int fd, int *fput_needed)
 		rcu_read_lock();
 		file = fcheck_files(files, fd);
 		if (file) {
-			if (atomic_long_inc_not_zero(&file->f_count))
-				*fput_needed = 1;
+			*fput_needed = fget_borrow(files, fd, file);
+			if (*fput_needed)
+				;	/* borrowed, or lent a reference */
+			else if (atomic_long_inc_not_zero(&file->f_count))
+				*fput_needed = FPUT_REF;
 			else
 				/* Didn't get the reference, someone's freed */
 				file = NULL;
@@ -329,6 +427,16 @@ struct file *fget_light(unsigned int fd, int *fput_needed)
 	return file;
 }
 
+void __fput_light(struct file *file, int fput_needed)
+{
+	/* a borrowed file only needs a put if a reference was lent */
+	if (fput_needed == FPUT_BORROWED &&
+	    xchg(&current->fborrow, NULL) != fborrow_lent(file))
+		return;
+	fput(file);
+}
+EXPORT_SYMBOL(__fput_light);
+
 void put_filp(struct file *file)
 {
 	if (atomic_long_dec_and_test(&file->f_count)) {
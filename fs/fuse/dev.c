@@ -25,15 +25,123 @@ MODULE_ALIAS("devname:fuse");
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_chan *fuse_get_chan(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount or clone and is valid until the file is
+	 * released.
 	 */
 	return file->private_data;
 }
 
+static struct fuse_conn *fuse_get_conn(struct file *file)
+{
+	struct fuse_chan *ch = fuse_get_chan(file);
+
+	return ch ? ch->fc : NULL;
+}
+
+void fuse_chan_init(struct fuse_chan *ch, struct fuse_conn *fc)
+{
+	memset(ch, 0, sizeof(*ch));
+	ch->fc = fc;
+	spin_lock_init(&ch->lock);
+	init_waitqueue_head(&ch->waitq);
+	INIT_LIST_HEAD(&ch->pending);
+	INIT_LIST_HEAD(&ch->io);
+	INIT_LIST_HEAD(&ch->entry);
+	ch->cpu = -1;
+}
+EXPORT_SYMBOL_GPL(fuse_chan_init);
+
+/*
+ * A channel is idle if a reader sleeps in request_wait() or a poller
+ * found nothing to read on it.  Checked without the channel lock.
+ */
+static bool chan_idle(struct fuse_chan *ch)
+{
+	return ACCESS_ONCE(ch->nr_idle) || ACCESS_ONCE(ch->polling);
+}
+
+/*
+ * Pick the channel to queue new work on: one with an idle reader on
+ * this CPU, else one with an idle reader anywhere, else one this
+ * CPU's readers use, else each channel in turn.  An idle reader only
+ * counts if nothing is queued for it yet.
+ *
+ * Called with fc->lock held
+ */
+static struct fuse_chan *fuse_pick_chan(struct fuse_conn *fc)
+{
+	struct fuse_chan *ch, *idle = NULL, *local = NULL;
+	int cpu = smp_processor_id();
+
+	if (list_empty(&fc->chans))
+		return &fc->chan;
+	if (list_is_singular(&fc->chans))
+		return list_first_entry(&fc->chans, struct fuse_chan, entry);
+
+	list_for_each_entry(ch, &fc->chans, entry) {
+		bool spare = chan_idle(ch) && list_empty(&ch->pending);
+
+		if (ch->cpu == cpu) {
+			if (spare)
+				return ch;
+			if (!local)
+				local = ch;
+		} else if (spare && !idle) {
+			idle = ch;
+		}
+	}
+	if (idle)
+		return idle;
+	if (local)
+		return local;
+
+	list_rotate_left(&fc->chans);
+	return list_first_entry(&fc->chans, struct fuse_chan, entry);
+}
+
+/*
+ * Wake a reader of @ch for new work.  If nobody is waiting on @ch,
+ * also wake an idle reader of another channel: readers take work
+ * from other channels when their own has none.
+ *
+ * Called with fc->lock held
+ */
+static void fuse_wake_chan(struct fuse_chan *ch)
+{
+	struct fuse_chan *other;
+
+	wake_up(&ch->waitq);
+	kill_fasync(&ch->fasync, SIGIO, POLL_IN);
+
+	/* Pairs with the barriers in request_wait() and fuse_dev_poll() */
+	smp_mb();
+	if (chan_idle(ch))
+		return;
+
+	list_for_each_entry(other, &ch->fc->chans, entry) {
+		if (other != ch && chan_idle(other)) {
+			wake_up(&other->waitq);
+			kill_fasync(&other->fasync, SIGIO, POLL_IN);
+			break;
+		}
+	}
+}
+
+/* Called with fc->lock held */
+void fuse_wake_chans(struct fuse_conn *fc)
+{
+	struct fuse_chan *ch;
+
+	list_for_each_entry(ch, &fc->chans, entry) {
+		wake_up_all(&ch->waitq);
+		kill_fasync(&ch->fasync, SIGIO, POLL_IN);
+	}
+}
+
 static void fuse_request_init(struct fuse_req *req)
 {
 	memset(req, 0, sizeof(*req));
@@ -239,16 +347,21 @@ static u64 fuse_get_unique(struct fuse_conn *fc)
 
 static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_chan *ch = fuse_pick_chan(fc);
+
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
+	req->chan = ch;
+	atomic_inc(&fc->num_pending);
+	spin_lock(&ch->lock);
+	list_add_tail(&req->list, &ch->pending);
 	req->state = FUSE_REQ_PENDING;
+	spin_unlock(&ch->lock);
 	if (!req->waiting) {
 		req->waiting = 1;
 		atomic_inc(&fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	fuse_wake_chan(ch);
 }
 
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
@@ -260,8 +373,7 @@ void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 	spin_lock(&fc->lock);
 	fc->forget_list_tail->next = forget;
 	fc->forget_list_tail = forget;
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	fuse_wake_chan(fuse_pick_chan(fc));
 	spin_unlock(&fc->lock);
 }
 
@@ -334,8 +446,7 @@ __acquires(fc->lock)
 static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
 {
 	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	fuse_wake_chan(fuse_pick_chan(fc));
 }
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
@@ -369,12 +480,24 @@ __acquires(fc->lock)
 		if (req->state == FUSE_REQ_FINISHED)
 			return;
 
-		/* Request is not yet in userspace, bail out */
+		/*
+		 * Request is not yet in userspace, bail out.  Readers
+		 * take requests off their channel under the channel lock
+		 * only, so check again under it.
+		 */
 		if (req->state == FUSE_REQ_PENDING) {
-			list_del(&req->list);
-			__fuse_put_request(req);
-			req->out.h.error = -EINTR;
-			return;
+			struct fuse_chan *ch = req->chan;
+
+			spin_lock(&ch->lock);
+			if (req->state == FUSE_REQ_PENDING) {
+				list_del(&req->list);
+				atomic_dec(&fc->num_pending);
+				spin_unlock(&ch->lock);
+				__fuse_put_request(req);
+				req->out.h.error = -EINTR;
+				return;
+			}
+			spin_unlock(&ch->lock);
 		}
 	}
 
@@ -909,31 +1032,79 @@ static int forget_pending(struct fuse_conn *fc)
 	return fc->forget_list_head.next != NULL;
 }
 
-static int request_pending(struct fuse_conn *fc)
+/*
+ * Find the channel to take the next request from: this one, or else
+ * any other with requests pending.
+ *
+ * Called with fc->lock held
+ */
+static struct fuse_chan *pending_chan(struct fuse_chan *ch)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	struct fuse_conn *fc = ch->fc;
+	struct fuse_chan *other;
+
+	if (!list_empty(&ch->pending))
+		return ch;
+
+	list_for_each_entry(other, &fc->chans, entry) {
+		if (!list_empty(&other->pending))
+			return other;
+	}
+	return NULL;
 }
 
-/* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+/*
+ * Is there anything for a reader of this channel to do?  Only the
+ * channel's own list is stable under ch->lock, the rest is a hint.
+ */
+static int request_pending(struct fuse_chan *ch)
+{
+	struct fuse_conn *fc = ch->fc;
+
+	return !list_empty(&ch->pending) || atomic_read(&fc->num_pending) ||
+		!list_empty(&fc->interrupts) || forget_pending(fc);
+}
+
+/* Wait until a request is available on the pending lists */
+static void request_wait(struct fuse_chan *ch)
+__releases(ch->lock)
+__acquires(ch->lock)
 {
+	struct fuse_conn *fc = ch->fc;
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(&ch->waitq, &wait);
+	ch->nr_idle++;
+	for (;;) {
+		ch->cpu = smp_processor_id();
+		/*
+		 * Work may be queued without ch->lock.  Publish nr_idle
+		 * before looking, fuse_wake_chan() does the reverse.
+		 */
 		set_current_state(TASK_INTERRUPTIBLE);
+		if (!fc->connected || request_pending(ch))
+			break;
 		if (signal_pending(current))
 			break;
 
-		spin_unlock(&fc->lock);
+		spin_unlock(&ch->lock);
 		schedule();
-		spin_lock(&fc->lock);
+		spin_lock(&ch->lock);
 	}
+	ch->nr_idle--;
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&ch->waitq, &wait);
+}
+
+/*
+ * Move a request taken off a pending list to the io list of the
+ * reader's channel @ch
+ */
+static void start_reading(struct fuse_chan *ch, struct fuse_req *req)
+{
+	atomic_dec(&ch->fc->num_pending);
+	req->state = FUSE_REQ_READING;
+	list_move(&req->list, &ch->io);
 }
 
 /*
@@ -1096,28 +1267,49 @@ __releases(fc->lock)
  * was an error during the copying then it's finished by calling
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
+ *
+ * Waiting, and taking a request queued on the reader's own channel,
+ * is done under the channel lock only.  Interrupts, forgets and
+ * requests of other channels are taken under fc->lock.
  */
 static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
+	struct fuse_chan *ch = fuse_get_chan(file);
+	struct fuse_chan *pch;
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
 
  restart:
-	spin_lock(&fc->lock);
+	spin_lock(&ch->lock);
+	ch->polling = 0;
 	err = -EAGAIN;
 	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
-		goto err_unlock;
+	    !request_pending(ch))
+		goto err_unlock_chan;
 
-	request_wait(fc);
+	request_wait(ch);
 	err = -ENODEV;
 	if (!fc->connected)
-		goto err_unlock;
+		goto err_unlock_chan;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(ch))
+		goto err_unlock_chan;
+
+	if (!list_empty(&ch->pending) && list_empty(&fc->interrupts) &&
+	    !forget_pending(fc)) {
+		req = list_entry(ch->pending.next, struct fuse_req, list);
+		start_reading(ch, req);
+		spin_unlock(&ch->lock);
+		goto copy;
+	}
+	spin_unlock(&ch->lock);
+
+	spin_lock(&fc->lock);
+	err = -ENODEV;
+	if (!fc->connected)
 		goto err_unlock;
 
 	if (!list_empty(&fc->interrupts)) {
@@ -1126,18 +1318,37 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		return fuse_read_interrupt(fc, cs, nbytes, req);
 	}
 
+	pch = pending_chan(ch);
 	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
+		if (!pch || fc->forget_batch-- > 0)
 			return fuse_read_forget(fc, cs, nbytes);
 
 		if (fc->forget_batch <= -8)
 			fc->forget_batch = 16;
 	}
+	if (!pch) {
+		spin_unlock(&fc->lock);
+		goto restart;
+	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
-	req->state = FUSE_REQ_READING;
-	list_move(&req->list, &fc->io);
+	spin_lock(&pch->lock);
+	req = NULL;
+	if (!list_empty(&pch->pending)) {
+		req = list_entry(pch->pending.next, struct fuse_req, list);
+		list_del_init(&req->list);
+	}
+	spin_unlock(&pch->lock);
+	if (!req) {
+		spin_unlock(&fc->lock);
+		goto restart;
+	}
+	spin_lock(&ch->lock);
+	req->chan = ch;
+	start_reading(ch, req);
+	spin_unlock(&ch->lock);
+	spin_unlock(&fc->lock);
 
+ copy:
 	in = &req->in;
 	reqsize = in->h.len;
 	/* If request is too large, reply with an error and restart the read */
@@ -1146,10 +1357,13 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		/* SETXATTR is special, since it may contain too large data */
 		if (in->h.opcode == FUSE_SETXATTR)
 			req->out.h.error = -E2BIG;
+		spin_lock(&fc->lock);
+		spin_lock(&ch->lock);
+		list_del_init(&req->list);
+		spin_unlock(&ch->lock);
 		request_end(fc, req);
 		goto restart;
 	}
-	spin_unlock(&fc->lock);
 	cs->req = req;
 	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
 	if (!err)
@@ -1162,6 +1376,12 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 		return -ENODEV;
 	}
+	spin_lock(&ch->lock);
+	if (err || !req->isreply)
+		list_del_init(&req->list);
+	else
+		list_move_tail(&req->list, &fc->processing);
+	spin_unlock(&ch->lock);
 	if (err) {
 		req->out.h.error = -EIO;
 		request_end(fc, req);
@@ -1171,7 +1391,6 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
 		if (req->interrupted)
 			queue_interrupt(fc, req);
 		spin_unlock(&fc->lock);
@@ -1181,6 +1400,10 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
  err_unlock:
 	spin_unlock(&fc->lock);
 	return err;
+
+ err_unlock_chan:
+	spin_unlock(&ch->lock);
+	return err;
 }
 
 static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
@@ -1260,6 +1483,8 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 		buf->offset = bufs[page_nr].offset;
 		buf->len = bufs[page_nr].len;
 		buf->ops = &fuse_dev_pipe_buf_ops;
+		/* Don't let stale GIFT or LRU flags reach a consumer */
+		buf->flags = 0;
 
 		pipe->nrbufs++;
 		page_nr++;
@@ -1827,24 +2052,33 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	struct fuse_conn *fc;
+	if (!ch)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	fc = ch->fc;
+	poll_wait(file, &ch->waitq, wait);
 
-	spin_lock(&fc->lock);
+	/*
+	 * Until it reads, count the poller as an idle reader so that
+	 * fuse_pick_chan() sends work here as to one in request_wait().
+	 */
+	spin_lock(&ch->lock);
+	ch->polling = 1;
+	ch->cpu = smp_processor_id();
+	smp_mb();
 	if (!fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(ch))
 		mask |= POLLIN | POLLRDNORM;
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 
 	return mask;
 }
 
 /*
- * Abort all requests on the given list (pending or processing)
+ * Abort all requests on the given list (processing)
  *
  * This function releases and reacquires fc->lock
  */
@@ -1876,9 +2110,24 @@ static void end_io_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
-	while (!list_empty(&fc->io)) {
+	struct fuse_chan *ch;
+	LIST_HEAD(io);
+
+	/*
+	 * Readers check fc->connected under the channel lock before
+	 * taking a request.  Once each channel lock has been taken here,
+	 * every request being read is on one of the lists gathered.
+	 */
+	list_for_each_entry(ch, &fc->chans, entry) {
+		spin_lock(&ch->lock);
+		list_splice_tail_init(&ch->io, &io);
+		spin_unlock(&ch->lock);
+	}
+	list_splice_tail_init(&fc->io, &io);
+
+	while (!list_empty(&io)) {
 		struct fuse_req *req =
-			list_entry(fc->io.next, struct fuse_req, list);
+			list_entry(io.next, struct fuse_req, list);
 		void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
 
 		req->aborted = 1;
@@ -1902,9 +2151,24 @@ static void end_queued_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	struct fuse_chan *ch;
+	LIST_HEAD(pending);
+
 	fc->max_background = UINT_MAX;
 	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
+	list_for_each_entry(ch, &fc->chans, entry) {
+		spin_lock(&ch->lock);
+		list_splice_tail_init(&ch->pending, &pending);
+		spin_unlock(&ch->lock);
+	}
+	while (!list_empty(&pending)) {
+		struct fuse_req *req;
+		req = list_entry(pending.next, struct fuse_req, list);
+		atomic_dec(&fc->num_pending);
+		req->out.h.error = -ECONNABORTED;
+		request_end(fc, req);
+		spin_lock(&fc->lock);
+	}
 	end_requests(fc, &fc->processing);
 	while (forget_pending(fc))
 		kfree(dequeue_forget(fc, 1, NULL));
@@ -1937,24 +2201,51 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		fc->blocked = 0;
 		end_io_requests(fc);
 		end_queued_requests(fc);
-		wake_up_all(&fc->waitq);
+		fuse_wake_chans(fc);
 		wake_up_all(&fc->blocked_waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 	}
 	spin_unlock(&fc->lock);
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+/*
+ * The connection goes away with its last channel.  Requests pending on
+ * any other channel are handed over to one that stays.
+ */
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (ch) {
+		struct fuse_conn *fc = ch->fc;
+
 		spin_lock(&fc->lock);
-		fc->connected = 0;
-		fc->blocked = 0;
-		end_queued_requests(fc);
-		wake_up_all(&fc->blocked_waitq);
+		if (--fc->num_chans == 0) {
+			fc->connected = 0;
+			fc->blocked = 0;
+			end_queued_requests(fc);
+			wake_up_all(&fc->blocked_waitq);
+			list_del_init(&ch->entry);
+		} else {
+			struct fuse_chan *to;
+			struct fuse_req *req;
+			LIST_HEAD(pending);
+
+			list_del_init(&ch->entry);
+			spin_lock(&ch->lock);
+			list_splice_init(&ch->pending, &pending);
+			spin_unlock(&ch->lock);
+
+			to = fuse_pick_chan(fc);
+			list_for_each_entry(req, &pending, list)
+				req->chan = to;
+			spin_lock(&to->lock);
+			list_splice_tail(&pending, &to->pending);
+			spin_unlock(&to->lock);
+			fuse_wake_chan(to);
+		}
 		spin_unlock(&fc->lock);
+		if (ch != &fc->chan)
+			kfree(ch);
 		fuse_conn_put(fc);
 	}
 
@@ -1964,12 +2255,88 @@ EXPORT_SYMBOL_GPL(fuse_dev_release);
 
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (!ch)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fc->fasync);
+	return fasync_helper(fd, file, on, &ch->fasync);
+}
+
+/*
+ * Make @file, a fuse device file that is not attached to a connection
+ * yet, a new channel of the connection of the file @oldfd refers to.
+ */
+static int fuse_dev_clone(struct file *file, int oldfd)
+{
+	struct fuse_conn *fc;
+	struct fuse_chan *ch;
+	struct file *old;
+	int err;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EBADF;
+
+	err = -EINVAL;
+	if (old->f_op != &fuse_dev_operations)
+		goto out_fput;
+
+	fc = fuse_get_conn(old);
+	if (!fc)
+		goto out_fput;
+
+	err = -ENOMEM;
+	ch = kmalloc(sizeof(*ch), GFP_KERNEL);
+	if (!ch)
+		goto out_fput;
+	fuse_chan_init(ch, fc);
+
+	/* fuse_mutex also guards file->private_data in fuse_fill_super() */
+	mutex_lock(&fuse_mutex);
+	err = -EINVAL;
+	if (file->private_data)
+		goto out_unlock;
+	spin_lock(&fc->lock);
+	err = -ENODEV;
+	if (!fc->connected) {
+		spin_unlock(&fc->lock);
+		goto out_unlock;
+	}
+	list_add_tail(&ch->entry, &fc->chans);
+	fc->num_chans++;
+	fuse_conn_get(fc);
+	spin_unlock(&fc->lock);
+	/* Readers use file->private_data without locking */
+	smp_wmb();
+	file->private_data = ch;
+	mutex_unlock(&fuse_mutex);
+	fput(old);
+
+	return 0;
+
+ out_unlock:
+	mutex_unlock(&fuse_mutex);
+	kfree(ch);
+ out_fput:
+	fput(old);
+	return err;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	u32 oldfd;
+
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE:
+		if (get_user(oldfd, (u32 __user *) arg))
+			return -EFAULT;
+		return fuse_dev_clone(file, oldfd);
+
+	default:
+		return -ENOTTY;
+	}
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -1984,6 +2351,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
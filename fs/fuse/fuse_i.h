@@ -209,9 +209,13 @@ enum fuse_req_state {
  */
 struct fuse_req {
 	/** This can be on either pending processing or io lists in
-	    fuse_conn */
+	    fuse_conn or fuse_chan */
 	struct list_head list;
 
+	/** The channel whose pending or io list the request is on.
+	    Changed only under fuse_conn->lock */
+	struct fuse_chan *chan;
+
 	/** Entry on the interrupts list  */
 	struct list_head intr_entry;
 
@@ -310,6 +314,50 @@ struct fuse_req {
 	struct file *stolen_file;
 };
 
+/**
+ * A channel of a Fuse connection: an open fuse device file.
+ *
+ * The file given at mount time is the connection's own channel, more
+ * can be cloned from it with FUSE_DEV_IOC_CLONE.  New requests are
+ * queued to a channel that has a reader waiting, preferably one on the
+ * requester's CPU.  Readers that run out of requests on their own
+ * channel take them from the others.
+ *
+ * Readers wait for and take requests off their own channel under its
+ * lock only.  Lock ordering is fuse_conn->lock, then fuse_chan->lock.
+ */
+struct fuse_chan {
+	/** The connection */
+	struct fuse_conn *fc;
+
+	/** Lock protecting the request lists and reader state below */
+	spinlock_t lock;
+
+	/** Readers of the channel are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** The list of requests being copied to userspace */
+	struct list_head io;
+
+	/** Number of readers in request_wait() */
+	unsigned nr_idle;
+
+	/** A poller found nothing to read and has not read since */
+	int polling;
+
+	/** The CPU readers last waited or polled on, or -1 */
+	int cpu;
+
+	/** Entry on fc->chans */
+	struct list_head entry;
+
+	/** O_ASYNC requests */
+	struct fasync_struct *fasync;
+};
+
 /**
  * A Fuse connection.
  *
@@ -342,16 +390,22 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
+	/** The channel of the device file given at mount */
+	struct fuse_chan chan;
 
-	/** The list of pending requests */
-	struct list_head pending;
+	/** List of open channels */
+	struct list_head chans;
+
+	/** Number of open channels */
+	unsigned num_chans;
+
+	/** Number of requests on the pending lists of all channels */
+	atomic_t num_pending;
 
 	/** The list of requests being processed */
 	struct list_head processing;
 
-	/** The list of requests under I/O */
+	/** The list of requests whose reply is being copied */
 	struct list_head io;
 
 	/** The next unique kernel file handle */
@@ -473,6 +527,9 @@ struct fuse_conn {
 	/** Don't apply umask to creation modes */
 	unsigned dont_mask:1;
 
+	/** Use writeback cache for buffered writes */
+	unsigned writeback_cache:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -494,9 +551,6 @@ struct fuse_conn {
 	/** number of dentries used in the above array */
 	int ctl_ndents;
 
-	/** O_ASYNC requests */
-	struct fasync_struct *fasync;
-
 	/** Key for lock owner ID scrambling */
 	u32 scramble_key[4];
 
@@ -735,6 +789,13 @@ int fuse_update_attributes(struct inode *inode, struct kstat *stat,
 
 void fuse_flush_writepages(struct inode *inode);
 
+void fuse_chan_init(struct fuse_chan *ch, struct fuse_conn *fc);
+
+/**
+ * Wake up all readers of the connection
+ */
+void fuse_wake_chans(struct fuse_conn *fc);
+
 void fuse_set_nowrite(struct inode *inode);
 void fuse_release_nowrite(struct inode *inode);
 
@@ -764,4 +825,7 @@ int fuse_dev_release(struct inode *inode, struct file *file);
 
 void fuse_write_update_size(struct inode *inode, loff_t pos);
 
+int fuse_flush_mtime(struct inode *inode, struct fuse_file *ff);
+int fuse_write_inode(struct inode *inode, struct writeback_control *wbc);
+
 #endif /* _FS_FUSE_I_H */
@@ -198,6 +198,9 @@ int inode_init_always(struct super_block *sb, struct inode *inode)
 	init_rwsem(&inode->i_alloc_sem);
 	lockdep_set_class(&inode->i_alloc_sem, &sb->s_type->i_alloc_sem_key);
 
+	init_rwsem(&inode->i_dir_sem);
+	lockdep_set_class(&inode->i_dir_sem, &sb->s_type->i_dir_sem_key);
+
 	mapping->a_ops = &empty_aops;
 	mapping->host = inode;
 	mapping->flags = 0;
@@ -205,6 +208,9 @@ int inode_init_always(struct super_block *sb, struct inode *inode)
 	mapping->assoc_mapping = NULL;
 	mapping->backing_dev_info = &default_backing_dev_info;
 	mapping->writeback_index = 0;
+#ifdef CONFIG_BLK_DEV_THROTTLING
+	mapping->dirtier_blkcg_id = 0;
+#endif
 
 	/*
 	 * If the block_device provides a backing_dev_info for client
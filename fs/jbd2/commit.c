@@ -300,6 +300,36 @@ static void write_tag_block(int tag_bytes, journal_block_tag_t *tag,
 		tag->t_blocknr_high = cpu_to_be32((block >> 31) >> 1);
 }
 
+/*
+ * End the commit phase which started at *@mark: store its length in
+ * microseconds in @us and start the next phase now.  The jiffies based
+ * run stats are too coarse for the histograms.
+ */
+static void jbd2_hist_mark(s64 *us, ktime_t *mark)
+{
+	ktime_t now = ktime_get();
+
+	*us = ktime_us_delta(now, *mark);
+	*mark = now;
+}
+
+/*
+ * Account the phase times of a commit, in microseconds, to the journal's
+ * latency histograms.  j_history_lock must be held.
+ */
+static void jbd2_update_hist(journal_t *journal, const s64 *us)
+{
+	unsigned int bucket;
+	int i;
+
+	for (i = 0; i < JBD2_HIST_NR; i++) {
+		bucket = us[i] > 0 ? fls64(us[i]) : 0;
+		if (bucket >= JBD2_HIST_BUCKETS)
+			bucket = JBD2_HIST_BUCKETS - 1;
+		journal->j_hist.count[i][bucket]++;
+	}
+}
+
 /*
  * jbd2_journal_commit_transaction
  *
@@ -317,6 +347,8 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	int err;
 	unsigned long long blocknr;
 	ktime_t start_time;
+	ktime_t hist_mark;
+	s64 hist_us[JBD2_HIST_NR];
 	u64 commit_time;
 	char *tagp = NULL;
 	journal_header_t *header;
@@ -372,6 +404,8 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	trace_jbd2_commit_locking(journal, commit_transaction);
 	stats.run.rs_wait = commit_transaction->t_max_wait;
 	stats.run.rs_locked = jiffies;
+	hist_mark = commit_transaction->t_start_time;
+	jbd2_hist_mark(&hist_us[JBD2_HIST_RUNNING], &hist_mark);
 	stats.run.rs_running = jbd2_time_diff(commit_transaction->t_start,
 					      stats.run.rs_locked);
 
@@ -449,6 +483,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	stats.run.rs_flushing = jiffies;
 	stats.run.rs_locked = jbd2_time_diff(stats.run.rs_locked,
 					     stats.run.rs_flushing);
+	jbd2_hist_mark(&hist_us[JBD2_HIST_LOCKED], &hist_mark);
 
 	commit_transaction->t_state = T_FLUSH;
 	journal->j_committing_transaction = commit_transaction;
@@ -486,6 +521,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	stats.run.rs_logging = jiffies;
 	stats.run.rs_flushing = jbd2_time_diff(stats.run.rs_flushing,
 					       stats.run.rs_logging);
+	jbd2_hist_mark(&hist_us[JBD2_HIST_FLUSHING], &hist_mark);
 	stats.run.rs_blocks =
 		atomic_read(&commit_transaction->t_outstanding_credits);
 	stats.run.rs_blocks_logged = 0;
@@ -967,6 +1003,8 @@ restart_loop:
 	commit_transaction->t_start = jiffies;
 	stats.run.rs_logging = jbd2_time_diff(stats.run.rs_logging,
 					      commit_transaction->t_start);
+	jbd2_hist_mark(&hist_us[JBD2_HIST_LOGGING], &hist_mark);
+	hist_us[JBD2_HIST_COMMIT] = ktime_us_delta(hist_mark, start_time);
 
 	/*
 	 * File the transaction statistics
@@ -1009,6 +1047,10 @@ restart_loop:
 		journal->j_average_commit_time = commit_time;
 	write_unlock(&journal->j_state_lock);
 
+	spin_lock(&journal->j_history_lock);
+	jbd2_update_hist(journal, hist_us);
+	spin_unlock(&journal->j_history_lock);
+
 	if (commit_transaction->t_checkpoint_list == NULL &&
 	    commit_transaction->t_checkpoint_io_list == NULL) {
 		__jbd2_journal_drop_transaction(journal, commit_transaction);
@@ -42,8 +42,10 @@
 #include <linux/log2.h>
 #include <linux/vmalloc.h>
 #include <linux/backing-dev.h>
+#include <linux/blkdev.h>
 #include <linux/bitops.h>
 #include <linux/ratelimit.h>
+#include <linux/random.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/jbd2.h>
@@ -617,6 +619,105 @@ out:
 }
 EXPORT_SYMBOL(jbd2_trans_will_send_data_barrier);
 
+/**
+ * int jbd2_fc_write() - write a fast commit block
+ * @journal: Journal to act on.
+ * @tid: Transaction the payload belongs to.
+ * @data: Payload.
+ * @len: Length of the payload.
+ *
+ * Write @data to the next free block of the fast commit area and make it,
+ * together with everything written to the filesystem before, stable.  If
+ * @tid never commits, recovery hands the payload back to the filesystem
+ * through j_fc_replay_callback.
+ *
+ * This only works for the running transaction, and only while nothing is
+ * being committed, so that everything before @tid is known to be on disk.
+ * -EAGAIN is returned otherwise, or when the area is full: the caller has
+ * to wait for @tid to commit instead.
+ */
+int jbd2_fc_write(journal_t *journal, tid_t tid, const void *data, int len)
+{
+	jbd2_fc_header_t *h;
+	struct buffer_head *bh;
+	unsigned long long blocknr;
+	int ret;
+
+	if (len > journal->j_blocksize - (int)sizeof(*h))
+		return -EINVAL;
+
+	mutex_lock(&journal->j_fc_mutex);
+	ret = -EAGAIN;
+	read_lock(&journal->j_state_lock);
+	if (!journal->j_fc_blocks || is_journal_aborted(journal) ||
+	    !journal->j_running_transaction ||
+	    journal->j_running_transaction->t_tid != tid ||
+	    journal->j_committing_transaction) {
+		read_unlock(&journal->j_state_lock);
+		goto out;
+	}
+	read_unlock(&journal->j_state_lock);
+
+	if (journal->j_fc_tid != tid) {
+		journal->j_fc_tid = tid;
+		journal->j_fc_off = 0;
+	}
+	if (journal->j_fc_off >= journal->j_fc_blocks)
+		goto out;
+	/* A new nonce keeps older blocks further down from looking valid */
+	if (!journal->j_fc_off)
+		get_random_bytes(&journal->j_fc_nonce,
+				 sizeof(journal->j_fc_nonce));
+
+	ret = jbd2_journal_bmap(journal,
+				journal->j_fc_first + journal->j_fc_off,
+				&blocknr);
+	if (ret)
+		goto out;
+	bh = __getblk(journal->j_dev, blocknr, journal->j_blocksize);
+	if (!bh) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	lock_buffer(bh);
+	memset(bh->b_data, 0, journal->j_blocksize);
+	h = (jbd2_fc_header_t *)bh->b_data;
+	h->fc_header.h_magic = cpu_to_be32(JBD2_MAGIC_NUMBER);
+	h->fc_header.h_blocktype = cpu_to_be32(JBD2_FC_BLOCK);
+	h->fc_header.h_sequence = cpu_to_be32(tid);
+	h->fc_nonce = cpu_to_be32(journal->j_fc_nonce);
+	h->fc_len = cpu_to_be32(len);
+	memcpy(h + 1, data, len);
+	h->fc_chksum = cpu_to_be32(jbd2_fc_chksum(h));
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	get_bh(bh);
+	bh->b_end_io = end_buffer_write_sync;
+
+	/* The data the caller wrote must be stable along with the block */
+	if ((journal->j_fs_dev != journal->j_dev) &&
+	    (journal->j_flags & JBD2_BARRIER))
+		blkdev_issue_flush(journal->j_fs_dev, GFP_KERNEL, NULL);
+	if (journal->j_flags & JBD2_BARRIER)
+		submit_bh(WRITE_SYNC | WRITE_FLUSH_FUA, bh);
+	else
+		submit_bh(WRITE_SYNC, bh);
+	wait_on_buffer(bh);
+
+	if (buffer_uptodate(bh)) {
+		journal->j_fc_off++;
+		ret = 0;
+	} else {
+		ret = -EIO;
+	}
+	brelse(bh);
+out:
+	mutex_unlock(&journal->j_fc_mutex);
+	return ret;
+}
+EXPORT_SYMBOL(jbd2_fc_write);
+
 /*
  * Wait for a specified commit to complete.
  * The caller may not hold the journal lock.
@@ -651,6 +752,64 @@ int jbd2_log_wait_commit(journal_t *journal, tid_t tid)
 	return err;
 }
 
+/*
+ * Synchronous transaction batching.  A synchronous operation (a sync
+ * handle, or an fsync) is about to commit @tid: don't force the commit
+ * immediately.  Let's yield and let another thread piggyback onto this
+ * transaction.  Keep doing that while new threads continue to arrive.
+ * It doesn't cost much - we're about to run a commit and sleep on IO
+ * anyway.  Speeds up many-threaded, many-dir operations by 30x or more...
+ *
+ * We try and optimize the sleep time against what the underlying disk
+ * can do, instead of having a static sleep time.  This is useful for the
+ * case where our storage is so fast that it is more optimal to go ahead
+ * and force a flush and wait for the transaction to be committed than it
+ * is to wait for an arbitrary amount of time for new writers to join the
+ * transaction.  We achieve this by measuring how long it takes to commit
+ * a transaction, and compare it with how long this transaction has been
+ * running, and if run time < commit time then we sleep for the delta and
+ * commit.  This greatly helps super fast disks that would see slowdowns
+ * as more threads started doing fsyncs.
+ *
+ * But don't do this if this process was the most recent one to perform a
+ * synchronous write.  We do this to detect the case where a single
+ * process is doing a stream of sync writes.  No point in waiting for
+ * joiners in that case.  Nor if @tid is no longer running.
+ */
+void jbd2_log_batch_sync(journal_t *journal, tid_t tid)
+{
+	transaction_t *transaction;
+	u64 commit_time, trans_time;
+	pid_t pid = current->pid;
+
+	if (journal->j_last_sync_writer == pid)
+		return;
+	journal->j_last_sync_writer = pid;
+
+	read_lock(&journal->j_state_lock);
+	transaction = journal->j_running_transaction;
+	if (!transaction || transaction->t_tid != tid) {
+		read_unlock(&journal->j_state_lock);
+		return;
+	}
+	commit_time = journal->j_average_commit_time;
+	trans_time = ktime_to_ns(ktime_sub(ktime_get(),
+					   transaction->t_start_time));
+	read_unlock(&journal->j_state_lock);
+
+	commit_time = max_t(u64, commit_time,
+			    1000*journal->j_min_batch_time);
+	commit_time = min_t(u64, commit_time,
+			    1000*journal->j_max_batch_time);
+
+	if (trans_time < commit_time) {
+		ktime_t expires = ktime_add_ns(ktime_get(), commit_time);
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+	}
+}
+EXPORT_SYMBOL(jbd2_log_batch_sync);
+
 /*
  * Log buffer allocation routines:
  */
@@ -842,6 +1001,69 @@ static const struct file_operations jbd2_seq_info_fops = {
 	.release        = jbd2_seq_info_release,
 };
 
+static int jbd2_seq_hist_show(struct seq_file *seq, void *v)
+{
+	static const char *const names[JBD2_HIST_NR] = {
+		"running", "locked", "flushing", "logging", "commit",
+	};
+	journal_t *journal = seq->private;
+	struct jbd2_commit_hist *hist;
+	char label[16];
+	int i, phase;
+
+	hist = kmalloc(sizeof(*hist), GFP_KERNEL);
+	if (!hist)
+		return -ENOMEM;
+	spin_lock(&journal->j_history_lock);
+	memcpy(hist, &journal->j_hist, sizeof(*hist));
+	spin_unlock(&journal->j_history_lock);
+
+	seq_printf(seq, "%10s", "usecs");
+	for (phase = 0; phase < JBD2_HIST_NR; phase++)
+		seq_printf(seq, " %10s", names[phase]);
+	seq_putc(seq, '\n');
+
+	for (i = 0; i < JBD2_HIST_BUCKETS; i++) {
+		if (i < JBD2_HIST_BUCKETS - 1)
+			sprintf(label, "<%lu", 1UL << i);
+		else
+			sprintf(label, ">=%lu", 1UL << (i - 1));
+		seq_printf(seq, "%10s", label);
+		for (phase = 0; phase < JBD2_HIST_NR; phase++)
+			seq_printf(seq, " %10lu", hist->count[phase][i]);
+		seq_putc(seq, '\n');
+	}
+
+	kfree(hist);
+	return 0;
+}
+
+static int jbd2_seq_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, jbd2_seq_hist_show, PDE(inode)->data);
+}
+
+/* Any write clears the histograms */
+static ssize_t jbd2_seq_hist_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	journal_t *journal = PDE(file->f_path.dentry->d_inode)->data;
+
+	spin_lock(&journal->j_history_lock);
+	memset(&journal->j_hist, 0, sizeof(journal->j_hist));
+	spin_unlock(&journal->j_history_lock);
+	return count;
+}
+
+static const struct file_operations jbd2_seq_hist_fops = {
+	.owner		= THIS_MODULE,
+	.open		= jbd2_seq_hist_open,
+	.read		= seq_read,
+	.write		= jbd2_seq_hist_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static struct proc_dir_entry *proc_jbd2_stats;
 
 static void jbd2_stats_proc_init(journal_t *journal)
@@ -850,11 +1072,15 @@ static void jbd2_stats_proc_init(journal_t *journal)
 	if (journal->j_proc_entry) {
 		proc_create_data("info", S_IRUGO, journal->j_proc_entry,
 				 &jbd2_seq_info_fops, journal);
+		proc_create_data("histogram", S_IRUGO | S_IWUSR,
+				 journal->j_proc_entry,
+				 &jbd2_seq_hist_fops, journal);
 	}
 }
 
 static void jbd2_stats_proc_exit(journal_t *journal)
 {
+	remove_proc_entry("histogram", journal->j_proc_entry);
 	remove_proc_entry("info", journal->j_proc_entry);
 	remove_proc_entry(journal->j_devname, proc_jbd2_stats);
 }
@@ -885,6 +1111,7 @@ static journal_t * journal_init_common (void)
 	init_waitqueue_head(&journal->j_wait_updates);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
+	mutex_init(&journal->j_fc_mutex);
 	spin_lock_init(&journal->j_revoke_lock);
 	spin_lock_init(&journal->j_list_lock);
 	rwlock_init(&journal->j_state_lock);
@@ -1080,7 +1307,7 @@ static int journal_reset(journal_t *journal)
 	unsigned long long first, last;
 
 	first = be32_to_cpu(sb->s_first);
-	last = be32_to_cpu(sb->s_maxlen);
+	last = be32_to_cpu(sb->s_maxlen) - journal->j_fc_blocks;
 	if (first + JBD2_MIN_JOURNAL_BLOCKS > last + 1) {
 		printk(KERN_ERR "JBD: Journal too short (blocks %llu-%llu).\n",
 		       first, last);
@@ -1269,6 +1496,21 @@ static int load_superblock(journal_t *journal)
 	journal->j_last = be32_to_cpu(sb->s_maxlen);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_INODE_FC)) {
+		journal->j_fc_blocks = be32_to_cpu(sb->s_inode_fc_blks);
+		if (journal->j_fc_blocks >=
+		    journal->j_last - journal->j_first) {
+			printk(KERN_WARNING
+				"JBD: bad fast commit area (%u blocks)\n",
+				journal->j_fc_blocks);
+			journal_fail_superblock(journal);
+			return -EINVAL;
+		}
+		journal->j_last -= journal->j_fc_blocks;
+		journal->j_fc_first = journal->j_last;
+	}
+
 	return 0;
 }
 
@@ -1381,6 +1623,10 @@ int jbd2_journal_destroy(journal_t *journal)
 			journal->j_tail = 0;
 			journal->j_tail_sequence =
 				++journal->j_transaction_sequence;
+			/* ... and no fast commit can be of use any more */
+			jbd2_journal_clear_features(journal, 0, 0,
+					JBD2_FEATURE_INCOMPAT_INODE_FC);
+			journal->j_superblock->s_inode_fc_blks = 0;
 			jbd2_journal_update_superblock(journal, 1);
 		} else {
 			err = -EIO;
@@ -1530,6 +1776,58 @@ void jbd2_journal_clear_features(journal_t *journal, unsigned long compat,
 }
 EXPORT_SYMBOL(jbd2_journal_clear_features);
 
+/**
+ * int jbd2_fc_init() - Set up the fast commit area
+ * @journal: Journal to act on.
+ * @blocks: Number of blocks to take from the end of the log.
+ *
+ * Carve a fast commit area out of the end of the log, unless the journal
+ * already has one.  This must be done right after jbd2_journal_load(),
+ * while the log is still empty.  The area is given back to the log when
+ * the journal is destroyed cleanly.
+ */
+int jbd2_fc_init(journal_t *journal, unsigned int blocks)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	int err = 0;
+
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_INODE_FC))
+		return 0;
+	if (!jbd2_journal_check_available_features(journal, 0, 0,
+					JBD2_FEATURE_INCOMPAT_INODE_FC))
+		return -EINVAL;
+
+	write_lock(&journal->j_state_lock);
+	if (journal->j_running_transaction ||
+	    journal->j_committing_transaction ||
+	    journal->j_head != journal->j_first ||
+	    journal->j_tail != journal->j_first) {
+		err = -EBUSY;
+		goto out;
+	}
+	if (journal->j_last - journal->j_first <
+	    blocks + JBD2_MIN_JOURNAL_BLOCKS) {
+		err = -ENOSPC;
+		goto out;
+	}
+
+	journal->j_last -= blocks;
+	journal->j_free -= blocks;
+	journal->j_fc_first = journal->j_last;
+	journal->j_fc_blocks = blocks;
+	journal->j_fc_off = 0;
+	sb->s_inode_fc_blks = cpu_to_be32(blocks);
+	sb->s_feature_incompat |=
+		cpu_to_be32(JBD2_FEATURE_INCOMPAT_INODE_FC);
+out:
+	write_unlock(&journal->j_state_lock);
+	if (!err)
+		jbd2_journal_update_superblock(journal, 1);
+	return err;
+}
+EXPORT_SYMBOL(jbd2_fc_init);
+
 /**
  * int jbd2_journal_update_format () - Update on-disk journal structure.
  * @journal: Journal to act on.
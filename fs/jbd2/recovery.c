@@ -210,6 +210,60 @@ do {									\
 		var -= ((journal)->j_last - (journal)->j_first);	\
 } while (0)
 
+__u32 jbd2_fc_chksum(jbd2_fc_header_t *h)
+{
+	__u32 crc;
+
+	crc = crc32_be(~0, (void *)h, offsetof(jbd2_fc_header_t, fc_chksum));
+	return crc32_be(crc, (void *)(h + 1), be32_to_cpu(h->fc_len));
+}
+
+/*
+ * Hand the fast commit blocks of transaction @tid, the first one which did
+ * not commit, back to the filesystem.  They were written in order from the
+ * start of the fast commit area, and the first block which does not check
+ * out ends the list.
+ */
+static int fc_do_replay(journal_t *journal, tid_t tid)
+{
+	struct buffer_head *bh;
+	jbd2_fc_header_t *h;
+	__u32 nonce = 0;
+	unsigned int i, len;
+	int err = 0;
+
+	if (!journal->j_fc_blocks || !journal->j_fc_replay_callback)
+		return 0;
+
+	for (i = 0; i < journal->j_fc_blocks; i++) {
+		err = jread(&bh, journal, journal->j_fc_first + i);
+		if (err)
+			break;
+
+		h = (jbd2_fc_header_t *)bh->b_data;
+		len = be32_to_cpu(h->fc_len);
+		if (h->fc_header.h_magic != cpu_to_be32(JBD2_MAGIC_NUMBER) ||
+		    be32_to_cpu(h->fc_header.h_blocktype) != JBD2_FC_BLOCK ||
+		    be32_to_cpu(h->fc_header.h_sequence) != tid ||
+		    (i && be32_to_cpu(h->fc_nonce) != nonce) ||
+		    len > journal->j_blocksize - sizeof(*h) ||
+		    be32_to_cpu(h->fc_chksum) != jbd2_fc_chksum(h)) {
+			brelse(bh);
+			break;
+		}
+		nonce = be32_to_cpu(h->fc_nonce);
+
+		err = journal->j_fc_replay_callback(journal, h + 1, len);
+		brelse(bh);
+		if (err)
+			break;
+	}
+
+	jbd_debug(1, "JBD: replayed %u fast commit blocks of transaction %u\n",
+		  i, tid);
+	return err;
+}
+
 /**
  * jbd2_journal_recover - recovers a on-disk journal
  * @journal: the journal to recover
@@ -242,7 +296,13 @@ int jbd2_journal_recover(journal_t *journal)
 		jbd_debug(1, "No recovery required, last transaction %d\n",
 			  be32_to_cpu(sb->s_sequence));
 		journal->j_transaction_sequence = be32_to_cpu(sb->s_sequence) + 1;
-		return 0;
+		/*
+		 * The log may have been flushed with the filesystem still in
+		 * use, so fast commits can be pending even then.
+		 */
+		err = fc_do_replay(journal, be32_to_cpu(sb->s_sequence));
+		err2 = sync_blockdev(journal->j_fs_dev);
+		return err ? err : err2;
 	}
 
 	err = do_one_pass(journal, &info, PASS_SCAN);
@@ -250,6 +310,8 @@ int jbd2_journal_recover(journal_t *journal)
 		err = do_one_pass(journal, &info, PASS_REVOKE);
 	if (!err)
 		err = do_one_pass(journal, &info, PASS_REPLAY);
+	if (!err)
+		err = fc_do_replay(journal, info.end_transaction);
 
 	jbd_debug(1, "JBD: recovery, exit status %d, "
 		  "recovered transactions %u to %u\n",
@@ -1207,6 +1207,52 @@ static struct dentry *d_alloc_and_lookup(struct dentry *parent,
 	return dentry;
 }
 
+/*
+ * Parallel lookup mode (FS_PARALLEL_LOOKUP): a lookup that misses the
+ * dcache holds the parent's i_dir_sem shared rather than its i_mutex, so
+ * lookups in one directory do not serialize.  Whatever changes the
+ * directory holds i_mutex and takes i_dir_sem exclusive around the change,
+ * see dir_lock_change().  d_alloc_parallel() keeps it to one ->lookup
+ * per name.  Same as d_alloc_and_lookup() otherwise; the parent's i_mutex
+ * or i_dir_sem must be held.
+ */
+static struct dentry *d_alloc_and_lookup_parallel(struct dentry *parent,
+				struct qstr *name, struct nameidata *nd)
+{
+	struct inode *inode = parent->d_inode;
+	struct dentry_lookup dl;
+	struct dentry *dentry;
+	struct dentry *old;
+
+	/* Don't create child dentry for a dead directory. */
+	if (unlikely(IS_DEADDIR(inode)))
+		return ERR_PTR(-ENOENT);
+
+	dentry = d_alloc_parallel(parent, name, &dl);
+	if (IS_ERR(dentry) || !d_in_lookup(dentry))
+		return dentry;
+
+	old = inode->i_op->lookup(inode, dentry, nd);
+	d_lookup_done(&dl);
+	if (unlikely(old)) {
+		dput(dentry);
+		dentry = old;
+	}
+	return dentry;
+}
+
+static inline void dir_lock_change(struct inode *dir, int subclass)
+{
+	if (IS_PARALLEL_LOOKUP(dir))
+		down_write_nested(&dir->i_dir_sem, subclass);
+}
+
+static inline void dir_unlock_change(struct inode *dir)
+{
+	if (IS_PARALLEL_LOOKUP(dir))
+		up_write(&dir->i_dir_sem);
+}
+
 /*
  *  It's more convoluted than I'd like it to be, but... it's still fairly
  *  small and for now I'd prefer to have fast path as straight as possible.
@@ -1293,6 +1339,15 @@ need_lookup:
 	dir = parent->d_inode;
 	BUG_ON(nd->inode != dir);
 
+	if (IS_PARALLEL_LOOKUP(dir)) {
+		down_read(&dir->i_dir_sem);
+		dentry = d_alloc_and_lookup_parallel(parent, name, nd);
+		up_read(&dir->i_dir_sem);
+		if (IS_ERR(dentry))
+			goto fail;
+		goto done;
+	}
+
 	mutex_lock(&dir->i_mutex);
 	/*
 	 * First re-do the cached lookup just in case it was created
@@ -1568,7 +1623,7 @@ static void path_finish_rcu(struct nameidata *nd)
 		br_read_unlock(vfsmount_lock);
 	}
 	if (nd->file)
-		fput(nd->file);
+		fput_light(nd->file, nd->fput_needed);
 }
 
 static int path_init_rcu(int dfd, const char *name, unsigned int flags, struct nameidata *nd)
@@ -1629,8 +1684,10 @@ static int path_init_rcu(int dfd, const char *name, unsigned int flags, struct n
 			goto fput_fail;
 
 		nd->path = file->f_path;
-		if (fput_needed)
+		if (fput_needed) {
 			nd->file = file;
+			nd->fput_needed = fput_needed;
+		}
 
 		nd->seq = __read_seqcount_begin(&nd->path.dentry->d_seq);
 		br_read_lock(vfsmount_lock);
@@ -1832,8 +1889,12 @@ static struct dentry *__lookup_hash(struct qstr *name,
 	if (dentry && (dentry->d_flags & DCACHE_OP_REVALIDATE))
 		dentry = do_revalidate(dentry, nd);
 
-	if (!dentry)
-		dentry = d_alloc_and_lookup(base, name, nd);
+	if (!dentry) {
+		if (IS_PARALLEL_LOOKUP(inode))
+			dentry = d_alloc_and_lookup_parallel(base, name, nd);
+		else
+			dentry = d_alloc_and_lookup(base, name, nd);
+	}
 out:
 	return dentry;
 }
@@ -2073,7 +2134,9 @@ int vfs_create(struct inode *dir, struct dentry *dentry, int mode,
 	error = security_inode_create(dir, dentry, mode);
 	if (error)
 		return error;
+	dir_lock_change(dir, I_MUTEX_PARENT);
 	error = dir->i_op->create(dir, dentry, mode, nd);
+	dir_unlock_change(dir);
 	if (!error)
 		fsnotify_create(dir, dentry);
 	return error;
@@ -2657,7 +2720,9 @@ int vfs_mknod(struct inode *dir, struct dentry *dentry, int mode, dev_t dev)
 	if (error)
 		return error;
 
+	dir_lock_change(dir, I_MUTEX_PARENT);
 	error = dir->i_op->mknod(dir, dentry, mode, dev);
+	dir_unlock_change(dir);
 	if (!error)
 		fsnotify_create(dir, dentry);
 	return error;
@@ -2755,7 +2820,9 @@ int vfs_mkdir(struct inode *dir, struct dentry *dentry, int mode)
 	if (error)
 		return error;
 
+	dir_lock_change(dir, I_MUTEX_PARENT);
 	error = dir->i_op->mkdir(dir, dentry, mode);
+	dir_unlock_change(dir);
 	if (!error)
 		fsnotify_mkdir(dir, dentry);
 	return error;
@@ -2845,11 +2912,15 @@ int vfs_rmdir(struct inode *dir, struct dentry *dentry)
 	else {
 		error = security_inode_rmdir(dir, dentry);
 		if (!error) {
+			dir_lock_change(dir, I_MUTEX_PARENT);
+			dir_lock_change(dentry->d_inode, I_MUTEX_CHILD);
 			error = dir->i_op->rmdir(dir, dentry);
 			if (!error) {
 				dentry->d_inode->i_flags |= S_DEAD;
 				dont_mount(dentry);
 			}
+			dir_unlock_change(dentry->d_inode);
+			dir_unlock_change(dir);
 		}
 	}
 	mutex_unlock(&dentry->d_inode->i_mutex);
@@ -2931,7 +3002,9 @@ int vfs_unlink(struct inode *dir, struct dentry *dentry)
 	else {
 		error = security_inode_unlink(dir, dentry);
 		if (!error) {
+			dir_lock_change(dir, I_MUTEX_PARENT);
 			error = dir->i_op->unlink(dir, dentry);
+			dir_unlock_change(dir);
 			if (!error)
 				dont_mount(dentry);
 		}
@@ -3037,7 +3110,9 @@ int vfs_symlink(struct inode *dir, struct dentry *dentry, const char *oldname)
 	if (error)
 		return error;
 
+	dir_lock_change(dir, I_MUTEX_PARENT);
 	error = dir->i_op->symlink(dir, dentry, oldname);
+	dir_unlock_change(dir);
 	if (!error)
 		fsnotify_create(dir, dentry);
 	return error;
@@ -3120,7 +3195,9 @@ int vfs_link(struct dentry *old_dentry, struct inode *dir, struct dentry *new_de
 		return error;
 
 	mutex_lock(&inode->i_mutex);
+	dir_lock_change(dir, I_MUTEX_PARENT);
 	error = dir->i_op->link(old_dentry, dir, new_dentry);
+	dir_unlock_change(dir);
 	mutex_unlock(&inode->i_mutex);
 	if (!error)
 		fsnotify_link(dir, inode, new_dentry);
@@ -3223,6 +3300,30 @@ SYSCALL_DEFINE2(link, const char __user *, oldname, const char __user *, newname
  *	   ->i_mutex on parents, which works but leads to some truly excessive
  *	   locking].
  */
+/*
+ * Both parents are locked by lock_rename(), so nobody else can be taking
+ * the i_dir_sem of two of these directories: any order will do.
+ */
+static void rename_lock_change(struct inode *old_dir, struct inode *new_dir,
+			       struct inode *target)
+{
+	dir_lock_change(old_dir, I_MUTEX_PARENT);
+	if (new_dir != old_dir)
+		dir_lock_change(new_dir, I_MUTEX_CHILD);
+	if (target)
+		dir_lock_change(target, I_MUTEX_NORMAL);
+}
+
+static void rename_unlock_change(struct inode *old_dir, struct inode *new_dir,
+				 struct inode *target)
+{
+	if (target)
+		dir_unlock_change(target);
+	if (new_dir != old_dir)
+		dir_unlock_change(new_dir);
+	dir_unlock_change(old_dir);
+}
+
 static int vfs_rename_dir(struct inode *old_dir, struct dentry *old_dentry,
 			  struct inode *new_dir, struct dentry *new_dentry)
 {
@@ -3251,13 +3352,15 @@ static int vfs_rename_dir(struct inode *old_dir, struct dentry *old_dentry,
 	else {
 		if (target)
 			dentry_unhash(new_dentry);
+		rename_lock_change(old_dir, new_dir, target);
 		error = old_dir->i_op->rename(old_dir, old_dentry, new_dir, new_dentry);
+		if (target && !error)
+			target->i_flags |= S_DEAD;
+		rename_unlock_change(old_dir, new_dir, target);
 	}
 	if (target) {
-		if (!error) {
-			target->i_flags |= S_DEAD;
+		if (!error)
 			dont_mount(new_dentry);
-		}
 		mutex_unlock(&target->i_mutex);
 		if (d_unhashed(new_dentry))
 			d_rehash(new_dentry);
@@ -3285,8 +3388,11 @@ static int vfs_rename_other(struct inode *old_dir, struct dentry *old_dentry,
 		mutex_lock(&target->i_mutex);
 	if (d_mountpoint(old_dentry)||d_mountpoint(new_dentry))
 		error = -EBUSY;
-	else
+	else {
+		rename_lock_change(old_dir, new_dir, NULL);
 		error = old_dir->i_op->rename(old_dir, old_dentry, new_dir, new_dentry);
+		rename_unlock_change(old_dir, new_dir, NULL);
+	}
 	if (!error) {
 		if (target)
 			dont_mount(new_dentry);
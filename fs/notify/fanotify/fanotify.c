@@ -31,20 +31,28 @@ static bool should_merge(struct fsnotify_event *old, struct fsnotify_event *new)
 }
 
 /* and the list better be locked by something too! */
-static struct fsnotify_event *fanotify_merge(struct list_head *list,
+static struct fsnotify_event *fanotify_merge(struct fsnotify_group *group,
 					     struct fsnotify_event *event)
 {
 	struct fsnotify_event_holder *test_holder;
 	struct fsnotify_event *test_event = NULL;
 	struct fsnotify_event *new_event;
 
-	pr_debug("%s: list=%p event=%p\n", __func__, list, event);
-
+	pr_debug("%s: group=%p event=%p\n", __func__, group, event);
 
-	list_for_each_entry_reverse(test_holder, list, event_list) {
-		if (should_merge(test_holder->event, event)) {
+	if (group->coalesce_window) {
+		/* the hash knows the last event queued for this object */
+		test_holder = fsnotify_merge_candidate(group, event);
+		if (should_merge(test_holder->event, event))
 			test_event = test_holder->event;
-			break;
+	} else {
+		list_for_each_entry_reverse(test_holder,
+					    &group->notification_list,
+					    event_list) {
+			if (should_merge(test_holder->event, event)) {
+				test_event = test_holder->event;
+				break;
+			}
 		}
 	}
 
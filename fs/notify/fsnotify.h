@@ -8,6 +8,10 @@
 
 /* destroy all events sitting in this groups notification queue */
 extern void fsnotify_flush_notify(struct fsnotify_group *group);
+/* free what event coalescing needs once the queue is empty */
+extern void fsnotify_destroy_notify_hash(struct fsnotify_group *group);
+/* delayed wakeup of the readers of a group */
+extern void fsnotify_wake_readers(unsigned long data);
 
 /* protects reads of inode and vfsmount marks list */
 extern struct srcu_struct fsnotify_mark_srcu;
@@ -35,6 +35,7 @@ void fsnotify_final_destroy_group(struct fsnotify_group *group)
 {
 	/* clear the notification queue of all events */
 	fsnotify_flush_notify(group);
+	fsnotify_destroy_notify_hash(group);
 
 	if (group->ops->free_group_priv)
 		group->ops->free_group_priv(group);
@@ -94,6 +95,8 @@ struct fsnotify_group *fsnotify_alloc_group(const struct fsnotify_ops *ops)
 	INIT_LIST_HEAD(&group->notification_list);
 	init_waitqueue_head(&group->notification_waitq);
 	group->max_events = UINT_MAX;
+	setup_timer(&group->notification_timer, fsnotify_wake_readers,
+		    (unsigned long)group);
 
 	spin_lock_init(&group->mark_lock);
 	INIT_LIST_HEAD(&group->marks_list);
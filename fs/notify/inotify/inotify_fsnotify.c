@@ -68,7 +68,7 @@ static bool event_compare(struct fsnotify_event *old, struct fsnotify_event *new
 	return false;
 }
 
-static struct fsnotify_event *inotify_merge(struct list_head *list,
+static struct fsnotify_event *inotify_merge(struct fsnotify_group *group,
 					    struct fsnotify_event *event)
 {
 	struct fsnotify_event_holder *last_holder;
@@ -77,7 +77,7 @@ static struct fsnotify_event *inotify_merge(struct list_head *list,
 	/* and the list better be locked by something too */
 	spin_lock(&event->lock);
 
-	last_holder = list_entry(list->prev, struct fsnotify_event_holder, event_list);
+	last_holder = fsnotify_merge_candidate(group, event);
 	last_event = last_holder->event;
 	if (event_compare(last_event, event))
 		fsnotify_get_event(last_event);
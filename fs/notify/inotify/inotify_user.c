@@ -307,9 +307,11 @@ static long inotify_ioctl(struct file *file, unsigned int cmd,
 	struct fsnotify_group *group;
 	struct fsnotify_event_holder *holder;
 	struct fsnotify_event *event;
+	struct inotify_queue_stats stats;
 	void __user *p;
 	int ret = -ENOTTY;
 	size_t send_len = 0;
+	u32 window;
 
 	group = file->private_data;
 	p = (void __user *) arg;
@@ -329,6 +331,18 @@ static long inotify_ioctl(struct file *file, unsigned int cmd,
 		mutex_unlock(&group->notification_mutex);
 		ret = put_user(send_len, (int __user *) p);
 		break;
+	case INOTIFY_IOC_SETWINDOW:
+		ret = get_user(window, (u32 __user *) p);
+		if (!ret)
+			ret = fsnotify_set_coalesce_window(group, window);
+		break;
+	case INOTIFY_IOC_GETSTATS:
+		mutex_lock(&group->notification_mutex);
+		stats.merged = group->q_merged;
+		stats.dropped = group->q_dropped;
+		mutex_unlock(&group->notification_mutex);
+		ret = copy_to_user(p, &stats, sizeof(stats)) ? -EFAULT : 0;
+		break;
 	}
 
 	return ret;
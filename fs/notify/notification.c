@@ -29,9 +29,18 @@
  * of always needing two.  If the embedded event_holder is already in use by
  * another group a new event_holder (from fsnotify_event_holder_cachep) will be
  * allocated and used.
+ *
+ * Events are merged into events already on the queue, how is up to the
+ * group's merge function.  By default only the last event on the queue is
+ * considered.  A group with a coalescing window also hashes its queued
+ * event_holders by the object they are about, so that an event can be
+ * merged into the last one queued for its object however long the queue
+ * is, and holds back waking up readers for the length of the window.
  */
 
+#include <linux/dcache.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
@@ -50,6 +59,10 @@
 
 static struct kmem_cache *fsnotify_event_cachep;
 static struct kmem_cache *fsnotify_event_holder_cachep;
+
+#define FSNOTIFY_HASH_BITS	7
+#define FSNOTIFY_HASH_SIZE	(1 << FSNOTIFY_HASH_BITS)
+#define FSNOTIFY_MAX_WINDOW_MS	1000
 /*
  * This is a magic event we send when the q is too full.  Since it doesn't
  * hold real event information we just keep one system wide and use it any time
@@ -102,7 +115,12 @@ void fsnotify_put_event(struct fsnotify_event *event)
 
 struct fsnotify_event_holder *fsnotify_alloc_event_holder(void)
 {
-	return kmem_cache_alloc(fsnotify_event_holder_cachep, GFP_KERNEL);
+	struct fsnotify_event_holder *holder;
+
+	holder = kmem_cache_alloc(fsnotify_event_holder_cachep, GFP_KERNEL);
+	if (holder)
+		INIT_HLIST_NODE(&holder->hash_node);
+	return holder;
 }
 
 void fsnotify_destroy_event_holder(struct fsnotify_event_holder *holder)
@@ -132,6 +150,113 @@ struct fsnotify_event_private_data *fsnotify_remove_priv_from_event(struct fsnot
 	return priv;
 }
 
+/* the object an event is about: the inode told and, if any, the name */
+static unsigned int fsnotify_event_hashfn(struct fsnotify_event *event)
+{
+	unsigned long hash = (unsigned long)event->to_tell;
+
+	if (event->name_len)
+		hash ^= full_name_hash(event->file_name, event->name_len);
+	return hash_long(hash, FSNOTIFY_HASH_BITS);
+}
+
+static bool fsnotify_same_object(struct fsnotify_event *old,
+				 struct fsnotify_event *new)
+{
+	return old->to_tell == new->to_tell &&
+	       old->name_len == new->name_len &&
+	       (!old->name_len || !strcmp(old->file_name, new->file_name));
+}
+
+/*
+ * Return the queued event_holder a group's merge function should try to
+ * merge @event into, or NULL if the queue is empty.  That is the last event
+ * queued for the same object if it was queued within the coalescing window
+ * of the group, otherwise the last event on the queue.
+ */
+struct fsnotify_event_holder *fsnotify_merge_candidate(struct fsnotify_group *group,
+						       struct fsnotify_event *event)
+{
+	struct list_head *list = &group->notification_list;
+	struct fsnotify_event_holder *holder, *last;
+	struct hlist_node *pos;
+
+	BUG_ON(!mutex_is_locked(&group->notification_mutex));
+
+	if (list_empty(list))
+		return NULL;
+	last = list_entry(list->prev, struct fsnotify_event_holder, event_list);
+	if (!group->coalesce_window || !group->notification_hash)
+		return last;
+
+	/* newest first, so the first match is the last one queued */
+	hlist_for_each_entry(holder, pos,
+			     &group->notification_hash[fsnotify_event_hashfn(event)],
+			     hash_node) {
+		if (!fsnotify_same_object(holder->event, event))
+			continue;
+		if (holder == last ||
+		    time_before(jiffies, holder->queued + group->coalesce_window))
+			return holder;
+		break;
+	}
+	return last;
+}
+
+/* timer function of group->notification_timer */
+void fsnotify_wake_readers(unsigned long data)
+{
+	struct fsnotify_group *group = (struct fsnotify_group *)data;
+
+	wake_up(&group->notification_waitq);
+}
+
+/*
+ * Set the coalescing window of @group.  An event is then merged into the
+ * last event queued for the same object if that was queued less than
+ * @msecs ago, wherever it is on the queue, and readers are only woken up
+ * @msecs after the first event on an empty queue, so that they read a burst
+ * of events in one go.  Permission events and a half full queue still wake
+ * them up right away.  A window of 0 restores the default behaviour.
+ */
+int fsnotify_set_coalesce_window(struct fsnotify_group *group, unsigned int msecs)
+{
+	struct hlist_head *hash = NULL;
+
+	if (msecs > FSNOTIFY_MAX_WINDOW_MS)
+		return -EINVAL;
+
+	if (msecs && !group->notification_hash) {
+		hash = kcalloc(FSNOTIFY_HASH_SIZE, sizeof(*hash), GFP_KERNEL);
+		if (!hash)
+			return -ENOMEM;
+	}
+
+	mutex_lock(&group->notification_mutex);
+	if (hash && !group->notification_hash) {
+		group->notification_hash = hash;
+		hash = NULL;
+	}
+	group->coalesce_window = msecs_to_jiffies(msecs);
+	mutex_unlock(&group->notification_mutex);
+
+	kfree(hash);
+
+	/* don't leave readers waiting for a window that no longer exists */
+	if (!msecs && del_timer_sync(&group->notification_timer))
+		wake_up(&group->notification_waitq);
+	return 0;
+}
+
+/*
+ * Called from fsnotify_final_destroy_group() once the queue is flushed.
+ */
+void fsnotify_destroy_notify_hash(struct fsnotify_group *group)
+{
+	del_timer_sync(&group->notification_timer);
+	kfree(group->notification_hash);
+}
+
 /*
  * Add an event to the group notification queue.  The group can later pull this
  * event off the queue to deal with.  If the event is successfully added to the
@@ -139,12 +264,13 @@ struct fsnotify_event_private_data *fsnotify_remove_priv_from_event(struct fsnot
  */
 struct fsnotify_event *fsnotify_add_notify_event(struct fsnotify_group *group, struct fsnotify_event *event,
 						 struct fsnotify_event_private_data *priv,
-						 struct fsnotify_event *(*merge)(struct list_head *,
+						 struct fsnotify_event *(*merge)(struct fsnotify_group *,
 										 struct fsnotify_event *))
 {
 	struct fsnotify_event *return_event = NULL;
 	struct fsnotify_event_holder *holder = NULL;
 	struct list_head *list = &group->notification_list;
+	bool wake = true;
 
 	pr_debug("%s: group=%p event=%p priv=%p\n", __func__, group, event, priv);
 
@@ -166,6 +292,7 @@ alloc_holder:
 	mutex_lock(&group->notification_mutex);
 
 	if (group->q_len >= group->max_events) {
+		group->q_dropped++;
 		event = q_overflow_event;
 
 		/*
@@ -182,8 +309,10 @@ alloc_holder:
 	if (!list_empty(list) && merge) {
 		struct fsnotify_event *tmp;
 
-		tmp = merge(list, event);
+		tmp = merge(group, event);
 		if (tmp) {
+			if (!IS_ERR(tmp))
+				group->q_merged++;
 			mutex_unlock(&group->notification_mutex);
 
 			if (return_event)
@@ -216,15 +345,30 @@ alloc_holder:
 
 	group->q_len++;
 	holder->event = event;
+	holder->queued = jiffies;
 
 	fsnotify_get_event(event);
 	list_add_tail(&holder->event_list, list);
+	if (group->notification_hash)
+		hlist_add_head(&holder->hash_node,
+			       &group->notification_hash[fsnotify_event_hashfn(event)]);
 	if (priv)
 		list_add_tail(&priv->event_list, &event->private_data_list);
 	spin_unlock(&event->lock);
+
+	/* hold back the wakeup so that the events following can be merged */
+	if (group->coalesce_window &&
+	    !(event->mask & ALL_FSNOTIFY_PERM_EVENTS) &&
+	    group->q_len < group->max_events / 2) {
+		wake = false;
+		if (group->q_len == 1)
+			mod_timer(&group->notification_timer,
+				  jiffies + group->coalesce_window);
+	}
 	mutex_unlock(&group->notification_mutex);
 
-	wake_up(&group->notification_waitq);
+	if (wake)
+		wake_up(&group->notification_waitq);
 	return return_event;
 }
 
@@ -249,6 +393,7 @@ struct fsnotify_event *fsnotify_remove_notify_event(struct fsnotify_group *group
 	spin_lock(&event->lock);
 	holder->event = NULL;
 	list_del_init(&holder->event_list);
+	hlist_del_init(&holder->hash_node);
 	spin_unlock(&event->lock);
 
 	/* event == holder means we are referenced through the in event holder */
@@ -304,6 +449,7 @@ void fsnotify_flush_notify(struct fsnotify_group *group)
 static void initialize_event(struct fsnotify_event *event)
 {
 	INIT_LIST_HEAD(&event->holder.event_list);
+	INIT_HLIST_NODE(&event->holder.hash_node);
 	atomic_set(&event->refcnt, 1);
 
 	spin_lock_init(&event->lock);
@@ -339,7 +485,12 @@ int fsnotify_replace_event(struct fsnotify_event_holder *old_holder,
 	spin_lock_nested(&new_event->lock, SPINLOCK_NEW);
 
 	new_holder->event = new_event;
+	new_holder->queued = old_holder->queued;
 	list_replace_init(&old_holder->event_list, &new_holder->event_list);
+	if (!hlist_unhashed(&old_holder->hash_node)) {
+		hlist_add_before(&new_holder->hash_node, &old_holder->hash_node);
+		hlist_del_init(&old_holder->hash_node);
+	}
 
 	spin_unlock(&new_event->lock);
 	spin_unlock(&old_event->lock);
@@ -970,6 +970,8 @@ int filp_close(struct file *filp, fl_owner_t id)
 
 	dnotify_flush(filp, id);
 	locks_remove_posix(filp, id);
+	if (id)
+		files_lend_borrowed(id, filp);
 	fput(filp);
 	return retval;
 }
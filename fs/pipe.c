@@ -20,6 +20,8 @@
 #include <linux/audit.h>
 #include <linux/syscalls.h>
 #include <linux/fcntl.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
 
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
@@ -50,6 +52,48 @@ unsigned int pipe_min_size = PAGE_SIZE;
  * -- Manfred Spraul <manfred@colorfullife.com> 2002-05-09
  */
 
+/*
+ * Pages released by anon pipe buffers are kept in a small per-CPU
+ * pool, so that busy pipes do not go to the page allocator and back
+ * for every buffer they fill. Only process context uses the pool.
+ */
+#define PIPE_POOL_PAGES	16
+
+struct pipe_page_pool {
+	int nr;
+	struct page *pages[PIPE_POOL_PAGES];
+};
+
+static DEFINE_PER_CPU(struct pipe_page_pool, pipe_page_pool);
+
+static struct page *pipe_get_page(void)
+{
+	struct pipe_page_pool *pool = &get_cpu_var(pipe_page_pool);
+	struct page *page = NULL;
+
+	if (pool->nr)
+		page = pool->pages[--pool->nr];
+	put_cpu_var(pipe_page_pool);
+
+	if (!page)
+		page = alloc_page(GFP_HIGHUSER);
+	return page;
+}
+
+static void pipe_put_page(struct page *page)
+{
+	struct pipe_page_pool *pool = &get_cpu_var(pipe_page_pool);
+
+	if (pool->nr < PIPE_POOL_PAGES) {
+		pool->pages[pool->nr++] = page;
+		page = NULL;
+	}
+	put_cpu_var(pipe_page_pool);
+
+	if (page)
+		__free_page(page);
+}
+
 static void pipe_lock_nested(struct pipe_inode_info *pipe, int subclass)
 {
 	if (pipe->inode)
@@ -201,12 +245,11 @@ static void anon_pipe_buf_release(struct pipe_inode_info *pipe,
 	struct page *page = buf->page;
 
 	/*
-	 * If nobody else uses this page, and we don't already have a
-	 * temporary page, let's keep track of it as a one-deep
-	 * allocation cache. (Otherwise just release our reference to it)
+	 * If nobody else uses this page, let's give it back to the page
+	 * pool. (Otherwise just release our reference to it)
 	 */
-	if (page_count(page) == 1 && !pipe->tmp_page)
-		pipe->tmp_page = page;
+	if (page_count(page) == 1)
+		pipe_put_page(page);
 	else
 		page_cache_release(page);
 }
@@ -487,7 +530,12 @@ pipe_write(struct kiocb *iocb, const struct iovec *_iov,
 		goto out;
 	}
 
-	/* We try to merge small writes */
+	/*
+	 * We try to merge small writes. If the last buffer cannot take all
+	 * of the tail of the write, fill it up and let the rest go to a new
+	 * buffer, but only when there is a free one: a write of up to
+	 * PIPE_BUF bytes must not be left half done while we wait for room.
+	 */
 	chars = total_len & (PAGE_SIZE-1); /* size of the last buffer */
 	if (pipe->nrbufs && chars != 0) {
 		int lastbuf = (pipe->curbuf + pipe->nrbufs - 1) &
@@ -496,6 +544,10 @@ pipe_write(struct kiocb *iocb, const struct iovec *_iov,
 		const struct pipe_buf_operations *ops = buf->ops;
 		int offset = buf->offset + buf->len;
 
+		if (offset + chars > PAGE_SIZE && offset < PAGE_SIZE &&
+		    pipe->nrbufs < pipe->buffers)
+			chars = PAGE_SIZE - offset;
+
 		if (ops->can_merge && offset + chars <= PAGE_SIZE) {
 			int error, atomic = 1;
 			void *addr;
@@ -540,17 +592,14 @@ redo1:
 		if (bufs < pipe->buffers) {
 			int newbuf = (pipe->curbuf + bufs) & (pipe->buffers-1);
 			struct pipe_buffer *buf = pipe->bufs + newbuf;
-			struct page *page = pipe->tmp_page;
+			struct page *page;
 			char *src;
 			int error, atomic = 1;
 
-			if (!page) {
-				page = alloc_page(GFP_HIGHUSER);
-				if (unlikely(!page)) {
-					ret = ret ? : -ENOMEM;
-					break;
-				}
-				pipe->tmp_page = page;
+			page = pipe_get_page();
+			if (unlikely(!page)) {
+				ret = ret ? : -ENOMEM;
+				break;
 			}
 			/* Always wake up, even if the copy fails. Otherwise
 			 * we lock up (O_NONBLOCK-)readers that sleep due to
@@ -581,6 +630,7 @@ redo2:
 					atomic = 0;
 					goto redo2;
 				}
+				pipe_put_page(page);
 				if (!ret)
 					ret = error;
 				break;
@@ -593,7 +643,6 @@ redo2:
 			buf->offset = 0;
 			buf->len = chars;
 			pipe->nrbufs = ++bufs;
-			pipe->tmp_page = NULL;
 
 			total_len -= chars;
 			if (!total_len)
@@ -919,8 +968,6 @@ void __free_pipe_info(struct pipe_inode_info *pipe)
 		if (buf->ops)
 			buf->ops->release(pipe, buf);
 	}
-	if (pipe->tmp_page)
-		__free_page(pipe->tmp_page);
 	kfree(pipe->bufs);
 	kfree(pipe);
 }
@@ -1275,10 +1322,26 @@ static struct file_system_type pipe_fs_type = {
 	.kill_sb	= kill_anon_super,
 };
 
+/* Give the pages pooled by a CPU that went away back to the allocator */
+static int pipe_cpu_notify(struct notifier_block *self,
+			   unsigned long action, void *hcpu)
+{
+	struct pipe_page_pool *pool;
+
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN) {
+		pool = &per_cpu(pipe_page_pool, (long)hcpu);
+		while (pool->nr)
+			__free_page(pool->pages[--pool->nr]);
+	}
+	return NOTIFY_OK;
+}
+
 static int __init init_pipe_fs(void)
 {
 	int err = register_filesystem(&pipe_fs_type);
 
+	hotcpu_notifier(pipe_cpu_notify, 0);
+
 	if (!err) {
 		pipe_mnt = kern_mount(&pipe_fs_type);
 		if (IS_ERR(pipe_mnt)) {
@@ -371,6 +371,84 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
+/*
+ * Decompress a datablock straight into the page cache pages it covers,
+ * instead of into the read_page cache followed by a copy into each page.
+ *
+ * This is only done if every page of the block can be grabbed without
+ * waiting, is not already up to date, and is directly addressable (not
+ * highmem).  Otherwise -EAGAIN is returned with target_page still locked,
+ * and the caller goes through the cache as before.
+ */
+static int squashfs_readpage_direct(struct page *target_page, u64 block,
+	int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int file_pages = (i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
+		PAGE_CACHE_SHIFT;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int start_index = target_page->index & ~mask;
+	int end_index = min(start_index | mask, file_pages - 1);
+	int pages = end_index - start_index + 1;
+	int i, n, bytes, avail, res = -EAGAIN;
+	struct page **page;
+	void **buffer;
+
+	page = kmalloc(pages * (sizeof(*page) + sizeof(*buffer)), GFP_KERNEL);
+	if (page == NULL)
+		return -EAGAIN;
+	buffer = (void **) (page + pages);
+
+	for (n = 0; n < pages; n++) {
+		page[n] = (start_index + n == target_page->index) ?
+			target_page :
+			grab_cache_page_nowait(target_page->mapping,
+				start_index + n);
+		if (page[n] == NULL)
+			goto release_pages;
+		if ((page[n] != target_page && PageUptodate(page[n])) ||
+				PageHighMem(page[n])) {
+			n++;
+			goto release_pages;
+		}
+		buffer[n] = page_address(page[n]);
+	}
+
+	res = squashfs_read_data(inode->i_sb, buffer, block, bsize, NULL,
+		msblk->block_size, pages);
+	if (res < 0) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		res = -EIO;
+		goto release_pages;
+	}
+
+	for (i = 0, bytes = res; i < pages; i++, bytes -= PAGE_CACHE_SIZE) {
+		avail = clamp_t(int, bytes, 0, PAGE_CACHE_SIZE);
+		memset(buffer[i] + avail, 0, PAGE_CACHE_SIZE - avail);
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+		unlock_page(page[i]);
+		if (page[i] != target_page)
+			page_cache_release(page[i]);
+	}
+
+	kfree(page);
+	return 0;
+
+release_pages:
+	for (i = 0; i < n; i++) {
+		if (page[i] == target_page)
+			continue;
+		unlock_page(page[i]);
+		page_cache_release(page[i]);
+	}
+	kfree(page);
+	return res;
+}
+
+
 static int squashfs_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
@@ -409,6 +487,12 @@ static int squashfs_readpage(struct file *file, struct page *page)
 				 msblk->block_size;
 			sparse = 1;
 		} else {
+			int res = squashfs_readpage_direct(page, block, bsize);
+			if (res == 0)
+				return 0;
+			if (res != -EAGAIN)
+				goto error_out;
+
 			/*
 			 * Read and decompress datablock.
 			 */
@@ -26,6 +26,7 @@
 #include "yaffs_yaffs2.h"
 #include "yaffs_bitmap.h"
 #include "yaffs_verify.h"
+#include "yaffs_summary.h"
 
 #include "yaffs_nand.h"
 #include "yaffs_packedtags2.h"
@@ -145,6 +146,9 @@ static int yaffs_init_tmp_buffers(struct yaffs_dev *dev)
 u8 *yaffs_get_temp_buffer(struct yaffs_dev * dev, int line_no)
 {
 	int i, j;
+	u8 *buffer;
+
+	spin_lock(&dev->temp_lock);
 
 	dev->temp_in_use++;
 	if (dev->temp_in_use > dev->max_temp)
@@ -160,10 +164,15 @@ u8 *yaffs_get_temp_buffer(struct yaffs_dev * dev, int line_no)
 					    dev->temp_buffer[j].line;
 			}
 
-			return dev->temp_buffer[i].buffer;
+			buffer = dev->temp_buffer[i].buffer;
+			spin_unlock(&dev->temp_lock);
+			return buffer;
 		}
 	}
 
+	dev->unmanaged_buffer_allocs++;
+	spin_unlock(&dev->temp_lock);
+
 	yaffs_trace(YAFFS_TRACE_BUFFERS,
 		"Out of temp buffers at line %d, other held by lines:",
 		line_no);
@@ -175,7 +184,6 @@ u8 *yaffs_get_temp_buffer(struct yaffs_dev * dev, int line_no)
 	 * This is not good.
 	 */
 
-	dev->unmanaged_buffer_allocs++;
 	return kmalloc(dev->data_bytes_per_chunk, GFP_NOFS);
 
 }
@@ -184,22 +192,28 @@ void yaffs_release_temp_buffer(struct yaffs_dev *dev, u8 * buffer, int line_no)
 {
 	int i;
 
+	spin_lock(&dev->temp_lock);
+
 	dev->temp_in_use--;
 
 	for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++) {
 		if (dev->temp_buffer[i].buffer == buffer) {
 			dev->temp_buffer[i].line = 0;
+			spin_unlock(&dev->temp_lock);
 			return;
 		}
 	}
 
+	if (buffer)
+		dev->unmanaged_buffer_deallocs++;
+	spin_unlock(&dev->temp_lock);
+
 	if (buffer) {
 		/* assume it is an unmanaged one. */
 		yaffs_trace(YAFFS_TRACE_BUFFERS,
 		  "Releasing unmanaged temp buffer in line %d",
 		   line_no);
 		kfree(buffer);
-		dev->unmanaged_buffer_deallocs++;
 	}
 
 }
@@ -252,6 +266,19 @@ static void yaffs_handle_chunk_update(struct yaffs_dev *dev, int nand_chunk,
 	tags = tags;
 }
 
+/* Readers only queue ECC failures since block info belongs to the writer. */
+static void yaffs_handle_ecc_errs(struct yaffs_dev *dev)
+{
+	int i;
+
+	mutex_lock(&dev->nand_lock);
+	for (i = 0; i < dev->n_ecc_errs; i++)
+		yaffs_handle_chunk_error(dev,
+			yaffs_get_block_info(dev, dev->ecc_err_blocks[i]));
+	dev->n_ecc_errs = 0;
+	mutex_unlock(&dev->nand_lock);
+}
+
 void yaffs_handle_chunk_error(struct yaffs_dev *dev,
 			      struct yaffs_block_info *bi)
 {
@@ -450,6 +477,7 @@ static int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
 		/* Get next block to allocate off */
 		dev->alloc_block = yaffs_find_alloc_block(dev);
 		dev->alloc_page = 0;
+		yaffs_summary_clear(dev);
 	}
 
 	if (!use_reserver && !yaffs_check_alloc_available(dev, 1)) {
@@ -474,8 +502,10 @@ static int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
 
 		dev->n_free_chunks--;
 
-		/* If the block is full set the state to full */
-		if (dev->alloc_page >= dev->param.chunks_per_block) {
+		/* If the block is full set the state to full.
+		 * The chunks after chunks_per_summary hold the block summary.
+		 */
+		if (dev->alloc_page >= dev->chunks_per_summary) {
 			bi->block_state = YAFFS_BLOCK_STATE_FULL;
 			dev->alloc_block = -1;
 		}
@@ -604,6 +634,8 @@ static int yaffs_write_new_chunk(struct yaffs_dev *dev,
 		/* Copy the data into the robustification buffer */
 		yaffs_handle_chunk_wr_ok(dev, chunk, data, tags);
 
+		yaffs_summary_add(dev, tags, chunk);
+
 	} while (write_ok != YAFFS_OK &&
 		 (yaffs_wr_attempts <= 0 || attempts <= yaffs_wr_attempts));
 
@@ -1268,6 +1300,59 @@ static int yaffs_soft_del_worker(struct yaffs_obj *in, struct yaffs_tnode *tn,
 
 }
 
+/*------------------------ Object locking ------------------------------------
+ * Everything that modifies the file system runs under the OS layer's gross
+ * lock, so there is only ever one writer.  Reading file data, symlinks and
+ * xattrs and looking up names do not take the gross lock, they hold the
+ * object's own lock shared instead (the directory's, for a lookup).
+ *
+ * The writer holds an object's lock exclusively while it changes what those
+ * readers look at: the tnode tree and cached chunks of a file, the object
+ * header chunk and name, or the children of a directory.  GC takes the lock
+ * only for the chunk it is moving, so readers wait for writes and gc of
+ * their own object but not for anything else.
+ *
+ * A reader holds at most one object lock and never waits for the writer
+ * while holding it, so the writer may take exclusive locks recursively and
+ * in any order.  lock_depth and n_obj_locked are only touched by the writer.
+ */
+
+void yaffs_obj_rd_lock(struct yaffs_obj *obj)
+{
+	down_read(&obj->lock);
+}
+
+void yaffs_obj_rd_unlock(struct yaffs_obj *obj)
+{
+	up_read(&obj->lock);
+}
+
+static void yaffs_obj_wr_lock(struct yaffs_obj *obj)
+{
+	struct yaffs_dev *dev;
+
+	if (!obj)
+		return;
+
+	dev = obj->my_dev;
+	if (obj->lock_depth++ == 0) {
+		/* lockdep has 8 subclasses */
+		down_write_nested(&obj->lock, min(dev->n_obj_locked, 7));
+		dev->n_obj_locked++;
+	}
+}
+
+static void yaffs_obj_wr_unlock(struct yaffs_obj *obj)
+{
+	if (!obj)
+		return;
+
+	if (--obj->lock_depth == 0) {
+		obj->my_dev->n_obj_locked--;
+		up_write(&obj->lock);
+	}
+}
+
 static void yaffs_remove_obj_from_dir(struct yaffs_obj *obj)
 {
 	struct yaffs_dev *dev = obj->my_dev;
@@ -1281,8 +1366,10 @@ static void yaffs_remove_obj_from_dir(struct yaffs_obj *obj)
 	if (dev && dev->param.remove_obj_fn)
 		dev->param.remove_obj_fn(obj);
 
+	yaffs_obj_wr_lock(parent);
 	list_del_init(&obj->siblings);
 	obj->parent = NULL;
+	yaffs_obj_wr_unlock(parent);
 
 	yaffs_verify_dir(parent);
 }
@@ -1313,8 +1400,10 @@ void yaffs_add_obj_to_dir(struct yaffs_obj *directory, struct yaffs_obj *obj)
 	yaffs_remove_obj_from_dir(obj);
 
 	/* Now add it */
+	yaffs_obj_wr_lock(directory);
 	list_add(&obj->siblings, &directory->variant.dir_variant.children);
 	obj->parent = directory;
+	yaffs_obj_wr_unlock(directory);
 
 	if (directory == obj->my_dev->unlinked_dir
 	    || directory == obj->my_dev->del_dir) {
@@ -1333,8 +1422,10 @@ static int yaffs_change_obj_name(struct yaffs_obj *obj,
 {
 	int unlink_op;
 	int del_op;
+	int ret_val = YAFFS_FAIL;
 
 	struct yaffs_obj *existing_target;
+	struct yaffs_obj *old_dir = obj->parent;
 
 	if (new_dir == NULL)
 		new_dir = obj->parent;	/* use the old directory */
@@ -1368,6 +1459,10 @@ static int yaffs_change_obj_name(struct yaffs_obj *obj,
 	     (shadows > 0) ||
 	     !existing_target) &&
 	    new_dir->variant_type == YAFFS_OBJECT_TYPE_DIRECTORY) {
+		/* Lookups in the old directory compare against the name */
+		yaffs_obj_wr_lock(old_dir);
+		yaffs_obj_wr_lock(new_dir);
+
 		yaffs_set_obj_name(obj, new_name);
 		obj->dirty = 1;
 
@@ -1379,10 +1474,13 @@ static int yaffs_change_obj_name(struct yaffs_obj *obj,
 		/* If it is a deletion then we mark it as a shrink for gc purposes. */
 		if (yaffs_update_oh(obj, new_name, 0, del_op, shadows, NULL) >=
 		    0)
-			return YAFFS_OK;
+			ret_val = YAFFS_OK;
+
+		yaffs_obj_wr_unlock(new_dir);
+		yaffs_obj_wr_unlock(old_dir);
 	}
 
-	return YAFFS_FAIL;
+	return ret_val;
 }
 
 /*------------------------ Short Operations Cache ----------------------------------------
@@ -1424,6 +1522,7 @@ static void yaffs_flush_file_cache(struct yaffs_obj *obj)
 	int n_caches = obj->my_dev->param.n_caches;
 
 	if (n_caches > 0) {
+		yaffs_obj_wr_lock(obj);
 		do {
 			cache = NULL;
 
@@ -1459,6 +1558,7 @@ static void yaffs_flush_file_cache(struct yaffs_obj *obj)
 			yaffs_trace(YAFFS_TRACE_ERROR,
 				"yaffs tragedy: no space during cache write");
 
+		yaffs_obj_wr_unlock(obj);
 	}
 
 }
@@ -1553,6 +1653,11 @@ static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_dev *dev)
 				/* Flush and try again */
 				yaffs_flush_file_cache(the_obj);
 				cache = yaffs_grab_chunk_worker(dev);
+			} else {
+				/* A reader of the_obj may be copying it out */
+				yaffs_obj_wr_lock(the_obj);
+				cache->object = NULL;
+				yaffs_obj_wr_unlock(the_obj);
 			}
 
 		}
@@ -1849,6 +1954,7 @@ static struct yaffs_obj *yaffs_alloc_empty_obj(struct yaffs_dev *dev)
 		/* Now sweeten it up... */
 
 		memset(obj, 0, sizeof(struct yaffs_obj));
+		init_rwsem(&obj->lock);
 		obj->being_created = 1;
 
 		obj->my_dev = dev;
@@ -1860,9 +1966,11 @@ static struct yaffs_obj *yaffs_alloc_empty_obj(struct yaffs_dev *dev)
 
 		/* Now make the directory sane */
 		if (dev->root_dir) {
+			yaffs_obj_wr_lock(dev->root_dir);
 			obj->parent = dev->root_dir;
 			list_add(&(obj->siblings),
 				 &dev->root_dir->variant.dir_variant.children);
+			yaffs_obj_wr_unlock(dev->root_dir);
 		}
 
 		/* Add it to the lost and found directory.
@@ -2422,6 +2530,7 @@ void yaffs_block_became_dirty(struct yaffs_dev *dev, int block_no)
 		bi->pages_in_use = 0;
 		bi->soft_del_pages = 0;
 		bi->has_shrink_hdr = 0;
+		bi->has_summary = 0;
 		bi->skip_erased_check = 1;	/* Clean, so no need to check */
 		bi->gc_prioritise = 0;
 		yaffs_clear_chunk_bits(dev, block_no);
@@ -2473,6 +2582,9 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 
 	bi->has_shrink_hdr = 0;	/* clear the flag so that the block can erase */
 
+	/* The summary is not copied, the new block gets its own */
+	yaffs_summary_gc(dev, block);
+
 	dev->gc_disable = 1;
 
 	if (is_checkpt_block || !yaffs_still_some_chunks(dev, block)) {
@@ -2647,15 +2759,21 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 						/* Ok, now fix up the Tnodes etc. */
 
 						if (tags.chunk_id == 0) {
-							/* It's a header */
+							/* It's a header, lookups read its name */
+							yaffs_obj_wr_lock(object->parent);
+							yaffs_obj_wr_lock(object);
 							object->hdr_chunk =
 							    new_chunk;
 							object->serial =
 							    tags.serial_number;
+							yaffs_obj_wr_unlock(object);
+							yaffs_obj_wr_unlock(object->parent);
 						} else {
 							/* It's a data chunk */
 							int ok;
+							yaffs_obj_wr_lock(object);
 							ok = yaffs_put_chunk_in_file(object, tags.chunk_id, new_chunk, 0);
+							yaffs_obj_wr_unlock(object);
 						}
 					}
 				}
@@ -2715,6 +2833,66 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 	return ret_val;
 }
 
+/*
+ * Background gc has the time to look at every block, so rather than taking
+ * the first block that is dirty enough it picks the best one by
+ * cost-benefit: the space a block frees, weighted by how long its data has
+ * been left alone, against the chunks that have to be copied off it.
+ *
+ *   score = free * age / (chunks_per_block + in_use)
+ *
+ * Old data is cold data and is unlikely to be rewritten soon after being
+ * copied.  The age comes from the yaffs2 sequence numbers; yaffs1 has none
+ * and just gets the dirtiest block.
+ */
+#define YAFFS_GC_MAX_AGE	0x3fff
+
+static unsigned yaffs_find_bg_gc_block(struct yaffs_dev *dev, int threshold)
+{
+	struct yaffs_block_info *bi = dev->block_info;
+	unsigned selected = 0;
+	u32 best_score = 0;
+	int best_in_use = 0;
+	int in_use;
+	u32 age;
+	u32 score;
+	int b;
+
+	for (b = dev->internal_start_block; b <= dev->internal_end_block;
+	     b++, bi++) {
+		in_use = bi->pages_in_use - bi->soft_del_pages;
+
+		if (bi->block_state != YAFFS_BLOCK_STATE_FULL ||
+		    in_use > threshold ||
+		    in_use >= dev->param.chunks_per_block ||
+		    !yaffs_block_ok_for_gc(dev, bi))
+			continue;
+
+		age = 1;
+		if (dev->param.is_yaffs2) {
+			age = dev->seq_number - bi->seq_number;
+			if (age > YAFFS_GC_MAX_AGE)
+				age = YAFFS_GC_MAX_AGE;
+			age++;
+		}
+
+		/* Scaled up so that yaffs1 scores don't all round to 0 */
+		score = ((dev->param.chunks_per_block - in_use) * age << 6) /
+			(dev->param.chunks_per_block + in_use);
+
+		if (!selected || score > best_score) {
+			selected = b;
+			best_score = score;
+			best_in_use = in_use;
+		}
+	}
+
+	if (selected)
+		dev->gc_pages_in_use = best_in_use;
+
+	return selected;
+}
+
 /*
  * FindBlockForgarbageCollection is used to select the dirtiest block (or close enough)
  * for garbage collection.
@@ -2798,8 +2976,11 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 				iterations = 100;
 		}
 
+		if (background && !aggressive)
+			selected = yaffs_find_bg_gc_block(dev, threshold);
+
 		for (i = 0;
-		     i < iterations &&
+		     !selected && i < iterations &&
 		     (dev->gc_dirtiest < 1 ||
 		      dev->gc_pages_in_use > YAFFS_GC_GOOD_ENOUGH); i++) {
 			dev->gc_block_finder++;
@@ -2822,7 +3003,8 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 			}
 		}
 
-		if (dev->gc_dirtiest > 0 && dev->gc_pages_in_use <= threshold)
+		if (!selected && dev->gc_dirtiest > 0 &&
+		    dev->gc_pages_in_use <= threshold)
 			selected = dev->gc_dirtiest;
 	}
 
@@ -2883,6 +3065,12 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
  * The idea is to help clear out space in a more spread-out manner.
  * Dunno if it really does anything useful.
  */
+static int yaffs_gc_min_erased(struct yaffs_dev *dev)
+{
+	return dev->param.n_reserved_blocks +
+	    yaffs_calc_checkpt_blocks_required(dev) + 1;
+}
+
 static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 {
 	int aggressive = 0;
@@ -2890,9 +3078,14 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 	int max_tries = 0;
 	int min_erased;
 	int erased_chunks;
-	int checkpt_block_adjust;
+	unsigned gc_control = 1;
+	u32 copies_before = dev->n_gc_copies;
+	u32 erasures_before = dev->n_erasures;
 
-	if (dev->param.gc_control && (dev->param.gc_control(dev) & 1) == 0)
+	if (dev->param.gc_control)
+		gc_control = dev->param.gc_control(dev);
+
+	if ((gc_control & 1) == 0)
 		return YAFFS_OK;
 
 	if (dev->gc_disable) {
@@ -2900,6 +3093,8 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 		return YAFFS_OK;
 	}
 
+	yaffs_handle_ecc_errs(dev);
+
 	/* This loop should pass the first time.
 	 * We'll only see looping here if the collection does not increase space.
 	 */
@@ -2907,10 +3102,7 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 	do {
 		max_tries++;
 
-		checkpt_block_adjust = yaffs_calc_checkpt_blocks_required(dev);
-
-		min_erased =
-		    dev->param.n_reserved_blocks + checkpt_block_adjust + 1;
+		min_erased = yaffs_gc_min_erased(dev);
 		erased_chunks =
 		    dev->n_erased_blocks * dev->param.chunks_per_block;
 
@@ -2922,6 +3114,13 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 			    && erased_chunks > (dev->n_free_chunks / 4))
 				break;
 
+			/* Leave passive gc to the background collector
+			 * unless it is falling behind.
+			 */
+			if (!background && (gc_control & 2) &&
+			    dev->n_erased_blocks > min_erased + 1)
+				break;
+
 			if (dev->gc_skip > 20)
 				dev->gc_skip = 20;
 			if (erased_chunks < dev->n_free_chunks / 2 ||
@@ -2971,22 +3170,30 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 	} while ((dev->n_erased_blocks < dev->param.n_reserved_blocks) &&
 		 (dev->gc_block > 0) && (max_tries < 2));
 
+	if (background) {
+		dev->bg_gc_copies += dev->n_gc_copies - copies_before;
+		dev->bg_gc_erasures += dev->n_erasures - erasures_before;
+	} else {
+		dev->fg_gc_copies += dev->n_gc_copies - copies_before;
+		dev->fg_gc_erasures += dev->n_erasures - erasures_before;
+	}
+
 	return aggressive ? gc_ok : YAFFS_OK;
 }
 
 /*
  * yaffs_bg_gc()
- * Garbage collects. Intended to be called from a background thread.
- * Returns non-zero if at least half the free chunks are erased.
+ * Garbage collects. Intended to be called from a background thread, a few
+ * chunks at a time so that foreground operations can get in between calls.
+ * Returns non-zero once at least reserve blocks more than gc itself needs
+ * are erased, ie. when the background thread can slow down again.
  */
-int yaffs_bg_gc(struct yaffs_dev *dev, unsigned urgency)
+int yaffs_bg_gc(struct yaffs_dev *dev, unsigned urgency, int reserve)
 {
-	int erased_chunks = dev->n_erased_blocks * dev->param.chunks_per_block;
-
 	yaffs_trace(YAFFS_TRACE_BACKGROUND, "Background gc %u", urgency);
 
 	yaffs_check_gc(dev, 1);
-	return erased_chunks > dev->n_free_chunks / 2;
+	return dev->n_erased_blocks >= yaffs_gc_min_erased(dev) + reserve;
 }
 
 /*-------------------- Data file manipulation -----------------*/
@@ -3062,6 +3269,8 @@ void yaffs_chunk_del(struct yaffs_dev *dev, int chunk_id, int mark_flash,
 
 		bi->pages_in_use--;
 
+		yaffs_summary_drop_if_unused(dev, block);
+
 		if (bi->pages_in_use == 0 &&
 		    !bi->has_shrink_hdr &&
 		    bi->block_state != YAFFS_BLOCK_STATE_ALLOCATING &&
@@ -3201,11 +3410,10 @@ static int yaffs_do_xattrib_fetch(struct yaffs_obj *obj, const YCHAR * name,
 	/* If we know that the object has no xattribs then don't do all the
 	 * reading and parsing.
 	 */
-	if (obj->xattr_known && !obj->has_xattr) {
-		if (name)
-			return -ENODATA;
-		else
-			return 0;
+	if (obj->xattr_known) {
+		smp_rmb();	/* pairs with smp_wmb() below */
+		if (!obj->has_xattr)
+			return name ? -ENODATA : 0;
 	}
 
 	buffer = (char *)yaffs_get_temp_buffer(dev, __LINE__);
@@ -3221,7 +3429,9 @@ static int yaffs_do_xattrib_fetch(struct yaffs_obj *obj, const YCHAR * name,
 		x_buffer = buffer + x_offs;
 
 		if (!obj->xattr_known) {
+			/* Readers racing here all store the same values */
 			obj->has_xattr = nval_hasvalues(x_buffer, x_size);
+			smp_wmb();
 			obj->xattr_known = 1;
 		}
 
@@ -3270,8 +3480,14 @@ static void yaffs_check_obj_details_loaded(struct yaffs_obj *in)
 
 	dev = in->my_dev;
 
+	if (!in->lazy_loaded || in->hdr_chunk <= 0) {
+		smp_rmb();	/* pairs with smp_wmb() below */
+		return;
+	}
+
+	/* Readers may race to load the same object, only one does it. */
+	mutex_lock(&dev->obj_lock);
 	if (in->lazy_loaded && in->hdr_chunk > 0) {
-		in->lazy_loaded = 0;
 		chunk_data = yaffs_get_temp_buffer(dev, __LINE__);
 
 		result =
@@ -3291,7 +3507,12 @@ static void yaffs_check_obj_details_loaded(struct yaffs_obj *in)
 		}
 
 		yaffs_release_temp_buffer(dev, chunk_data, __LINE__);
+
+		/* Details must be visible before the flag is cleared */
+		smp_wmb();
+		in->lazy_loaded = 0;
 	}
+	mutex_unlock(&dev->obj_lock);
 }
 
 static void yaffs_load_name_from_oh(struct yaffs_dev *dev, YCHAR * name,
@@ -3397,6 +3618,11 @@ int yaffs_update_oh(struct yaffs_obj *in, const YCHAR * name, int force,
 	    force || xmod) {
 
 		yaffs_check_gc(dev, 0);
+
+		/* Lookups in the parent may read the old header's name */
+		yaffs_obj_wr_lock(in->parent);
+		yaffs_obj_wr_lock(in);
+
 		yaffs_check_obj_details_loaded(in);
 
 		buffer = yaffs_get_temp_buffer(in->my_dev, __LINE__);
@@ -3518,6 +3744,9 @@ int yaffs_update_oh(struct yaffs_obj *in, const YCHAR * name, int force,
 
 		}
 
+		yaffs_obj_wr_unlock(in);
+		yaffs_obj_wr_unlock(in->parent);
+
 		ret_val = new_chunk_id;
 
 	}
@@ -3538,6 +3767,12 @@ int yaffs_update_oh(struct yaffs_obj *in, const YCHAR * name, int force,
  * Curve-balls: the first chunk might also be the last chunk.
  */
 
+/*
+ * yaffs_file_rd() is called with only the object's lock held shared, so
+ * other readers and the writer may be running.  It must therefore leave
+ * the short op cache alone: chunks already in the cache are copied out of
+ * it, everything else is read straight from flash.
+ */
 int yaffs_file_rd(struct yaffs_obj *in, u8 * buffer, loff_t offset, int n_bytes)
 {
 
@@ -3568,48 +3803,21 @@ int yaffs_file_rd(struct yaffs_obj *in, u8 * buffer, loff_t offset, int n_bytes)
 
 		cache = yaffs_find_chunk_cache(in, chunk);
 
-		/* If the chunk is already in the cache or it is less than a whole chunk
-		 * or we're using inband tags then use the cache (if there is caching)
-		 * else bypass the cache.
-		 */
-		if (cache || n_copy != dev->data_bytes_per_chunk
-		    || dev->param.inband_tags) {
-			if (dev->param.n_caches > 0) {
+		if (cache) {
+			/* The cache may hold data not yet written to flash. */
+			memcpy(buffer, &cache->data[start], n_copy);
+		} else if (n_copy != dev->data_bytes_per_chunk
+			   || dev->param.inband_tags) {
+			/* Read into the local buffer then copy.. */
 
-				/* If we can't find the data in the cache, then load it up. */
+			u8 *local_buffer =
+			    yaffs_get_temp_buffer(dev, __LINE__);
+			yaffs_rd_data_obj(in, chunk, local_buffer);
 
-				if (!cache) {
-					cache =
-					    yaffs_grab_chunk_cache(in->my_dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_rd_data_obj(in, chunk,
-							  cache->data);
-					cache->n_bytes = 0;
-				}
-
-				yaffs_use_cache(dev, cache, 0);
-
-				cache->locked = 1;
-
-				memcpy(buffer, &cache->data[start], n_copy);
-
-				cache->locked = 0;
-			} else {
-				/* Read into the local buffer then copy.. */
-
-				u8 *local_buffer =
-				    yaffs_get_temp_buffer(dev, __LINE__);
-				yaffs_rd_data_obj(in, chunk, local_buffer);
-
-				memcpy(buffer, &local_buffer[start], n_copy);
-
-				yaffs_release_temp_buffer(dev, local_buffer,
-							  __LINE__);
-			}
+			memcpy(buffer, &local_buffer[start], n_copy);
 
+			yaffs_release_temp_buffer(dev, local_buffer,
+						  __LINE__);
 		} else {
 
 			/* A full chunk. Read directly into the supplied buffer. */
@@ -3801,8 +4009,14 @@ int yaffs_do_file_wr(struct yaffs_obj *in, const u8 * buffer, loff_t offset,
 int yaffs_wr_file(struct yaffs_obj *in, const u8 * buffer, loff_t offset,
 		  int n_bytes, int write_trhrough)
 {
+	int n_done;
+
+	yaffs_obj_wr_lock(in);
 	yaffs2_handle_hole(in, offset);
-	return yaffs_do_file_wr(in, buffer, offset, n_bytes, write_trhrough);
+	n_done = yaffs_do_file_wr(in, buffer, offset, n_bytes, write_trhrough);
+	yaffs_obj_wr_unlock(in);
+
+	return n_done;
 }
 
 /* ---------------------- File resizing stuff ------------------ */
@@ -3879,7 +4093,7 @@ void yaffs_resize_file_down(struct yaffs_obj *obj, loff_t new_size)
 	yaffs_prune_tree(dev, &obj->variant.file_variant);
 }
 
-int yaffs_resize_file(struct yaffs_obj *in, loff_t new_size)
+static int yaffs_do_resize_file(struct yaffs_obj *in, loff_t new_size)
 {
 	struct yaffs_dev *dev = in->my_dev;
 	int old_size = in->variant.file_variant.file_size;
@@ -3917,6 +4131,17 @@ int yaffs_resize_file(struct yaffs_obj *in, loff_t new_size)
 	return YAFFS_OK;
 }
 
+int yaffs_resize_file(struct yaffs_obj *in, loff_t new_size)
+{
+	int ret_val;
+
+	yaffs_obj_wr_lock(in);
+	ret_val = yaffs_do_resize_file(in, new_size);
+	yaffs_obj_wr_unlock(in);
+
+	return ret_val;
+}
+
 int yaffs_flush_file(struct yaffs_obj *in, int update_time, int data_sync)
 {
 	int ret_val;
@@ -4776,6 +5001,12 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 		return YAFFS_FAIL;
 	}
 
+	spin_lock_init(&dev->temp_lock);
+	mutex_init(&dev->nand_lock);
+	mutex_init(&dev->obj_lock);
+	dev->n_obj_locked = 0;
+	dev->n_ecc_errs = 0;
+
 	dev->internal_start_block = dev->param.start_block;
 	dev->internal_end_block = dev->param.end_block;
 	dev->block_offset = 0;
@@ -4916,6 +5147,10 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	dev->passive_gc_count = 0;
 	dev->oldest_dirty_gc_count = 0;
 	dev->bg_gcs = 0;
+	dev->fg_gc_copies = 0;
+	dev->bg_gc_copies = 0;
+	dev->fg_gc_erasures = 0;
+	dev->bg_gc_erasures = 0;
 	dev->gc_block_finder = 0;
 	dev->buffered_block = -1;
 	dev->doing_buffered_block_rewrite = 0;
@@ -4983,6 +5218,9 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	if (dev->param.is_yaffs2)
 		dev->param.use_header_file_size = 1;
 
+	if (!init_failed && !yaffs_summary_init(dev))
+		init_failed = 1;
+
 	if (!init_failed && !yaffs_init_blocks(dev))
 		init_failed = 1;
 
@@ -5089,6 +5327,7 @@ void yaffs_deinitialise(struct yaffs_dev *dev)
 		}
 
 		kfree(dev->gc_cleanup_list);
+		yaffs_summary_deinit(dev);
 
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
 			kfree(dev->temp_buffer[i].buffer);
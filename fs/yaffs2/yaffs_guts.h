@@ -60,7 +60,7 @@
 #define YAFFS_OBJECT_SPACE		0x40000
 #define YAFFS_MAX_OBJECT_ID		(YAFFS_OBJECT_SPACE -1)
 
-#define YAFFS_CHECKPOINT_VERSION 	4
+#define YAFFS_CHECKPOINT_VERSION 	5
 
 #ifdef CONFIG_YAFFS_UNICODE
 #define YAFFS_MAX_NAME_LENGTH		127
@@ -83,10 +83,15 @@
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
+/* Pseudo object id for block summary chunks */
+#define YAFFS_OBJECTID_SUMMARY		0x30
+
 #define YAFFS_MAX_SHORT_OP_CACHES	20
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
+#define YAFFS_N_ECC_ERRS		8
+
 /* We limit the number attempts at sucessfully saving a chunk of data.
  * Small-page devices have 32 pages per block; large-page devices have 64.
  * Default to something in the order of 5 to 10 blocks worth of chunks.
@@ -281,6 +286,7 @@ struct yaffs_block_info {
 
 #ifdef CONFIG_YAFFS_YAFFS2
 	u32 has_shrink_hdr:1;	/* This block has at least one shrink object header */
+	u32 has_summary:1;	/* The summary chunks of this block are in use */
 	u32 seq_number;		/* block sequence number for yaffs2 */
 #endif
 
@@ -387,7 +393,6 @@ struct yaffs_obj {
 				 * object might be created before the data
 				 * is available (ie. file data records appear before the header).
 				 */
-	u8 lazy_loaded:1;	/* This object has been lazy loaded and is missing some detail */
 
 	u8 defered_free:1;	/* For Linux kernel. Object is removed from NAND, but is
 				 * still in the inode cache. Free of object is defered.
@@ -396,12 +401,19 @@ struct yaffs_obj {
 	u8 being_created:1;	/* This object is still being created so skip some checks. */
 	u8 is_shadowed:1;	/* This object is shadowed on the way to being renamed. */
 
-	u8 xattr_known:1;	/* We know if this has object has xattribs or not. */
-	u8 has_xattr:1;		/* This object has xattribs. Valid if xattr_known. */
+	/* Readers set these without the gross lock, so they must not share
+	 * a byte with the flags above.
+	 */
+	u8 lazy_loaded;		/* This object has been lazy loaded and is missing some detail */
+	u8 xattr_known;		/* We know if this has object has xattribs or not. */
+	u8 has_xattr;		/* This object has xattribs. Valid if xattr_known. */
 
 	u8 serial;		/* serial number of chunk in NAND. Cached here */
 	u16 sum;		/* sum of the name to speed searching */
 
+	struct rw_semaphore lock;	/* See yaffs_obj_rd_lock() */
+	u8 lock_depth;		/* Recursion count of the writer's exclusive hold */
+
 	struct yaffs_dev *my_dev;	/* The device I'm on */
 
 	struct list_head hash_link;	/* list of objects in this hash bucket */
@@ -524,6 +536,8 @@ struct yaffs_param {
 
 	int enable_xattr;	/* Enable xattribs */
 
+	int disable_summary;	/* yaffs2 only: don't write block summaries */
+
 	/* NAND access functions (Must be set before calling YAFFS) */
 
 	int (*write_chunk_fn) (struct yaffs_dev * dev,
@@ -559,7 +573,11 @@ struct yaffs_param {
 	/* Callback to mark the superblock dirty */
 	void (*sb_dirty_fn) (struct yaffs_dev * dev);
 
-	/*  Callback to control garbage collection. */
+	/*  Callback to control garbage collection.
+	 *  Bit 0: gc is allowed.
+	 *  Bit 1: a background collector is keeping erased blocks in reserve,
+	 *         so writers only collect when they are about to run out.
+	 */
 	unsigned (*gc_control) (struct yaffs_dev * dev);
 
 	/* Debug control flags. Don't use unless you know what you're doing */
@@ -695,6 +713,19 @@ struct yaffs_dev {
 	int n_unlinked_files;	/* Count of unlinked files. */
 	int n_bg_deletions;	/* Count of background deletions. */
 
+	/* Locks for state shared with readers that do not hold the OS layer's
+	 * gross lock.  Anything that modifies the file system is still
+	 * serialised by the gross lock, see yaffs_obj_rd_lock().
+	 */
+	spinlock_t temp_lock;		/* temp_buffer[] and its counters */
+	struct mutex nand_lock;		/* Flash reads and ecc_err_blocks[] */
+	struct mutex obj_lock;		/* Lazy loading */
+	int n_obj_locked;		/* Objects the writer holds exclusively */
+
+	/* Blocks that failed ECC on read, handled by the next gc check */
+	int ecc_err_blocks[YAFFS_N_ECC_ERRS];
+	int n_ecc_errs;
+
 	/* Temporary buffer management */
 	struct yaffs_buffer temp_buffer[YAFFS_N_TEMP_BUFFERS];
 	int max_temp;
@@ -707,6 +738,10 @@ struct yaffs_dev {
 	unsigned oldest_dirty_seq;
 	unsigned oldest_dirty_block;
 
+	/* Block summaries, see yaffs_summary.c */
+	int chunks_per_summary;	/* Data chunks per block, the rest hold the summary */
+	struct yaffs_summary_tags *sum_tags;	/* Summary of the allocation block */
+
 	/* Block refreshing */
 	int refresh_skip;	/* A skip down counter. Refresh happens when this gets to zero. */
 
@@ -724,6 +759,10 @@ struct yaffs_dev {
 	u32 oldest_dirty_gc_count;
 	u32 n_gc_blocks;
 	u32 bg_gcs;
+	u32 fg_gc_copies;	/* Chunks copied by gc in the write path */
+	u32 bg_gc_copies;	/* Chunks copied by background gc */
+	u32 fg_gc_erasures;	/* Blocks erased by gc in the write path */
+	u32 bg_gc_erasures;	/* Blocks erased by background gc */
 	u32 n_retired_writes;
 	u32 n_retired_blocks;
 	u32 n_ecc_fixed;
@@ -734,6 +773,8 @@ struct yaffs_dev {
 	u32 n_unmarked_deletions;
 	u32 refresh_count;
 	u32 cache_hits;
+	u32 summary_used;	/* Blocks scanned from their summary */
+	u32 tags_used;		/* Blocks scanned chunk by chunk */
 
 };
 
@@ -854,9 +895,13 @@ struct yaffs_obj *yaffs_lost_n_found(struct yaffs_dev *dev);
 
 void yaffs_handle_defered_free(struct yaffs_obj *obj);
 
+/* Locking for readers that do not hold the gross lock */
+void yaffs_obj_rd_lock(struct yaffs_obj *obj);
+void yaffs_obj_rd_unlock(struct yaffs_obj *obj);
+
 void yaffs_update_dirty_dirs(struct yaffs_dev *dev);
 
-int yaffs_bg_gc(struct yaffs_dev *dev, unsigned urgency);
+int yaffs_bg_gc(struct yaffs_dev *dev, unsigned urgency, int reserve);
 
 /* Debug dump  */
 int yaffs_dump_obj(struct yaffs_obj *obj);
@@ -25,6 +25,9 @@ int yaffs_rd_chunk_tags_nand(struct yaffs_dev *dev, int nand_chunk,
 
 	int realigned_chunk = nand_chunk - dev->chunk_offset;
 
+	/* Readers can get here concurrently, see struct yaffs_dev */
+	mutex_lock(&dev->nand_lock);
+
 	dev->n_page_reads++;
 
 	/* If there are no tags provided, use local tags to get prioritised gc working */
@@ -39,14 +42,22 @@ int yaffs_rd_chunk_tags_nand(struct yaffs_dev *dev, int nand_chunk,
 		result = yaffs_tags_compat_rd(dev,
 					      realigned_chunk, buffer, tags);
 	if (tags && tags->ecc_result > YAFFS_ECC_RESULT_NO_ERROR) {
-
-		struct yaffs_block_info *bi;
-		bi = yaffs_get_block_info(dev,
-					  nand_chunk /
-					  dev->param.chunks_per_block);
-		yaffs_handle_chunk_error(dev, bi);
+		/* The caller may be a reader without the gross lock, which must
+		 * not touch block info.  Queue the block for the next gc check,
+		 * if the queue is full the error will be seen again on reread.
+		 */
+		int block = nand_chunk / dev->param.chunks_per_block;
+		int i;
+
+		for (i = 0; i < dev->n_ecc_errs; i++)
+			if (dev->ecc_err_blocks[i] == block)
+				break;
+		if (i == dev->n_ecc_errs && i < YAFFS_N_ECC_ERRS)
+			dev->ecc_err_blocks[dev->n_ecc_errs++] = block;
 	}
 
+	mutex_unlock(&dev->nand_lock);
+
 	return result;
 }
 
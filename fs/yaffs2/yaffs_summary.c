@@ -0,0 +1,328 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * Copyright (C) 2002-2010 Aleph One Ltd.
+ *   for Toby Churchill Ltd and Brightstar Engineering
+ *
+ * Created by Charles Manning <charles@aleph1.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Block summaries.
+ *
+ * While a block is being allocated from, the tags of each chunk written
+ * to it are collected in dev->sum_tags.  When the last data chunk of the
+ * block (chunks_per_summary - 1) has been written, the collected tags are
+ * written into the remaining chunks of the block, each prefixed with a
+ * header that ties the summary to the block and its sequence number.
+ *
+ * The summary chunks are counted as in use so that the free chunk
+ * accounting stays exact.  They are released when the block is garbage
+ * collected, or when every other chunk in the block has been deleted.
+ *
+ * A block without a valid summary (partially written, written with
+ * summaries disabled, or by an older yaffs) is scanned chunk by chunk
+ * as before, and the scanner ignores any stray summary chunks in it.
+ */
+
+#include "yaffs_summary.h"
+#include "yaffs_packedtags2.h"
+#include "yaffs_nand.h"
+#include "yaffs_tagsvalidity.h"
+#include "yaffs_getblockinfo.h"
+#include "yaffs_bitmap.h"
+#include "yaffs_trace.h"
+
+struct yaffs_summary_header {
+	unsigned version;	/* Must match YAFFS_SUMMARY_VERSION */
+	unsigned block;		/* Must be this block */
+	unsigned seq;		/* Must be this block's sequence number */
+	unsigned sum;		/* Byte sum of the summary tags */
+};
+
+static unsigned yaffs_summary_sum(struct yaffs_dev *dev,
+				  struct yaffs_summary_tags *st)
+{
+	u8 *p = (u8 *) st;
+	int n = dev->chunks_per_summary * sizeof(struct yaffs_summary_tags);
+	unsigned sum = 0;
+
+	while (n-- > 0)
+		sum += *p++;
+
+	return sum;
+}
+
+int yaffs_summary_init(struct yaffs_dev *dev)
+{
+	int sum_bytes;
+	int chunks_used;
+
+	dev->chunks_per_summary = dev->param.chunks_per_block;
+	dev->sum_tags = NULL;
+
+	if (!dev->param.is_yaffs2 || dev->param.disable_summary)
+		return YAFFS_OK;
+
+	sum_bytes = dev->param.chunks_per_block *
+	    sizeof(struct yaffs_summary_tags);
+	chunks_used = (sum_bytes + dev->data_bytes_per_chunk - 1) /
+	    (dev->data_bytes_per_chunk - sizeof(struct yaffs_summary_header));
+
+	/* Not worth it if the summary eats a big part of each block */
+	if (chunks_used * 4 > dev->param.chunks_per_block) {
+		yaffs_trace(YAFFS_TRACE_ALWAYS,
+			"yaffs: block summaries disabled, blocks too small");
+		return YAFFS_OK;
+	}
+
+	dev->chunks_per_summary = dev->param.chunks_per_block - chunks_used;
+	dev->sum_tags = kmalloc(dev->chunks_per_summary *
+				sizeof(struct yaffs_summary_tags), GFP_NOFS);
+	if (!dev->sum_tags) {
+		dev->chunks_per_summary = dev->param.chunks_per_block;
+		return YAFFS_FAIL;
+	}
+
+	yaffs_summary_clear(dev);
+
+	return YAFFS_OK;
+}
+
+void yaffs_summary_deinit(struct yaffs_dev *dev)
+{
+	kfree(dev->sum_tags);
+	dev->sum_tags = NULL;
+	dev->chunks_per_summary = dev->param.chunks_per_block;
+}
+
+void yaffs_summary_clear(struct yaffs_dev *dev)
+{
+	if (dev->sum_tags)
+		memset(dev->sum_tags, 0, dev->chunks_per_summary *
+		       sizeof(struct yaffs_summary_tags));
+}
+
+static int yaffs_summary_write(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	struct yaffs_summary_header hdr;
+	struct yaffs_ext_tags tags;
+	int sum_bytes_per_chunk = dev->data_bytes_per_chunk - sizeof(hdr);
+	u8 *sum_buffer = (u8 *) dev->sum_tags;
+	int n_bytes = dev->chunks_per_summary *
+	    sizeof(struct yaffs_summary_tags);
+	int chunk_in_block = dev->chunks_per_summary;
+	int result = YAFFS_OK;
+	int this_tx;
+	u8 *buffer;
+
+	hdr.version = YAFFS_SUMMARY_VERSION;
+	hdr.block = blk;
+	hdr.seq = bi->seq_number;
+	hdr.sum = yaffs_summary_sum(dev, dev->sum_tags);
+
+	buffer = yaffs_get_temp_buffer(dev, __LINE__);
+
+	yaffs_init_tags(&tags);
+	tags.obj_id = YAFFS_OBJECTID_SUMMARY;
+	tags.chunk_id = 1;
+
+	while (n_bytes > 0 && chunk_in_block < dev->param.chunks_per_block) {
+		this_tx = min(n_bytes, sum_bytes_per_chunk);
+
+		memset(buffer, 0xff, dev->data_bytes_per_chunk);
+		memcpy(buffer, &hdr, sizeof(hdr));
+		memcpy(buffer + sizeof(hdr), sum_buffer, this_tx);
+		tags.n_bytes = this_tx + sizeof(hdr);
+
+		result = yaffs_wr_chunk_tags_nand(dev,
+				blk * dev->param.chunks_per_block +
+				chunk_in_block, buffer, &tags);
+		if (result != YAFFS_OK)
+			break;
+
+		yaffs_set_chunk_bit(dev, blk, chunk_in_block);
+		bi->pages_in_use++;
+		dev->n_free_chunks--;
+
+		n_bytes -= this_tx;
+		sum_buffer += this_tx;
+		chunk_in_block++;
+		tags.chunk_id++;
+	}
+
+	yaffs_release_temp_buffer(dev, buffer, __LINE__);
+
+	if (result == YAFFS_OK && n_bytes == 0) {
+		bi->has_summary = 1;
+		return YAFFS_OK;
+	}
+
+	/* Give back what got written, the scan will ignore it */
+	yaffs_trace(YAFFS_TRACE_ERROR,
+		"yaffs: failed to write summary for block %d", blk);
+	bi->has_summary = 1;
+	yaffs_summary_gc(dev, blk);
+
+	return YAFFS_FAIL;
+}
+
+/*
+ * Record the tags of a chunk that has just been written.  If it was the
+ * last data chunk of its block, write the block summary out.
+ */
+void yaffs_summary_add(struct yaffs_dev *dev, struct yaffs_ext_tags *tags,
+		       int chunk_in_nand)
+{
+	struct yaffs_packed_tags2_tags_only tags_only;
+	struct yaffs_summary_tags *st;
+	int blk = chunk_in_nand / dev->param.chunks_per_block;
+	int chunk_in_block = chunk_in_nand % dev->param.chunks_per_block;
+
+	if (!dev->sum_tags || chunk_in_block >= dev->chunks_per_summary)
+		return;
+
+	yaffs_pack_tags2_tags_only(&tags_only, tags);
+	st = &dev->sum_tags[chunk_in_block];
+	st->obj_id = tags_only.obj_id;
+	st->chunk_id = tags_only.chunk_id;
+	st->n_bytes = tags_only.n_bytes;
+
+	if (chunk_in_block == dev->chunks_per_summary - 1) {
+		yaffs_summary_write(dev, blk);
+		yaffs_summary_clear(dev);
+	}
+}
+
+/*
+ * Read and validate the summary of a block into st.
+ * Returns YAFFS_OK only if the whole summary is intact.
+ */
+int yaffs_summary_read(struct yaffs_dev *dev, struct yaffs_summary_tags *st,
+		       int blk)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	struct yaffs_summary_header hdr;
+	struct yaffs_ext_tags tags;
+	int sum_bytes_per_chunk = dev->data_bytes_per_chunk - sizeof(hdr);
+	u8 *sum_buffer = (u8 *) st;
+	int n_bytes = dev->chunks_per_summary *
+	    sizeof(struct yaffs_summary_tags);
+	int chunk_in_block = dev->chunks_per_summary;
+	int ok = 1;
+	int this_tx;
+	u8 *buffer;
+
+	if (!dev->sum_tags)
+		return YAFFS_FAIL;
+
+	buffer = yaffs_get_temp_buffer(dev, __LINE__);
+
+	while (ok && n_bytes > 0 &&
+	       chunk_in_block < dev->param.chunks_per_block) {
+		this_tx = min(n_bytes, sum_bytes_per_chunk);
+
+		yaffs_rd_chunk_tags_nand(dev,
+			blk * dev->param.chunks_per_block + chunk_in_block,
+			buffer, &tags);
+		memcpy(&hdr, buffer, sizeof(hdr));
+
+		ok = tags.chunk_used &&
+		    tags.ecc_result != YAFFS_ECC_RESULT_UNFIXED &&
+		    tags.obj_id == YAFFS_OBJECTID_SUMMARY &&
+		    tags.chunk_id == chunk_in_block - dev->chunks_per_summary + 1 &&
+		    tags.n_bytes == this_tx + sizeof(hdr) &&
+		    tags.seq_number == bi->seq_number &&
+		    hdr.version == YAFFS_SUMMARY_VERSION &&
+		    hdr.block == blk && hdr.seq == bi->seq_number;
+
+		if (ok)
+			memcpy(sum_buffer, buffer + sizeof(hdr), this_tx);
+
+		n_bytes -= this_tx;
+		sum_buffer += this_tx;
+		chunk_in_block++;
+	}
+
+	yaffs_release_temp_buffer(dev, buffer, __LINE__);
+
+	if (ok && (n_bytes || hdr.sum != yaffs_summary_sum(dev, st)))
+		ok = 0;
+
+	return ok ? YAFFS_OK : YAFFS_FAIL;
+}
+
+/*
+ * Turn a summary entry back into tags, as they would have been read from
+ * the chunk.  Entries for chunks that were never written come back with
+ * YAFFS_FAIL so that the caller reads the tags from flash instead.
+ */
+int yaffs_summary_fetch(struct yaffs_dev *dev, struct yaffs_summary_tags *st,
+			struct yaffs_ext_tags *tags, int chunk_in_block,
+			u32 seq_number)
+{
+	struct yaffs_packed_tags2_tags_only tags_only;
+
+	if (chunk_in_block < 0 || chunk_in_block >= dev->chunks_per_summary ||
+	    !st[chunk_in_block].obj_id)
+		return YAFFS_FAIL;
+
+	tags_only.seq_number = seq_number;
+	tags_only.obj_id = st[chunk_in_block].obj_id;
+	tags_only.chunk_id = st[chunk_in_block].chunk_id;
+	tags_only.n_bytes = st[chunk_in_block].n_bytes;
+	yaffs_unpack_tags2_tags_only(tags, &tags_only);
+
+	return YAFFS_OK;
+}
+
+/* Account for the summary chunks of a block scanned from its summary. */
+void yaffs_summary_claim(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	int i;
+
+	for (i = dev->chunks_per_summary; i < dev->param.chunks_per_block; i++) {
+		yaffs_set_chunk_bit(dev, blk, i);
+		bi->pages_in_use++;
+	}
+	bi->has_summary = 1;
+}
+
+/* Release the summary chunks of a block that is being collected. */
+void yaffs_summary_gc(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	int i;
+
+	if (!bi->has_summary)
+		return;
+
+	for (i = dev->chunks_per_summary; i < dev->param.chunks_per_block; i++) {
+		if (yaffs_check_chunk_bit(dev, blk, i)) {
+			yaffs_clear_chunk_bit(dev, blk, i);
+			bi->pages_in_use--;
+			dev->n_free_chunks++;
+		}
+	}
+	bi->has_summary = 0;
+}
+
+/*
+ * Once nothing but the summary is left in use in a block, release the
+ * summary so that the block is seen as dirty and gets erased.
+ */
+void yaffs_summary_drop_if_unused(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+
+	if (bi->has_summary &&
+	    bi->pages_in_use ==
+	    dev->param.chunks_per_block - dev->chunks_per_summary)
+		yaffs_summary_gc(dev, blk);
+}
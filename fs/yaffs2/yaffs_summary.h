@@ -0,0 +1,53 @@
+/*
+ * YAFFS: Yet another Flash File System . A NAND-flash specific file system.
+ *
+ * Copyright (C) 2002-2010 Aleph One Ltd.
+ *   for Toby Churchill Ltd and Brightstar Engineering
+ *
+ * Created by Charles Manning <charles@aleph1.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1 as
+ * published by the Free Software Foundation.
+ *
+ * Note: Only YAFFS headers are LGPL, YAFFS C code is covered by GPL.
+ */
+
+/*
+ * Block summaries (yaffs2 only).
+ *
+ * The last chunk(s) of each block hold a copy of the tags of every
+ * other chunk in that block, so that a scan can get a whole block's
+ * worth of tags from one or two reads instead of one read per chunk.
+ */
+
+#ifndef __YAFFS_SUMMARY_H__
+#define __YAFFS_SUMMARY_H__
+
+#include "yaffs_guts.h"
+
+#define YAFFS_SUMMARY_VERSION	1
+
+/* The packed tags of one chunk, without sequence number or ecc */
+struct yaffs_summary_tags {
+	unsigned obj_id;
+	unsigned chunk_id;
+	unsigned n_bytes;
+};
+
+int yaffs_summary_init(struct yaffs_dev *dev);
+void yaffs_summary_deinit(struct yaffs_dev *dev);
+void yaffs_summary_clear(struct yaffs_dev *dev);
+
+void yaffs_summary_add(struct yaffs_dev *dev, struct yaffs_ext_tags *tags,
+		       int chunk_in_nand);
+int yaffs_summary_read(struct yaffs_dev *dev, struct yaffs_summary_tags *st,
+		       int blk);
+int yaffs_summary_fetch(struct yaffs_dev *dev, struct yaffs_summary_tags *st,
+			struct yaffs_ext_tags *tags, int chunk_in_block,
+			u32 seq_number);
+void yaffs_summary_claim(struct yaffs_dev *dev, int blk);
+void yaffs_summary_gc(struct yaffs_dev *dev, int blk);
+void yaffs_summary_drop_if_unused(struct yaffs_dev *dev, int blk);
+
+#endif
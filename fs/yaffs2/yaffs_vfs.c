@@ -97,6 +97,8 @@ unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
+unsigned int yaffs_bg_gc_reserve = 4;
+unsigned int yaffs_bg_checkpoint = 0;	/* idle seconds, 0 is off */
 
 /* Module Parameters */
 module_param(yaffs_trace_mask, uint, 0644);
@@ -104,6 +106,8 @@ module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_bg_gc_reserve, uint, 0644);
+module_param(yaffs_bg_checkpoint, uint, 0644);
 
 
 #define yaffs_inode_to_obj_lv(iptr) ((iptr)->i_private)
@@ -118,14 +122,32 @@ module_param(yaffs_bg_enable, uint, 0644);
 
 static unsigned yaffs_gc_control_callback(struct yaffs_dev *dev)
 {
-	return yaffs_gc_control;
+	unsigned control = yaffs_gc_control;
+
+	/* Tell the writers that the background thread keeps a reserve */
+	if (yaffs_bg_enable && yaffs_dev_to_lc(dev)->bg_running)
+		control |= 2;
+
+	return control;
 }
 
+/*
+ * Locking.
+ *
+ * Anything that changes the file system, including gc and checkpointing,
+ * takes the gross lock.  Operations that only read file data or object
+ * details (readpage, lookup, symlinks, xattr reads) do not: they hold the
+ * lock of the object they read shared, so they run in parallel with each
+ * other and only wait for writes and gc that touch that same object.  See
+ * yaffs_obj_rd_lock() in the guts.
+ */
 static void yaffs_gross_lock(struct yaffs_dev *dev)
 {
 	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locking %p", current);
 	mutex_lock(&(yaffs_dev_to_lc(dev)->gross_lock));
 	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locked %p", current);
+	if (current != yaffs_dev_to_lc(dev)->bg_thread)
+		yaffs_dev_to_lc(dev)->last_fg_op = jiffies;
 }
 
 static void yaffs_gross_unlock(struct yaffs_dev *dev)
@@ -134,6 +156,23 @@ static void yaffs_gross_unlock(struct yaffs_dev *dev)
 	mutex_unlock(&(yaffs_dev_to_lc(dev)->gross_lock));
 }
 
+static void yaffs_obj_lock_shared(struct yaffs_obj *obj)
+{
+	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locking object %d shared %p",
+		obj->obj_id, current);
+	yaffs_obj_rd_lock(obj);
+	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locked object %d shared %p",
+		obj->obj_id, current);
+	yaffs_dev_to_lc(obj->my_dev)->last_fg_op = jiffies;
+}
+
+static void yaffs_obj_unlock_shared(struct yaffs_obj *obj)
+{
+	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs unlocking object %d shared %p",
+		obj->obj_id, current);
+	yaffs_obj_rd_unlock(obj);
+}
+
 static void yaffs_fill_inode_from_obj(struct inode *inode,
 				      struct yaffs_obj *obj);
 
@@ -371,22 +410,23 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry,
 	struct yaffs_obj *obj;
 	struct inode *inode = NULL;
 
-	struct yaffs_dev *dev = yaffs_inode_to_obj(dir)->my_dev;
+	struct yaffs_obj *dir_obj = yaffs_inode_to_obj(dir);
 
-	if (current != yaffs_dev_to_lc(dev)->readdir_process)
-		yaffs_gross_lock(dev);
+	/* Safe from readdir's filldir too, the gross lock holder only
+	 * holds object locks inside the guts.
+	 */
+	yaffs_obj_lock_shared(dir_obj);
 
 	yaffs_trace(YAFFS_TRACE_OS,
 		"yaffs_lookup for %d:%s",
-		yaffs_inode_to_obj(dir)->obj_id, dentry->d_name.name);
+		dir_obj->obj_id, dentry->d_name.name);
 
-	obj = yaffs_find_by_name(yaffs_inode_to_obj(dir), dentry->d_name.name);
+	obj = yaffs_find_by_name(dir_obj, dentry->d_name.name);
 
 	obj = yaffs_get_equivalent_obj(obj);	/* in case it was a hardlink */
 
-	/* Can't hold gross lock when calling yaffs_get_inode() */
-	if (current != yaffs_dev_to_lc(dev)->readdir_process)
-		yaffs_gross_unlock(dev);
+	/* Can't hold any lock when calling yaffs_get_inode() */
+	yaffs_obj_unlock_shared(dir_obj);
 
 	if (obj) {
 		yaffs_trace(YAFFS_TRACE_OS,
@@ -591,7 +631,6 @@ static ssize_t yaffs_getxattr(struct dentry * dentry, const char *name, void *bu
 {
 	struct inode *inode = dentry->d_inode;
 	int error = 0;
-	struct yaffs_dev *dev;
 	struct yaffs_obj *obj = yaffs_inode_to_obj(inode);
 
 	yaffs_trace(YAFFS_TRACE_OS,
@@ -599,10 +638,9 @@ static ssize_t yaffs_getxattr(struct dentry * dentry, const char *name, void *bu
 		name, obj->obj_id);
 
 	if (error == 0) {
-		dev = obj->my_dev;
-		yaffs_gross_lock(dev);
+		yaffs_obj_lock_shared(obj);
 		error = yaffs_get_xattrib(obj, name, buff, size);
-		yaffs_gross_unlock(dev);
+		yaffs_obj_unlock_shared(obj);
 
 	}
 	yaffs_trace(YAFFS_TRACE_OS, "yaffs_getxattr done returning %d", error);
@@ -642,17 +680,15 @@ static ssize_t yaffs_listxattr(struct dentry * dentry, char *buff, size_t size)
 {
 	struct inode *inode = dentry->d_inode;
 	int error = 0;
-	struct yaffs_dev *dev;
 	struct yaffs_obj *obj = yaffs_inode_to_obj(inode);
 
 	yaffs_trace(YAFFS_TRACE_OS,
 		"yaffs_listxattr of object %d", obj->obj_id);
 
 	if (error == 0) {
-		dev = obj->my_dev;
-		yaffs_gross_lock(dev);
+		yaffs_obj_lock_shared(obj);
 		error = yaffs_list_xattrib(obj, buff, size);
-		yaffs_gross_unlock(dev);
+		yaffs_obj_unlock_shared(obj);
 
 	}
 	yaffs_trace(YAFFS_TRACE_OS,
@@ -1019,13 +1055,13 @@ static int yaffs_readlink(struct dentry *dentry, char __user * buffer,
 	unsigned char *alias;
 	int ret;
 
-	struct yaffs_dev *dev = yaffs_dentry_to_obj(dentry)->my_dev;
+	struct yaffs_obj *obj = yaffs_dentry_to_obj(dentry);
 
-	yaffs_gross_lock(dev);
+	yaffs_obj_lock_shared(obj);
 
-	alias = yaffs_get_symlink_alias(yaffs_dentry_to_obj(dentry));
+	alias = yaffs_get_symlink_alias(obj);
 
-	yaffs_gross_unlock(dev);
+	yaffs_obj_unlock_shared(obj);
 
 	if (!alias)
 		return -ENOMEM;
@@ -1039,12 +1075,12 @@ static void *yaffs_follow_link(struct dentry *dentry, struct nameidata *nd)
 {
 	unsigned char *alias;
 	void *ret;
-	struct yaffs_dev *dev = yaffs_dentry_to_obj(dentry)->my_dev;
+	struct yaffs_obj *obj = yaffs_dentry_to_obj(dentry);
 
-	yaffs_gross_lock(dev);
+	yaffs_obj_lock_shared(obj);
 
-	alias = yaffs_get_symlink_alias(yaffs_dentry_to_obj(dentry));
-	yaffs_gross_unlock(dev);
+	alias = yaffs_get_symlink_alias(obj);
+	yaffs_obj_unlock_shared(obj);
 
 	if (!alias) {
 		ret = ERR_PTR(-ENOMEM);
@@ -1133,8 +1169,6 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	unsigned char *pg_buf;
 	int ret;
 
-	struct yaffs_dev *dev;
-
 	yaffs_trace(YAFFS_TRACE_OS,
 		"yaffs_readpage_nolock at %08x, size %08x",
 		(unsigned)(pg->index << PAGE_CACHE_SHIFT),
@@ -1142,19 +1176,17 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 
 	obj = yaffs_dentry_to_obj(f->f_dentry);
 
-	dev = obj->my_dev;
-
 	BUG_ON(!PageLocked(pg));
 
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
-	yaffs_gross_lock(dev);
+	yaffs_obj_lock_shared(obj);
 
 	ret = yaffs_file_rd(obj, pg_buf,
 			    pg->index << PAGE_CACHE_SHIFT, PAGE_CACHE_SIZE);
 
-	yaffs_gross_unlock(dev);
+	yaffs_obj_unlock_shared(obj);
 
 	if (ret >= 0)
 		ret = 0;
@@ -1610,6 +1642,66 @@ static int yaffs_do_sync_fs(struct super_block *sb, int request_checkpoint)
  * The thread should not do any writing while the fs is in read only.
  */
 
+/*
+ * One round of background gc, called with the gross lock held.
+ *
+ * gc works a few chunks at a time.  While no foreground operation has
+ * come in for YAFFS_BG_IDLE, keep going until yaffs_bg_gc_reserve
+ * erased blocks are ready, dropping the lock between steps so that
+ * anyone who turns up does not wait for more than one of them.
+ * Returns non-zero if the reserve is short and gc is still making
+ * progress, ie. the thread should come back soon.
+ */
+#define YAFFS_BG_IDLE		(HZ / 2)
+#define YAFFS_BG_IDLE_STEPS	64
+
+static int yaffs_bg_gc_pass(struct yaffs_dev *dev, unsigned urgency)
+{
+	struct yaffs_linux_context *context = yaffs_dev_to_lc(dev);
+	int steps = 0;
+	int reserve_ok;
+	u32 work;
+
+	for (;;) {
+		work = dev->bg_gc_copies + dev->bg_gc_erasures;
+		reserve_ok = yaffs_bg_gc(dev, urgency, yaffs_bg_gc_reserve);
+		if (work == dev->bg_gc_copies + dev->bg_gc_erasures &&
+		    dev->gc_block < 1)
+			return 0;	/* nothing worth collecting */
+		if (reserve_ok || ++steps >= YAFFS_BG_IDLE_STEPS)
+			break;
+		if (time_before(jiffies, context->last_fg_op + YAFFS_BG_IDLE))
+			break;
+
+		yaffs_gross_unlock(dev);
+		cond_resched();
+		yaffs_gross_lock(dev);
+
+		if (!context->bg_running || kthread_should_stop() ||
+		    dev->is_checkpointed)
+			break;
+	}
+
+	return !reserve_ok;
+}
+
+/*
+ * Write a checkpoint from the background thread, called with the gross
+ * lock held once the file system has been idle for yaffs_bg_checkpoint
+ * seconds and gc has nothing left to do.  Any later write invalidates
+ * it again, but a power cut during a quiet spell no longer means a full
+ * scan at the next mount.
+ */
+static void yaffs_bg_checkpoint_save(struct yaffs_dev *dev)
+{
+	yaffs_trace(YAFFS_TRACE_BACKGROUND | YAFFS_TRACE_CHECKPOINT,
+		"yaffs_background: idle checkpoint");
+
+	yaffs_update_dirty_dirs(dev);
+	yaffs_flush_whole_cache(dev);
+	yaffs_checkpoint_save(dev);
+}
+
 void yaffs_background_waker(unsigned long data)
 {
 	wake_up_process((struct task_struct *)data);
@@ -1622,10 +1714,11 @@ static int yaffs_bg_thread_fn(void *data)
 	unsigned long now = jiffies;
 	unsigned long next_dir_update = now;
 	unsigned long next_gc = now;
+	unsigned long next_checkpt = now;
 	unsigned long expires;
 	unsigned int urgency;
 
-	int gc_result;
+	int gc_more = 0;
 	struct timer_list timer;
 
 	yaffs_trace(YAFFS_TRACE_BACKGROUND,
@@ -1653,8 +1746,8 @@ static int yaffs_bg_thread_fn(void *data)
 		if (time_after(now, next_gc) && yaffs_bg_enable) {
 			if (!dev->is_checkpointed) {
 				urgency = yaffs_bg_gc_urgency(dev);
-				gc_result = yaffs_bg_gc(dev, urgency);
-				if (urgency > 1)
+				gc_more = yaffs_bg_gc_pass(dev, urgency);
+				if (urgency > 1 || gc_more)
 					next_gc = now + HZ / 20 + 1;
 				else if (urgency > 0)
 					next_gc = now + HZ / 10 + 1;
@@ -1668,6 +1761,17 @@ static int yaffs_bg_thread_fn(void *data)
 				next_gc = next_dir_update;
                         }
 		}
+
+		if (yaffs_bg_checkpoint && yaffs_bg_enable &&
+		    !dev->is_checkpointed && !gc_more &&
+		    time_after(now, next_checkpt) &&
+		    time_after(now, context->last_fg_op +
+			       yaffs_bg_checkpoint * HZ) &&
+		    !yaffs_bg_gc_urgency(dev)) {
+			yaffs_bg_checkpoint_save(dev);
+			/* Don't hammer the flash if it keeps failing */
+			next_checkpt = jiffies + yaffs_bg_checkpoint * HZ;
+		}
 		yaffs_gross_unlock(dev);
 		expires = next_dir_update;
 		if (time_before(next_gc, expires))
@@ -1757,6 +1861,7 @@ struct yaffs_options {
 	int inband_tags;
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
+	int summary;
 	int no_cache;
 	int tags_ecc_on;
 	int tags_ecc_overridden;
@@ -1820,6 +1925,10 @@ static int yaffs_parse_options(struct yaffs_options *options,
 		} else if (!strcmp(cur_opt, "no-checkpoint")) {
 			options->skip_checkpoint_read = 1;
 			options->skip_checkpoint_write = 1;
+		} else if (!strcmp(cur_opt, "summary")) {
+			options->summary = 1;
+		} else if (!strcmp(cur_opt, "no-summary")) {
+			options->summary = 0;
 		} else {
 			printk(KERN_INFO "yaffs: Bad mount option \"%s\"\n",
 			       cur_opt);
@@ -2296,6 +2405,7 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 
 	param->skip_checkpt_rd = options.skip_checkpoint_read;
 	param->skip_checkpt_wr = options.skip_checkpoint_write;
+	param->disable_summary = !options.summary;
 
 	mutex_lock(&yaffs_context_lock);
 	/* Get a mount id */
@@ -2442,6 +2552,8 @@ static char *yaffs_dump_dev_part0(char *buf, struct yaffs_dev *dev)
 			param->n_reserved_blocks);
 	buf += sprintf(buf, "always_check_erased... %d\n",
 			param->always_check_erased);
+	buf += sprintf(buf, "disable_summary....... %d\n",
+			param->disable_summary);
 
 	return buf;
 }
@@ -2457,6 +2569,8 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_erased_blocks....... %d\n", dev->n_erased_blocks);
 	buf +=
 	    sprintf(buf, "blocks_in_checkpt..... %d\n", dev->blocks_in_checkpt);
+	buf +=
+	    sprintf(buf, "chunks_per_summary.... %d\n", dev->chunks_per_summary);
 	buf += sprintf(buf, "\n");
 	buf += sprintf(buf, "n_tnodes.............. %d\n", dev->n_tnodes);
 	buf += sprintf(buf, "n_obj................. %d\n", dev->n_obj);
@@ -2474,6 +2588,12 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 		    dev->oldest_dirty_gc_count);
 	buf += sprintf(buf, "n_gc_blocks........... %u\n", dev->n_gc_blocks);
 	buf += sprintf(buf, "bg_gcs................ %u\n", dev->bg_gcs);
+	buf += sprintf(buf, "fg_gc_copies.......... %u\n", dev->fg_gc_copies);
+	buf += sprintf(buf, "bg_gc_copies.......... %u\n", dev->bg_gc_copies);
+	buf +=
+	    sprintf(buf, "fg_gc_erasures........ %u\n", dev->fg_gc_erasures);
+	buf +=
+	    sprintf(buf, "bg_gc_erasures........ %u\n", dev->bg_gc_erasures);
 	buf +=
 	    sprintf(buf, "n_retired_writes...... %u\n", dev->n_retired_writes);
 	buf +=
@@ -2492,6 +2612,8 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_unlinked_files...... %u\n", dev->n_unlinked_files);
 	buf += sprintf(buf, "refresh_count......... %u\n", dev->refresh_count);
 	buf += sprintf(buf, "n_bg_deletions........ %u\n", dev->n_bg_deletions);
+	buf += sprintf(buf, "summary_used.......... %u\n", dev->summary_used);
+	buf += sprintf(buf, "tags_used............. %u\n", dev->tags_used);
 
 	return buf;
 }
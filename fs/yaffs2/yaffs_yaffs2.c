@@ -20,6 +20,7 @@
 #include "yaffs_getblockinfo.h"
 #include "yaffs_verify.h"
 #include "yaffs_attribs.h"
+#include "yaffs_summary.h"
 
 /*
  * Checkpoints are really no benefit on very small partitions.
@@ -225,6 +226,8 @@ int yaffs_calc_checkpt_blocks_required(struct yaffs_dev *dev)
 		n_bytes += sizeof(struct yaffs_checkpt_dev);
 		n_bytes += dev_blocks * sizeof(struct yaffs_block_info);
 		n_bytes += dev_blocks * dev->chunk_bit_stride;
+		n_bytes += sizeof(u32) + dev->param.chunks_per_block *
+		    sizeof(struct yaffs_summary_tags);
 		n_bytes +=
 		    (sizeof(struct yaffs_checkpt_obj) +
 		     sizeof(u32)) * (dev->n_obj);
@@ -312,6 +315,7 @@ static int yaffs2_wr_checkpt_dev(struct yaffs_dev *dev)
 {
 	struct yaffs_checkpt_dev cp;
 	u32 n_bytes;
+	u32 n_sum = 0;
 	u32 n_blocks =
 	    (dev->internal_end_block - dev->internal_start_block + 1);
 
@@ -336,6 +340,18 @@ static int yaffs2_wr_checkpt_dev(struct yaffs_dev *dev)
 		ok = (yaffs2_checkpt_wr(dev, dev->chunk_bits, n_bytes) ==
 		      n_bytes);
 	}
+
+	/* Write the summary collected so far for the allocation block */
+	if (ok) {
+		n_sum = dev->sum_tags ? dev->chunks_per_summary : 0;
+		ok = (yaffs2_checkpt_wr(dev, &n_sum, sizeof(n_sum)) ==
+		      sizeof(n_sum));
+	}
+	if (ok && n_sum) {
+		n_bytes = n_sum * sizeof(struct yaffs_summary_tags);
+		ok = (yaffs2_checkpt_wr(dev, dev->sum_tags, n_bytes) ==
+		      n_bytes);
+	}
 	return ok ? 1 : 0;
 
 }
@@ -344,6 +360,7 @@ static int yaffs2_rd_checkpt_dev(struct yaffs_dev *dev)
 {
 	struct yaffs_checkpt_dev cp;
 	u32 n_bytes;
+	u32 n_sum;
 	u32 n_blocks =
 	    (dev->internal_end_block - dev->internal_start_block + 1);
 
@@ -368,6 +385,21 @@ static int yaffs2_rd_checkpt_dev(struct yaffs_dev *dev)
 
 	ok = (yaffs2_checkpt_rd(dev, dev->chunk_bits, n_bytes) == n_bytes);
 
+	if (!ok)
+		return 0;
+
+	/* The summary layout has to match the one we are mounting with */
+	ok = (yaffs2_checkpt_rd(dev, &n_sum, sizeof(n_sum)) == sizeof(n_sum));
+
+	if (!ok || n_sum != (dev->sum_tags ? dev->chunks_per_summary : 0))
+		return 0;
+
+	if (n_sum) {
+		n_bytes = n_sum * sizeof(struct yaffs_summary_tags);
+		ok = (yaffs2_checkpt_rd(dev, dev->sum_tags, n_bytes) ==
+		      n_bytes);
+	}
+
 	return ok ? 1 : 0;
 }
 
@@ -987,10 +1019,16 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	struct yaffs_block_index *block_index = NULL;
 	int alt_block_index = 0;
 
+	struct yaffs_summary_tags *sum_tags = NULL;
+	int summary_available;
+
 	yaffs_trace(YAFFS_TRACE_SCAN,
 		"yaffs2_scan_backwards starts  intstartblk %d intendblk %d...",
 		dev->internal_start_block, dev->internal_end_block);
 
+	dev->summary_used = 0;
+	dev->tags_used = 0;
+
 	dev->seq_number = YAFFS_LOWEST_SEQUENCE_NUMBER;
 
 	block_index = kmalloc(n_blocks * sizeof(struct yaffs_block_index),
@@ -1011,6 +1049,11 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 	dev->blocks_in_checkpt = 0;
 
+	/* Without this we just fall back to reading every chunk's tags */
+	if (dev->sum_tags)
+		sum_tags = kmalloc(dev->chunks_per_summary *
+				   sizeof(struct yaffs_summary_tags), GFP_NOFS);
+
 	chunk_data = yaffs_get_temp_buffer(dev, __LINE__);
 
 	/* Scan all the blocks to determine their state */
@@ -1102,9 +1145,24 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 		deleted = 0;
 
+		/* If the block has a good summary, take the tags from it
+		 * and skip the summary chunks themselves.
+		 */
+		summary_available = sum_tags &&
+		    yaffs_summary_read(dev, sum_tags, blk) == YAFFS_OK;
+
+		if (summary_available) {
+			yaffs_summary_claim(dev, blk);
+			dev->summary_used++;
+			c = dev->chunks_per_summary - 1;
+		} else {
+			dev->tags_used++;
+			c = dev->param.chunks_per_block - 1;
+		}
+
 		/* For each chunk in each block that needs scanning.... */
 		found_chunks = 0;
-		for (c = dev->param.chunks_per_block - 1;
+		for ( /* c is already set */ ;
 		     !alloc_failed && c >= 0 &&
 		     (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING ||
 		      state == YAFFS_BLOCK_STATE_ALLOCATING); c--) {
@@ -1114,8 +1172,11 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 			chunk = blk * dev->param.chunks_per_block + c;
 
-			result = yaffs_rd_chunk_tags_nand(dev, chunk, NULL,
-							  &tags);
+			if (!summary_available ||
+			    yaffs_summary_fetch(dev, sum_tags, &tags, c,
+						bi->seq_number) != YAFFS_OK)
+				result = yaffs_rd_chunk_tags_nand(dev, chunk,
+								  NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -1178,9 +1239,11 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 			} else if (tags.obj_id > YAFFS_MAX_OBJECT_ID ||
 				   tags.chunk_id > YAFFS_MAX_CHUNK_ID ||
+				   tags.obj_id == YAFFS_OBJECTID_SUMMARY ||
 				   (tags.chunk_id > 0
 				    && tags.n_bytes > dev->data_bytes_per_chunk)
 				   || tags.seq_number != bi->seq_number) {
+				/* Bad tags, or a summary we could not use */
 				yaffs_trace(YAFFS_TRACE_SCAN,
 					"Chunk (%d:%d) with bad tags:obj = %d, chunk_id = %d, n_bytes = %d, ignored",
 					blk, c, tags.obj_id,
@@ -1565,6 +1628,7 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 		bi->block_state = state;
 
 		/* Now let's see if it was dirty */
+		yaffs_summary_drop_if_unused(dev, blk);
 		if (bi->pages_in_use == 0 &&
 		    !bi->has_shrink_hdr &&
 		    bi->block_state == YAFFS_BLOCK_STATE_FULL) {
@@ -1588,11 +1652,14 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	yaffs_link_fixup(dev, hard_list);
 
 	yaffs_release_temp_buffer(dev, chunk_data, __LINE__);
+	kfree(sum_tags);
 
 	if (alloc_failed)
 		return YAFFS_FAIL;
 
-	yaffs_trace(YAFFS_TRACE_SCAN, "yaffs2_scan_backwards ends");
+	yaffs_trace(YAFFS_TRACE_SCAN | YAFFS_TRACE_MOUNT,
+		"yaffs2_scan_backwards ends, %u blocks from summaries, %u scanned by tags",
+		dev->summary_used, dev->tags_used);
 
 	return YAFFS_OK;
 }
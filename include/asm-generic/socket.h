@@ -64,4 +64,7 @@
 #define SO_DOMAIN		39
 
 #define SO_RXQ_OVFL             40
+
+/* Mainline's number, the ones in between are its options we lack */
+#define SO_ZEROCOPY             60
 #endif /* __ASM_GENERIC_SOCKET_H */
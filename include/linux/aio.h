@@ -11,6 +11,7 @@
 
 #define AIO_MAXSEGS		4
 #define AIO_KIOGRP_NR_ATOMIC	8
+#define AIO_EVENTS_BATCH	8	/* events io_getevents pulls at once */
 
 struct kioctx;
 
@@ -234,5 +235,6 @@ static inline struct kiocb *list_kiocb(struct list_head *h)
 /* for sysctl: */
 extern unsigned long aio_nr;
 extern unsigned long aio_max_nr;
+extern int aio_buffered;
 
 #endif /* __LINUX__AIO_H */
@@ -219,6 +219,8 @@ struct dentry_operations {
 #define DCACHE_MANAGED_DENTRY \
 	(DCACHE_MOUNTED|DCACHE_NEED_AUTOMOUNT|DCACHE_MANAGE_TRANSIT)
 
+#define DCACHE_PAR_LOOKUP	0x80000	/* being looked up, see d_alloc_parallel() */
+
 extern seqlock_t rename_lock;
 
 static inline int dname_external(struct dentry *dentry)
@@ -310,6 +312,24 @@ extern struct dentry *__d_lookup(struct dentry *, struct qstr *);
 extern struct dentry *__d_lookup_rcu(struct dentry *parent, struct qstr *name,
 				unsigned *seq, struct inode **inode);
 
+struct in_lookup_bucket;
+
+/* A lookup in progress, see d_alloc_parallel() */
+struct dentry_lookup {
+	struct hlist_node d_node;
+	struct dentry *dentry;
+	struct in_lookup_bucket *bucket;
+};
+
+extern struct dentry *d_alloc_parallel(struct dentry *, struct qstr *,
+				       struct dentry_lookup *);
+extern void d_lookup_done(struct dentry_lookup *);
+
+static inline int d_in_lookup(struct dentry *dentry)
+{
+	return dentry->d_flags & DCACHE_PAR_LOOKUP;
+}
+
 /**
  * __d_rcu_to_refcount - take a refcount on dentry if sequence check is ok
  * @dentry: dentry to take a ref on
@@ -18,6 +18,14 @@ struct sock_extended_err {
 #define SO_EE_ORIGIN_ICMP	2
 #define SO_EE_ORIGIN_ICMP6	3
 #define SO_EE_ORIGIN_TIMESTAMPING 4
+#define SO_EE_ORIGIN_ZEROCOPY	5
+
+/*
+ * MSG_ZEROCOPY completion: the sends numbered ee_info to ee_data (inclusive)
+ * no longer reference user memory.  SO_EE_CODE_ZEROCOPY_COPIED is set when
+ * at least one of them had to be copied after all.
+ */
+#define SO_EE_CODE_ZEROCOPY_COPIED	1
 
 #define SO_EE_OFFENDER(ee)	((struct sockaddr*)((ee)+1))
 
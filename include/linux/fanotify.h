@@ -1,6 +1,7 @@
 #ifndef _LINUX_FANOTIFY_H
 #define _LINUX_FANOTIFY_H
 
+#include <linux/ioctl.h>
 #include <linux/types.h>
 
 /* the following events that user-space can register for */
@@ -106,6 +107,15 @@ struct fanotify_response {
 /* No fd set in event */
 #define FAN_NOFD	-1
 
+/* ioctls on a fanotify group, they work as INOTIFY_IOC_* in inotify.h */
+struct fanotify_queue_stats {
+	__u64 merged;
+	__u64 dropped;
+};
+
+#define FAN_IOC_SETWINDOW	_IOW('F', 1, __u32)
+#define FAN_IOC_GETSTATS	_IOR('F', 2, struct fanotify_queue_stats)
+
 /* Helper functions to deal with fanotify_event_metadata buffers */
 #define FAN_EVENT_METADATA_LEN (sizeof(struct fanotify_event_metadata))
 
@@ -53,6 +53,7 @@ struct files_struct {
    */
 	spinlock_t file_lock ____cacheline_aligned_in_smp;
 	int next_fd;
+	struct list_head fborrowers;	/* tasks that may borrow, see fget_light() */
 	struct embedded_fd_set close_on_exec_init;
 	struct embedded_fd_set open_fds_init;
 	struct file __rcu * fd_array[NR_OPEN_DEFAULT];
@@ -103,6 +104,8 @@ void put_files_struct(struct files_struct *fs);
 void reset_files_struct(struct files_struct *);
 int unshare_files(struct files_struct **);
 struct files_struct *dup_fd(struct files_struct *, int *);
+void files_forget_borrower(struct task_struct *);
+void files_lend_borrowed(struct files_struct *, struct file *);
 
 extern struct kmem_cache *files_cachep;
 
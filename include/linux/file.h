@@ -21,10 +21,16 @@ struct path;
 extern struct file *alloc_file(struct path *, fmode_t mode,
 	const struct file_operations *fop);
 
+/* values of the fput_needed of fget_light() */
+#define FPUT_REF	1	/* a reference was taken */
+#define FPUT_BORROWED	2	/* the file was borrowed */
+
+extern void __fput_light(struct file *file, int fput_needed);
+
 static inline void fput_light(struct file *file, int fput_needed)
 {
 	if (fput_needed)
-		fput(file);
+		__fput_light(file, fput_needed);
 }
 
 extern struct file *fget(unsigned int fd);
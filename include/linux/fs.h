@@ -181,6 +181,7 @@ struct inodes_stat_t {
 #define FS_REQUIRES_DEV 1 
 #define FS_BINARY_MOUNTDATA 2
 #define FS_HAS_SUBTYPE 4
+#define FS_PARALLEL_LOOKUP 8	/* ->lookup may run under i_dir_sem, shared */
 #define FS_REVAL_DOT	16384	/* Check the paths ".", ".." for staleness */
 #define FS_RENAME_DOES_D_MOVE	32768	/* FS will handle d_move()
 					 * during rename() internally.
@@ -279,6 +280,8 @@ struct inodes_stat_t {
 #define IS_PRIVATE(inode)	((inode)->i_flags & S_PRIVATE)
 #define IS_IMA(inode)		((inode)->i_flags & S_IMA)
 #define IS_AUTOMOUNT(inode)	((inode)->i_flags & S_AUTOMOUNT)
+#define IS_PARALLEL_LOOKUP(inode) \
+	((inode)->i_sb->s_type->fs_flags & FS_PARALLEL_LOOKUP)
 
 /* the read-only stuff doesn't really belong here, but any other place is
    probably as bad and I don't want to create yet another include file. */
@@ -650,6 +653,9 @@ struct address_space {
 	struct list_head	private_list;	/* ditto */
 	struct address_space	*assoc_mapping;	/* ditto */
 	struct mutex		unmap_mutex;    /* to protect unmapping */
+#ifdef CONFIG_BLK_DEV_THROTTLING
+	unsigned short		dirtier_blkcg_id; /* blkio cgroup that last dirtied a page */
+#endif
 } __attribute__((aligned(sizeof(long))));
 	/*
 	 * On most architectures that alignment is already the case; but
@@ -776,6 +782,7 @@ struct inode {
 	blkcnt_t		i_blocks;
 	unsigned short          i_bytes;
 	struct rw_semaphore	i_alloc_sem;
+	struct rw_semaphore	i_dir_sem;	/* see FS_PARALLEL_LOOKUP */
 	const struct file_operations	*i_fop;	/* former ->i_op->default_file_ops */
 	struct file_lock	*i_flock;
 	struct address_space	*i_mapping;
@@ -1804,6 +1811,7 @@ struct file_system_type {
 	struct lock_class_key i_mutex_key;
 	struct lock_class_key i_mutex_dir_key;
 	struct lock_class_key i_alloc_sem_key;
+	struct lock_class_key i_dir_sem_key;
 };
 
 extern struct dentry *mount_ns(struct file_system_type *fs_type, int flags,
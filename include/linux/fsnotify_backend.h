@@ -14,6 +14,7 @@
 #include <linux/list.h>
 #include <linux/path.h> /* struct path */
 #include <linux/spinlock.h>
+#include <linux/timer.h>
 #include <linux/types.h>
 
 #include <asm/atomic.h>
@@ -131,6 +132,16 @@ struct fsnotify_group {
 	wait_queue_head_t notification_waitq;	/* read() on the notification file blocks on this waitq */
 	unsigned int q_len;			/* events on the queue */
 	unsigned int max_events;		/* maximum events allowed on the list */
+	/*
+	 * Event coalescing, see fsnotify_set_coalesce_window().  The hash
+	 * finds the last event queued for an object, it is allocated the
+	 * first time a window is set.
+	 */
+	unsigned long coalesce_window;		/* in jiffies, 0 to merge with the last event only */
+	struct hlist_head *notification_hash;	/* event_holders on the queue by object */
+	struct timer_list notification_timer;	/* delayed wakeup of notification_waitq */
+	unsigned long q_merged;			/* events merged into a queued one */
+	unsigned long q_dropped;		/* events lost to queue overflow */
 	/*
 	 * Valid fsnotify group priorities.  Events are send in order from highest
 	 * priority to lowest priority.  We default to the lowest priority.
@@ -189,6 +200,8 @@ struct fsnotify_group {
 struct fsnotify_event_holder {
 	struct fsnotify_event *event;
 	struct list_head event_list;
+	struct hlist_node hash_node;	/* on group->notification_hash */
+	unsigned long queued;		/* jiffies when it was queued */
 };
 
 /*
@@ -376,8 +389,13 @@ extern struct fsnotify_event_private_data *fsnotify_remove_priv_from_event(struc
 extern struct fsnotify_event *fsnotify_add_notify_event(struct fsnotify_group *group,
 							struct fsnotify_event *event,
 							struct fsnotify_event_private_data *priv,
-							struct fsnotify_event *(*merge)(struct list_head *,
+							struct fsnotify_event *(*merge)(struct fsnotify_group *,
 											struct fsnotify_event *));
+/* find the queued event a new event may be merged into */
+extern struct fsnotify_event_holder *fsnotify_merge_candidate(struct fsnotify_group *group,
+							       struct fsnotify_event *event);
+/* set how long events on the same object are coalesced */
+extern int fsnotify_set_coalesce_window(struct fsnotify_group *group, unsigned int msecs);
 /* true if the group notification queue is empty */
 extern bool fsnotify_notify_queue_is_empty(struct fsnotify_group *group);
 /* return, but do not dequeue the first event on the notification queue */
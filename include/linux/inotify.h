@@ -9,6 +9,7 @@
 
 /* For O_CLOEXEC and O_NONBLOCK */
 #include <linux/fcntl.h>
+#include <linux/ioctl.h>
 #include <linux/types.h>
 
 /*
@@ -70,6 +71,21 @@ struct inotify_event {
 #define IN_CLOEXEC O_CLOEXEC
 #define IN_NONBLOCK O_NONBLOCK
 
+/*
+ * ioctls on an inotify instance.  INOTIFY_IOC_SETWINDOW takes a number of
+ * milliseconds during which events on the same object are coalesced and
+ * readers are not woken up again (0, the default, only merges identical
+ * consecutive events).  INOTIFY_IOC_GETSTATS reports how many events were
+ * merged into queued ones or lost to queue overflow.
+ */
+struct inotify_queue_stats {
+	__u64		merged;
+	__u64		dropped;
+};
+
+#define INOTIFY_IOC_SETWINDOW	_IOW('I', 1, __u32)
+#define INOTIFY_IOC_GETSTATS	_IOR('I', 2, struct inotify_queue_stats)
+
 #ifdef __KERNEL__
 #include <linux/sysctl.h>
 extern struct ctl_table inotify_table[]; /* for sysctl */
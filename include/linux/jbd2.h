@@ -130,6 +130,7 @@ typedef struct journal_s	journal_t;	/* Journal control structure */
 #define JBD2_SUPERBLOCK_V1	3
 #define JBD2_SUPERBLOCK_V2	4
 #define JBD2_REVOKE_BLOCK	5
+#define JBD2_FC_BLOCK		6
 
 /*
  * Standard header for all descriptor blocks:
@@ -199,6 +200,21 @@ typedef struct jbd2_journal_revoke_header_s
 #define JBD2_FLAG_DELETED	4	/* block deleted by this transaction */
 #define JBD2_FLAG_LAST_TAG	8	/* last tag in this descriptor block */
 
+/*
+ * The fast commit block header.  Fast commit blocks live in their own
+ * area past the end of the log and carry an opaque, fs-defined payload.
+ * A block only counts if its sequence is that of the first transaction
+ * which did not make it to disk, its nonce matches the one of the first
+ * fast commit block and its checksum is good.
+ */
+typedef struct jbd2_fc_header_s
+{
+	journal_header_t fc_header;
+	__be32		fc_nonce;	/* Random, fixed for one transaction */
+	__be32		fc_len;		/* Bytes of payload after the header */
+	__be32		fc_chksum;	/* crc32_be of header and payload */
+} jbd2_fc_header_t;
+
 
 /*
  * The journal superblock.  All fields are in big-endian byte order.
@@ -241,7 +257,11 @@ typedef struct journal_superblock_s
 	__be32	s_max_trans_data;	/* Limit of data blocks per trans. */
 
 /* 0x0050 */
-	__u32	s_padding[44];
+	__u32	s_padding[42];
+
+/* 0x00F8 */
+	__be32	s_inode_fc_blks;	/* Nr of inode fast commit blocks */
+	__u32	s_padding2;
 
 /* 0x0100 */
 	__u8	s_users[16*48];		/* ids of all fs'es sharing the log */
@@ -263,13 +283,20 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_REVOKE		0x00000001
 #define JBD2_FEATURE_INCOMPAT_64BIT		0x00000002
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
+/*
+ * Private to this tree, as is the layout of the fast commit area it
+ * describes.  Taken from the top so it stays clear of the bits mainline
+ * hands out from the bottom.
+ */
+#define JBD2_FEATURE_INCOMPAT_INODE_FC		0x80000000
 
 /* Features known to this kernel version: */
 #define JBD2_KNOWN_COMPAT_FEATURES	JBD2_FEATURE_COMPAT_CHECKSUM
 #define JBD2_KNOWN_ROCOMPAT_FEATURES	0
 #define JBD2_KNOWN_INCOMPAT_FEATURES	(JBD2_FEATURE_INCOMPAT_REVOKE | \
 					JBD2_FEATURE_INCOMPAT_64BIT | \
-					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT)
+					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
+					JBD2_FEATURE_INCOMPAT_INODE_FC)
 
 #ifdef __KERNEL__
 
@@ -665,6 +692,27 @@ struct transaction_stats_s {
 	struct transaction_run_stats_s run;
 };
 
+/*
+ * Commit latency histograms, one per phase of a commit plus the whole
+ * commit (flushing and logging).  The phases are timed with ktime, not
+ * the jiffies of struct transaction_run_stats_s.  Bucket i counts times
+ * below 2^i microseconds, the last bucket everything longer.
+ */
+enum {
+	JBD2_HIST_RUNNING,	/* transaction running */
+	JBD2_HIST_LOCKED,	/* waiting for handles to finish */
+	JBD2_HIST_FLUSHING,	/* flushing data (in ordered mode) */
+	JBD2_HIST_LOGGING,	/* writing the log */
+	JBD2_HIST_COMMIT,	/* whole commit */
+	JBD2_HIST_NR,
+};
+
+#define JBD2_HIST_BUCKETS	24
+
+struct jbd2_commit_hist {
+	unsigned long		count[JBD2_HIST_NR][JBD2_HIST_BUCKETS];
+};
+
 static inline unsigned long
 jbd2_time_diff(unsigned long start, unsigned long end)
 {
@@ -706,6 +754,12 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_free: Journal free - how many free blocks are there in the journal?
  * @j_first: The block number of the first usable block
  * @j_last: The block number one beyond the last usable block
+ * @j_fc_first: The block number of the first fast commit block
+ * @j_fc_blocks: Number of fast commit blocks, zero if there are none
+ * @j_fc_off: Number of fast commit blocks written for @j_fc_tid
+ * @j_fc_tid: Transaction the fast commit blocks currently belong to
+ * @j_fc_nonce: Nonce of the fast commit blocks written for @j_fc_tid
+ * @j_fc_mutex: Serialises fast commit writes
  * @j_dev: Device where we store the journal
  * @j_blocksize: blocksize for the location where we store the journal.
  * @j_blk_offset: starting block offset for into the device where we store the
@@ -743,6 +797,8 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_history_lock: Protect the transactions statistics history
  * @j_proc_entry: procfs entry for the jbd statistics directory
  * @j_stats: Overall statistics
+ * @j_hist: Commit latency histograms
+ * @j_fc_replay_callback: Called by recovery for each fast commit block
  * @j_private: An opaque pointer to fs-private information.
  */
 
@@ -852,6 +908,18 @@ struct journal_s
 	unsigned long		j_first;
 	unsigned long		j_last;
 
+	/*
+	 * Fast commit area: j_fc_blocks blocks from j_fc_first, past the end
+	 * of the log.  j_fc_off blocks of it have been written for
+	 * transaction j_fc_tid.  [j_fc_mutex]
+	 */
+	unsigned long		j_fc_first;
+	unsigned int		j_fc_blocks;
+	unsigned int		j_fc_off;
+	tid_t			j_fc_tid;
+	__u32			j_fc_nonce;
+	struct mutex		j_fc_mutex;
+
 	/*
 	 * Device, blocksize and starting block offset for the location where we
 	 * store the journal.
@@ -971,10 +1039,17 @@ struct journal_s
 	spinlock_t		j_history_lock;
 	struct proc_dir_entry	*j_proc_entry;
 	struct transaction_stats_s j_stats;
+	struct jbd2_commit_hist	j_hist;
 
 	/* Failed journal commit ID */
 	unsigned int		j_failed_commit;
 
+	/*
+	 * Called by recovery, once the log has been replayed, with the
+	 * payload of each valid fast commit block in the order written.
+	 */
+	int			(*j_fc_replay_callback)(journal_t *, void *, int);
+
 	/*
 	 * An opaque pointer to fs-private information.  ext3 puts its
 	 * superblock pointer here
@@ -1122,6 +1197,7 @@ extern void	   jbd2_journal_clear_features
 extern int	   jbd2_journal_load       (journal_t *journal);
 extern int	   jbd2_journal_destroy    (journal_t *);
 extern int	   jbd2_journal_recover    (journal_t *journal);
+extern __u32	   jbd2_fc_chksum	   (jbd2_fc_header_t *);
 extern int	   jbd2_journal_wipe       (journal_t *, int);
 extern int	   jbd2_journal_skip_recovery	(journal_t *);
 extern void	   jbd2_journal_update_superblock	(journal_t *, int);
@@ -1132,6 +1208,8 @@ extern void	   jbd2_journal_ack_err    (journal_t *);
 extern int	   jbd2_journal_clear_err  (journal_t *);
 extern int	   jbd2_journal_bmap(journal_t *, unsigned long, unsigned long long *);
 extern int	   jbd2_journal_force_commit(journal_t *);
+extern int	   jbd2_fc_init(journal_t *, unsigned int);
+extern int	   jbd2_fc_write(journal_t *, tid_t, const void *, int);
 extern int	   jbd2_journal_file_inode(handle_t *handle, struct jbd2_inode *inode);
 extern int	   jbd2_journal_begin_ordered_truncate(journal_t *journal,
 				struct jbd2_inode *inode, loff_t new_size);
@@ -1208,6 +1286,7 @@ int __jbd2_log_start_commit(journal_t *journal, tid_t tid);
 int jbd2_journal_start_commit(journal_t *journal, tid_t *tid);
 int jbd2_journal_force_commit_nested(journal_t *journal);
 int jbd2_log_wait_commit(journal_t *journal, tid_t tid);
+void jbd2_log_batch_sync(journal_t *journal, tid_t tid);
 int jbd2_log_do_checkpoint(journal_t *journal);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
@@ -1354,6 +1354,10 @@ struct task_struct {
 	struct fs_struct *fs;
 /* open file information */
 	struct files_struct *files;
+/* file borrowed by fget_light() and the table it may borrow from */
+	struct file *fborrow;
+	struct files_struct *fborrow_files;
+	struct list_head fborrow_node;
 /* namespaces */
 	struct nsproxy *nsproxy;
 /* signal handlers */
@@ -181,6 +181,20 @@ enum {
 
 	/* ensure the originating sk reference is available on driver level */
 	SKBTX_DRV_NEEDS_SK_REF = 1 << 3,
+
+	/* frags reference user pages, destructor_arg is the ubuf_info */
+	SKBTX_ZEROCOPY = 1 << 4,
+};
+
+/*
+ * Completion state of one MSG_ZEROCOPY send.  It lives in the cb of the
+ * skb that is queued on the socket error queue once the last skb that
+ * references the user pages is freed.
+ */
+struct ubuf_info {
+	atomic_t	refcnt;
+	u32		id;		/* number of the send on the socket */
+	u8		zerocopy;	/* cleared when data had to be copied */
 };
 
 /* This data is invariant across clones and lives at
@@ -503,6 +517,13 @@ static inline struct sk_buff *alloc_skb_fclone(unsigned int size,
 
 extern bool skb_recycle_check(struct sk_buff *skb, int skb_size);
 
+extern struct ubuf_info *sock_zerocopy_alloc(struct sock *sk);
+extern void sock_zerocopy_put(struct ubuf_info *uarg);
+extern void sock_zerocopy_put_abort(struct ubuf_info *uarg);
+extern int skb_zerocopy_add_frags(struct sk_buff *skb,
+				  const char __user *from, int len);
+extern int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask);
+
 extern struct sk_buff *skb_morph(struct sk_buff *dst, struct sk_buff *src);
 extern struct sk_buff *skb_clone(struct sk_buff *skb,
 				 gfp_t priority);
@@ -1493,6 +1514,41 @@ static inline void skb_orphan(struct sk_buff *skb)
 	skb->sk		= NULL;
 }
 
+static inline bool skb_zcopy(const struct sk_buff *skb)
+{
+	return skb_shinfo(skb)->tx_flags & SKBTX_ZEROCOPY;
+}
+
+static inline struct ubuf_info *skb_zcopy_uarg(const struct sk_buff *skb)
+{
+	return skb_zcopy(skb) ? skb_shinfo(skb)->destructor_arg : NULL;
+}
+
+/* Make @skb hold a reference on the MSG_ZEROCOPY send @uarg */
+static inline void skb_zcopy_set(struct sk_buff *skb, struct ubuf_info *uarg)
+{
+	if (uarg) {
+		atomic_inc(&uarg->refcnt);
+		skb_shinfo(skb)->destructor_arg = uarg;
+		skb_shinfo(skb)->tx_flags |= SKBTX_ZEROCOPY;
+	}
+}
+
+/**
+ *	skb_orphan_frags - stop referencing user pages
+ *	@skb: buffer to orphan the frags of
+ *	@gfp_mask: allocation priority
+ *
+ *	Copies the frags of a MSG_ZEROCOPY buffer that may be held for an
+ *	unbounded time, e.g. queued to a local socket.  Returns 0 on success.
+ */
+static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	if (likely(!skb_zcopy(skb)))
+		return 0;
+	return skb_copy_ubufs(skb, gfp_mask);
+}
+
 /**
  *	__skb_queue_purge - empty a list
  *	@list: list to empty
@@ -541,6 +541,7 @@ void reset_files_struct(struct files_struct *files)
 	struct files_struct *old;
 
 	old = tsk->files;
+	files_forget_borrower(tsk);
 	task_lock(tsk);
 	tsk->files = files;
 	task_unlock(tsk);
@@ -552,6 +553,7 @@ void exit_files(struct task_struct *tsk)
 	struct files_struct * files = tsk->files;
 
 	if (files) {
+		files_forget_borrower(tsk);
 		task_lock(tsk);
 		tsk->files = NULL;
 		task_unlock(tsk);
@@ -809,6 +809,9 @@ static int copy_files(unsigned long clone_flags, struct task_struct * tsk)
 	struct files_struct *oldf, *newf;
 	int error = 0;
 
+	tsk->fborrow = NULL;
+	tsk->fborrow_files = NULL;
+
 	/*
 	 * A background process may not have any files ...
 	 */
@@ -1720,6 +1723,7 @@ SYSCALL_DEFINE1(unshare, unsigned long, unshare_flags)
 
 		if (new_fd) {
 			fd = current->files;
+			files_forget_borrower(current);
 			current->files = new_fd;
 			new_fd = fd;
 		}
@@ -1770,6 +1774,7 @@ int unshare_files(struct files_struct **displaced)
 		return error;
 	}
 	*displaced = task->files;
+	files_forget_borrower(task);
 	task_lock(task);
 	task->files = copy;
 	task_unlock(task);
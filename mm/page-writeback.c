@@ -43,18 +43,17 @@
 static long ratelimit_pages = 32;
 
 /*
- * When balance_dirty_pages decides that the caller needs to perform some
- * non-background writeback, this is how many pages it will attempt to write.
- * It should be somewhat larger than dirtied pages to ensure that reasonably
- * large amounts of I/O are submitted.
+ * Don't sleep more than 200ms at a time in balance_dirty_pages().
  */
-static inline long sync_writeback_pages(unsigned long dirtied)
-{
-	if (dirtied < ratelimit_pages)
-		dirtied = ratelimit_pages;
+#define MAX_PAUSE		max(HZ/5, 1)
 
-	return dirtied + dirtied / 2;
-}
+/*
+ * Estimate write bandwidth at 200ms intervals.
+ */
+#define BANDWIDTH_INTERVAL	max(HZ/5, 1)
+
+#define RATELIMIT_CALC_SHIFT	10
+#define RATELIMIT_CALC_ONE	(1UL << RATELIMIT_CALC_SHIFT)
 
 /* The following parameters are exported via /proc/sys/vm */
 
@@ -219,6 +218,7 @@ int dirty_bytes_handler(struct ctl_table *table, int write,
  */
 static inline void __bdi_writeout_inc(struct backing_dev_info *bdi)
 {
+	__inc_bdi_stat(bdi, BDI_WRITTEN);
 	__prop_inc_percpu_max(&vm_completions, &bdi->completions,
 			      bdi->max_prop_frac);
 }
@@ -437,6 +437,15 @@ void global_dirty_limits(unsigned long *pbackground, unsigned long *pdirty)
 	*pdirty = dirty;
 }
 
+/*
+ * Below this amount of dirty memory, dirtiers are not throttled at all.
+ */
+static unsigned long dirty_freerun_ceiling(unsigned long thresh,
+					   unsigned long bg_thresh)
+{
+	return (thresh + bg_thresh) / 2;
+}
+
 /*
  * bdi_dirty_limit - @bdi's share of dirty throttling threshold
  *
@@ -468,37 +477,187 @@ unsigned long bdi_dirty_limit(struct backing_dev_info *bdi, unsigned long dirty)
 	return bdi_dirty;
 }
 
+static void bdi_update_write_bandwidth(struct backing_dev_info *bdi,
+				       unsigned long elapsed,
+				       unsigned long written)
+{
+	const unsigned long period = roundup_pow_of_two(3 * HZ);
+	unsigned long avg = bdi->avg_write_bandwidth;
+	unsigned long old = bdi->write_bandwidth;
+	u64 bw;
+
+	/*
+	 * bw = written * HZ / elapsed
+	 *
+	 *                   bw * elapsed + write_bandwidth * (period - elapsed)
+	 * write_bandwidth = ---------------------------------------------------
+	 *                                          period
+	 */
+	bw = written - bdi->written_stamp;
+	bw *= HZ;
+	if (unlikely(elapsed > period)) {
+		do_div(bw, elapsed);
+		avg = bw;
+		goto out;
+	}
+	bw += (u64)bdi->write_bandwidth * (period - elapsed);
+	bw >>= ilog2(period);
+
+	/*
+	 * one more level of smoothing, for filtering out sudden spikes
+	 */
+	if (avg > old && old >= (unsigned long)bw)
+		avg -= (avg - old) >> 3;
+
+	if (avg < old && old <= (unsigned long)bw)
+		avg += (old - avg) >> 3;
+
+out:
+	bdi->write_bandwidth = max_t(unsigned long, bw, 1);
+	bdi->avg_write_bandwidth = max_t(unsigned long, avg, 1);
+}
+
+static void __bdi_update_bandwidth(struct backing_dev_info *bdi,
+				   unsigned long start_time)
+{
+	unsigned long now = jiffies;
+	unsigned long elapsed = now - bdi->bw_time_stamp;
+	unsigned long written;
+
+	if (elapsed < BANDWIDTH_INTERVAL)
+		return;
+
+	written = bdi_stat(bdi, BDI_WRITTEN);
+
+	/*
+	 * Skip quiet periods when disk bandwidth is under-utilized.
+	 * (at least 1s idle time between two flusher runs)
+	 */
+	if (elapsed > HZ && time_before(bdi->bw_time_stamp, start_time))
+		goto snapshot;
+
+	bdi_update_write_bandwidth(bdi, elapsed, written);
+	trace_bdi_write_bandwidth(bdi, written);
+
+snapshot:
+	bdi->written_stamp = written;
+	bdi->bw_time_stamp = now;
+}
+
+/*
+ * bdi_update_bandwidth - refresh @bdi's write bandwidth estimate
+ * @start_time: when the caller started dirtying or writing back
+ *
+ * Called from the flusher and from throttled dirtiers.  The estimate is
+ * only refreshed every BANDWIDTH_INTERVAL, and periods in which nobody
+ * has been busy on @bdi since @start_time are not counted.
+ */
+void bdi_update_bandwidth(struct backing_dev_info *bdi,
+			  unsigned long start_time)
+{
+	if (time_is_after_eq_jiffies(bdi->bw_time_stamp + BANDWIDTH_INTERVAL))
+		return;
+	spin_lock_bh(&bdi->wb_lock);
+	__bdi_update_bandwidth(bdi, start_time);
+	spin_unlock_bh(&bdi->wb_lock);
+}
+
+/*
+ * Linear control line through (setpoint, 1.0) and (limit, 0), capped at 2.0:
+ *
+ *   ratio = (limit - dirty) / (limit - setpoint)
+ */
+static unsigned long pos_ratio_linear(unsigned long setpoint,
+				      unsigned long limit,
+				      unsigned long dirty)
+{
+	u64 ratio;
+
+	if (dirty >= limit)
+		return 0;
+	if (limit <= setpoint)
+		return RATELIMIT_CALC_ONE;
+
+	ratio = div_u64((u64)(limit - dirty) << RATELIMIT_CALC_SHIFT,
+			limit - setpoint);
+	return min_t(u64, ratio, 2 * RATELIMIT_CALC_ONE);
+}
+
+/*
+ * bdi_position_ratio - scale factor for the dirtier's rate limit
+ *
+ * Dirtiers are allowed to dirty pages at the bdi's estimated write
+ * bandwidth times this ratio, so that the amount of dirty memory settles
+ * around a setpoint instead of bouncing off the hard limit:
+ *
+ * - globally the setpoint is halfway between the freerun ceiling and
+ *   dirty_thresh; the ratio is 2.0 at the ceiling, 1.0 at the setpoint
+ *   and drops to 0 at dirty_thresh, which is still a hard limit.
+ *
+ * - the bdi gets the same line scaled down to its share of the dirty
+ *   limit.  Since bdi_thresh can be tiny while a device ramps up, this
+ *   part is a soft limit: its span is at least 1/8s worth of writeout
+ *   and it never slows the dirtier below 1/4 of the bandwidth.
+ *
+ * The two are multiplied and returned in RATELIMIT_CALC_SHIFT fixed point.
+ */
+static unsigned long bdi_position_ratio(struct backing_dev_info *bdi,
+					unsigned long thresh,
+					unsigned long bg_thresh,
+					unsigned long dirty,
+					unsigned long bdi_thresh,
+					unsigned long bdi_dirty)
+{
+	unsigned long freerun = dirty_freerun_ceiling(thresh, bg_thresh);
+	unsigned long setpoint = (freerun + thresh) / 2;
+	unsigned long bdi_setpoint, span;
+	unsigned long pos_ratio, bdi_ratio;
+
+	pos_ratio = pos_ratio_linear(setpoint, thresh, dirty);
+	if (!pos_ratio)
+		return 0;
+
+	bdi_setpoint = div_u64((u64)bdi_thresh * setpoint, thresh);
+	span = max(bdi_thresh - bdi_setpoint, bdi->avg_write_bandwidth / 8);
+	bdi_ratio = pos_ratio_linear(bdi_setpoint, bdi_setpoint + span,
+				     bdi_dirty);
+	bdi_ratio = max_t(unsigned long, bdi_ratio, RATELIMIT_CALC_ONE / 4);
+
+	return (pos_ratio * bdi_ratio) >> RATELIMIT_CALC_SHIFT;
+}
+
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
- * data.  It looks at the number of dirty pages in the machine and will force
- * the caller to perform writeback if the system is over `vm_dirty_ratio'.
- * If we're over `background_thresh' then the writeback threads are woken to
- * perform some writeout.
+ * data.  Once the amount of dirty memory is above the freerun ceiling halfway
+ * between the background and the dirty thresholds, the caller is put to sleep
+ * for as long as it would take the bdi to write back the @pages_dirtied pages
+ * it has just dirtied, scaled by bdi_position_ratio().  The writeout itself is
+ * left to the flusher thread, which is kicked if it is not running already.
+ *
+ * The sleep is capped at MAX_PAUSE so that dirtiers on slow devices make
+ * steady progress instead of stalling for seconds at a time.
  */
 static void balance_dirty_pages(struct address_space *mapping,
-				unsigned long write_chunk)
+				unsigned long pages_dirtied)
 {
-	long nr_reclaimable, bdi_nr_reclaimable;
-	long nr_writeback, bdi_nr_writeback;
+	unsigned long nr_reclaimable, bdi_nr_reclaimable;
+	unsigned long nr_writeback, bdi_nr_writeback;
+	unsigned long nr_dirty, bdi_dirty;
 	unsigned long background_thresh;
 	unsigned long dirty_thresh;
 	unsigned long bdi_thresh;
-	unsigned long pages_written = 0;
-	unsigned long pause = 1;
+	unsigned long pos_ratio;
+	unsigned long task_ratelimit;
+	long pause;
 	bool dirty_exceeded = false;
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	unsigned long start_time = jiffies;
 
 	for (;;) {
-		struct writeback_control wbc = {
-			.sync_mode	= WB_SYNC_NONE,
-			.older_than_this = NULL,
-			.nr_to_write	= write_chunk,
-			.range_cyclic	= 1,
-		};
-
 		nr_reclaimable = global_page_state(NR_FILE_DIRTY) +
 					global_page_state(NR_UNSTABLE_NFS);
 		nr_writeback = global_page_state(NR_WRITEBACK);
+		nr_dirty = nr_reclaimable + nr_writeback;
 
 		global_dirty_limits(&background_thresh, &dirty_thresh);
 
@@ -507,8 +666,8 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 * catch-up. This avoids (excessively) small writeouts
 		 * when the bdi limits are ramping up.
 		 */
-		if (nr_reclaimable + nr_writeback <=
-				(background_thresh + dirty_thresh) / 2)
+		if (nr_dirty <= dirty_freerun_ceiling(dirty_thresh,
+						      background_thresh))
 			break;
 
 		bdi_thresh = bdi_dirty_limit(bdi, dirty_thresh);
@@ -531,6 +690,7 @@ static void balance_dirty_pages(struct address_space *mapping,
 			bdi_nr_reclaimable = bdi_stat(bdi, BDI_RECLAIMABLE);
 			bdi_nr_writeback = bdi_stat(bdi, BDI_WRITEBACK);
 		}
+		bdi_dirty = bdi_nr_reclaimable + bdi_nr_writeback;
 
 		/*
 		 * The bdi thresh is somehow "soft" limit derived from the
@@ -538,44 +698,53 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 * bdi or process from holding back light ones; The latter is
 		 * the last resort safeguard.
 		 */
-		dirty_exceeded =
-			(bdi_nr_reclaimable + bdi_nr_writeback > bdi_thresh)
-			|| (nr_reclaimable + nr_writeback > dirty_thresh);
-
-		if (!dirty_exceeded)
-			break;
-
-		if (!bdi->dirty_exceeded)
+		dirty_exceeded = (bdi_dirty > bdi_thresh) ||
+				 (nr_dirty > dirty_thresh);
+		if (dirty_exceeded && !bdi->dirty_exceeded)
 			bdi->dirty_exceeded = 1;
 
-		/* Note: nr_reclaimable denotes nr_dirty + nr_unstable.
-		 * Unstable writes are a feature of certain networked
-		 * filesystems (i.e. NFS) in which data may have been
-		 * written to the server's write cache, but has not yet
-		 * been flushed to permanent storage.
-		 * Only move pages to writeback if this bdi is over its
-		 * threshold otherwise wait until the disk writes catch
-		 * up.
+		/*
+		 * Dirtiers no longer write out pages themselves, so make
+		 * sure the flusher is working on this bdi while we wait.
 		 */
-		trace_wbc_balance_dirty_start(&wbc, bdi);
-		if (bdi_nr_reclaimable > bdi_thresh) {
-			writeback_inodes_wb(&bdi->wb, &wbc);
-			pages_written += write_chunk - wbc.nr_to_write;
-			trace_wbc_balance_dirty_written(&wbc, bdi);
-			if (pages_written >= write_chunk)
-				break;		/* We've done our duty */
+		if (!writeback_in_progress(bdi))
+			bdi_start_background_writeback(bdi);
+
+		bdi_update_bandwidth(bdi, start_time);
+
+		pos_ratio = bdi_position_ratio(bdi, dirty_thresh,
+					       background_thresh, nr_dirty,
+					       bdi_thresh, bdi_dirty);
+		task_ratelimit = ((u64)bdi->avg_write_bandwidth * pos_ratio) >>
+							RATELIMIT_CALC_SHIFT;
+		if (unlikely(task_ratelimit == 0)) {
+			/* over the hard limit: wait for writeout to catch up */
+			pause = MAX_PAUSE;
+		} else {
+			pause = HZ * pages_dirtied / task_ratelimit;
+			if (pause > MAX_PAUSE)
+				pause = MAX_PAUSE;
 		}
-		trace_wbc_balance_dirty_wait(&wbc, bdi);
+
+		trace_balance_dirty_pages(bdi, dirty_thresh, background_thresh,
+					  nr_dirty, bdi_thresh, bdi_dirty,
+					  task_ratelimit, pages_dirtied,
+					  pause, start_time);
+		if (pause <= 0)
+			break;
+
 		__set_current_state(TASK_UNINTERRUPTIBLE);
 		io_schedule_timeout(pause);
 
 		/*
-		 * Increase the delay for each loop, up to our previous
-		 * default of taking a 100ms nap.
+		 * One proportional pause is all this batch of dirtied pages
+		 * owes.  Only keep waiting while over the hard limit.
 		 */
-		pause <<= 1;
-		if (pause > HZ / 10)
-			pause = HZ / 10;
+		if (task_ratelimit)
+			break;
+
+		if (fatal_signal_pending(current))
+			break;
 	}
 
 	if (!dirty_exceeded && bdi->dirty_exceeded)
@@ -588,12 +757,12 @@ static void balance_dirty_pages(struct address_space *mapping,
 	 * In laptop mode, we wait until hitting the higher threshold before
 	 * starting background writeout, and then write out all the way down
 	 * to the lower threshold.  So slow writers cause minimal disk activity.
+	 * The writeout is kicked from the throttling loop above.
 	 *
 	 * In normal mode, we start background writeout at the lower
 	 * background_thresh, to keep the amount of dirty memory low.
 	 */
-	if ((laptop_mode && pages_written) ||
-	    (!laptop_mode && (nr_reclaimable > background_thresh)))
+	if (!laptop_mode && nr_reclaimable > background_thresh)
 		bdi_start_background_writeback(bdi);
 }
 
@@ -641,7 +810,7 @@ void balance_dirty_pages_ratelimited_nr(struct address_space *mapping,
 	p =  &__get_cpu_var(bdp_ratelimits);
 	*p += nr_pages_dirtied;
 	if (unlikely(*p >= ratelimit)) {
-		ratelimit = sync_writeback_pages(*p);
+		ratelimit = *p;
 		*p = 0;
 		preempt_enable();
 		balance_dirty_pages(mapping, ratelimit);
@@ -1122,6 +1291,7 @@ void account_page_dirtied(struct page *page, struct address_space *mapping)
 		__inc_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
 		task_dirty_inc(current);
 		task_io_account_write(PAGE_CACHE_SIZE);
+		blk_throtl_mark_dirtier(mapping);
 	}
 }
 EXPORT_SYMBOL(account_page_dirtied);
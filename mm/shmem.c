@@ -2556,6 +2556,7 @@ static struct file_system_type tmpfs_fs_type = {
 	.name		= "tmpfs",
 	.mount		= shmem_mount,
 	.kill_sb	= kill_litter_super,
+	.fs_flags	= FS_PARALLEL_LOOKUP,
 };
 
 int __init init_tmpfs(void)
@@ -2652,6 +2653,7 @@ static struct file_system_type tmpfs_fs_type = {
 	.name		= "tmpfs",
 	.mount		= ramfs_mount,
 	.kill_sb	= kill_litter_super,
+	.fs_flags	= FS_PARALLEL_LOOKUP,
 };
 
 int __init init_tmpfs(void)
@@ -1577,6 +1577,13 @@ static void dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev)
 			if (!skb2)
 				break;
 
+			/* Taps may queue it for as long as they like */
+			if (skb_orphan_frags(skb2, GFP_ATOMIC)) {
+				kfree_skb(skb2);
+				skb2 = NULL;
+				break;
+			}
+
 			net_timestamp_set(skb2);
 
 			/* skb->nh should be correctly
@@ -3032,6 +3039,12 @@ static int __netif_receive_skb(struct sk_buff *skb)
 	if (netpoll_receive_skb(skb))
 		return NET_RX_DROP;
 
+	/* A local receiver may hold on to MSG_ZEROCOPY user pages forever */
+	if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC))) {
+		kfree_skb(skb);
+		return NET_RX_DROP;
+	}
+
 	if (!skb->skb_iif)
 		skb->skb_iif = skb->dev->ifindex;
 
@@ -328,6 +328,10 @@ static void skb_release_data(struct sk_buff *skb)
 				put_page(skb_shinfo(skb)->frags[i].page);
 		}
 
+		/* The user pages are no longer referenced from here */
+		if (skb_zcopy(skb))
+			sock_zerocopy_put(skb_zcopy_uarg(skb));
+
 		if (skb_has_frag_list(skb))
 			skb_drop_fraglist(skb);
 
@@ -487,7 +491,7 @@ bool skb_recycle_check(struct sk_buff *skb, int skb_size)
 	if (skb_end_pointer(skb) - skb->head < skb_size)
 		return false;
 
-	if (skb_shared(skb) || skb_cloned(skb))
+	if (skb_shared(skb) || skb_cloned(skb) || skb_zcopy(skb))
 		return false;
 
 	skb_release_head_state(skb);
@@ -736,6 +740,7 @@ struct sk_buff *pskb_copy(struct sk_buff *skb, gfp_t gfp_mask)
 			get_page(skb_shinfo(n)->frags[i].page);
 		}
 		skb_shinfo(n)->nr_frags = i;
+		skb_zcopy_set(n, skb_zcopy_uarg(skb));
 	}
 
 	if (skb_has_frag_list(skb)) {
@@ -822,6 +827,9 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 			get_page(skb_shinfo(skb)->frags[i].page);
 
+		if (skb_zcopy(skb))
+			atomic_inc(&skb_zcopy_uarg(skb)->refcnt);
+
 		if (skb_has_frag_list(skb))
 			skb_clone_fraglist(skb);
 
@@ -2081,6 +2089,8 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 {
 	int pos = skb_headlen(skb);
 
+	skb_zcopy_set(skb1, skb_zcopy_uarg(skb));
+
 	if (len < pos)	/* Split line is inside header. */
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
@@ -2123,6 +2133,10 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	/* tgt can only track the user pages of one MSG_ZEROCOPY send */
+	if (skb_zcopy(tgt) || skb_zcopy(skb))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2596,6 +2610,7 @@ struct sk_buff *skb_segment(struct sk_buff *skb, int features)
 		}
 
 		frag = skb_shinfo(nskb)->frags;
+		skb_zcopy_set(nskb, skb_zcopy_uarg(skb));
 
 		skb_copy_from_linear_data_offset(skb, offset,
 						 skb_put(nskb, hsize), hsize);
@@ -3043,6 +3058,213 @@ void skb_tstamp_tx(struct sk_buff *orig_skb,
 }
 EXPORT_SYMBOL_GPL(skb_tstamp_tx);
 
+/*
+ * MSG_ZEROCOPY sends.
+ *
+ * The pages of the user buffer are pinned and attached to the frags of the
+ * skbs on the socket write queue.  Every skb whose frags may reference them
+ * (clones share the skb_shared_info) holds a reference on the ubuf_info of
+ * the send.  When the last one is freed, the send is reported complete on
+ * the socket error queue and the user may reuse the buffer.
+ */
+
+static inline struct sk_buff *skb_from_uarg(struct ubuf_info *uarg)
+{
+	return container_of((void *)uarg, struct sk_buff, cb);
+}
+
+/**
+ *	sock_zerocopy_alloc - start a MSG_ZEROCOPY send
+ *	@sk: socket sending
+ *
+ *	Allocates the completion state of the next send on @sk, together with
+ *	the skb that will carry its notification, so that the completion
+ *	cannot fail later.  Must be called with the socket locked.
+ */
+struct ubuf_info *sock_zerocopy_alloc(struct sock *sk)
+{
+	struct ubuf_info *uarg;
+	struct sk_buff *skb;
+
+	BUILD_BUG_ON(sizeof(*uarg) > sizeof(skb->cb));
+
+	skb = sock_omalloc(sk, 0, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	uarg = (void *)skb->cb;
+	atomic_set(&uarg->refcnt, 1);
+	uarg->id = atomic_inc_return(&sk->sk_zckey) - 1;
+	uarg->zerocopy = 1;
+	sock_hold(sk);
+
+	return uarg;
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_alloc);
+
+/*
+ * Queue the completion of a send.  A completion that continues the range
+ * of the notification at the tail of the error queue is merged into it,
+ * so that a busy sender reads one notification for many sends.
+ */
+static void sock_zerocopy_notify(struct ubuf_info *uarg)
+{
+	struct sk_buff *tail, *skb = skb_from_uarg(uarg);
+	struct sock *sk = skb->sk;
+	struct sk_buff_head *q = &sk->sk_error_queue;
+	struct sock_exterr_skb *serr;
+	unsigned long flags;
+	u32 id = uarg->id;
+	u8 code = uarg->zerocopy ? 0 : SO_EE_CODE_ZEROCOPY_COPIED;
+
+	/* The error header reuses the cb, uarg is gone from here on */
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_code = code;
+	serr->ee.ee_info = id;
+	serr->ee.ee_data = id;
+
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (tail && SKB_EXT_ERR(tail)->ee.ee_origin == SO_EE_ORIGIN_ZEROCOPY &&
+	    SKB_EXT_ERR(tail)->ee.ee_code == code &&
+	    SKB_EXT_ERR(tail)->ee.ee_data + 1 == id) {
+		SKB_EXT_ERR(tail)->ee.ee_data = id;
+	} else {
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	sk->sk_error_report(sk);
+
+	kfree_skb(skb);
+	sock_put(sk);
+}
+
+void sock_zerocopy_put(struct ubuf_info *uarg)
+{
+	if (uarg && atomic_dec_and_test(&uarg->refcnt))
+		sock_zerocopy_notify(uarg);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+/*
+ * Drop a send that failed before any skb referenced the user pages.  It
+ * gives its id back so that the ids the user sees stay contiguous.
+ */
+void sock_zerocopy_put_abort(struct ubuf_info *uarg)
+{
+	struct sk_buff *skb;
+	struct sock *sk;
+
+	if (!uarg)
+		return;
+	if (atomic_read(&uarg->refcnt) != 1) {
+		sock_zerocopy_put(uarg);
+		return;
+	}
+
+	skb = skb_from_uarg(uarg);
+	sk = skb->sk;
+	atomic_dec(&sk->sk_zckey);
+	kfree_skb(skb);
+	sock_put(sk);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
+/**
+ *	skb_zerocopy_add_frags - attach user pages to a buffer
+ *	@skb: buffer to add the pages to
+ *	@from: user address of the data
+ *	@len: number of bytes wanted
+ *
+ *	Pins the user pages holding @len bytes at @from and appends them to
+ *	the frags of @skb, as far as its free frag slots allow.  The caller
+ *	charges the memory to the socket and sets the ubuf_info.  Returns the
+ *	number of bytes attached or a negative error.
+ */
+int skb_zerocopy_add_frags(struct sk_buff *skb, const char __user *from,
+			   int len)
+{
+	struct page *pages[MAX_SKB_FRAGS];
+	unsigned long addr = (unsigned long)from;
+	int offset = addr & ~PAGE_MASK;
+	int i = skb_shinfo(skb)->nr_frags;
+	int nr, j, copied = 0;
+
+	nr = min_t(int, MAX_SKB_FRAGS - i,
+		   (offset + len + PAGE_SIZE - 1) >> PAGE_SHIFT);
+	if (nr <= 0)
+		return -EMSGSIZE;
+
+	nr = get_user_pages_fast(addr & PAGE_MASK, nr, 0, pages);
+	if (nr <= 0)
+		return nr ? nr : -EFAULT;
+
+	for (j = 0; j < nr; j++) {
+		int size = min_t(int, len, PAGE_SIZE - offset);
+
+		skb_fill_page_desc(skb, i++, pages[j], offset, size);
+		offset = 0;
+		len -= size;
+		copied += size;
+	}
+
+	skb->len += copied;
+	skb->data_len += copied;
+	skb->truesize += copied;
+	return copied;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_add_frags);
+
+/**
+ *	skb_copy_ubufs - copy the user pages of a buffer
+ *	@skb: buffer to modify
+ *	@gfp_mask: allocation priority
+ *
+ *	Replaces the frags of a MSG_ZEROCOPY buffer with kernel copies and
+ *	drops its reference on the send, which is then reported as copied.
+ *	A clone gets a private skb_shared_info first, the buffers it was
+ *	cloned from keep the user pages.  Returns 0 on success.
+ */
+int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	struct ubuf_info *uarg;
+	int i;
+
+	if (skb_shared(skb))
+		return -EINVAL;
+	if (skb_cloned(skb) && pskb_expand_head(skb, 0, 0, gfp_mask))
+		return -ENOMEM;
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+		struct page *page = alloc_page(gfp_mask);
+		u8 *vaddr;
+
+		if (!page)
+			return -ENOMEM;
+
+		vaddr = kmap_skb_frag(frag);
+		memcpy(page_address(page), vaddr + frag->page_offset,
+		       frag->size);
+		kunmap_skb_frag(vaddr);
+
+		put_page(frag->page);
+		frag->page = page;
+		frag->page_offset = 0;
+	}
+
+	uarg = skb_zcopy_uarg(skb);
+	skb_shinfo(skb)->tx_flags &= ~SKBTX_ZEROCOPY;
+	uarg->zerocopy = 0;
+	sock_zerocopy_put(uarg);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_copy_ubufs);
+
 
 /**
  * skb_partial_csum_set - set up and verify partial csum values for packet
@@ -384,6 +384,7 @@ int ip_recv_error(struct sock *sk, struct msghdr *msg, int len)
 	} errhdr;
 	int err;
 	int copied;
+	int zerocopy;
 
 	err = -EAGAIN;
 	skb = skb_dequeue(&sk->sk_error_queue);
@@ -402,9 +403,11 @@ int ip_recv_error(struct sock *sk, struct msghdr *msg, int len)
 	sock_recv_timestamp(msg, sk, skb);
 
 	serr = SKB_EXT_ERR(skb);
+	zerocopy = serr->ee.ee_origin == SO_EE_ORIGIN_ZEROCOPY;
 
+	/* Zerocopy completions carry no packet to take an address from */
 	sin = (struct sockaddr_in *)msg->msg_name;
-	if (sin) {
+	if (sin && !zerocopy) {
 		sin->sin_family = AF_INET;
 		sin->sin_addr.s_addr = *(__be32 *)(skb_network_header(skb) +
 						   serr->addr_offset);
@@ -433,7 +436,12 @@ int ip_recv_error(struct sock *sk, struct msghdr *msg, int len)
 	msg->msg_flags |= MSG_ERRQUEUE;
 	err = copied;
 
-	/* Reset and regenerate socket error */
+	/*
+	 * Reset and regenerate socket error.  Zerocopy completions are
+	 * queued on connected TCP sockets, whose sk_err must survive them.
+	 */
+	if (zerocopy)
+		goto out_free_skb;
 	spin_lock_bh(&sk->sk_error_queue.lock);
 	sk->sk_err = 0;
 	skb2 = skb_peek(&sk->sk_error_queue);
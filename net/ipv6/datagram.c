@@ -331,6 +331,7 @@ int ipv6_recv_error(struct sock *sk, struct msghdr *msg, int len)
 	} errhdr;
 	int err;
 	int copied;
+	int zerocopy;
 
 	err = -EAGAIN;
 	skb = skb_dequeue(&sk->sk_error_queue);
@@ -349,9 +350,11 @@ int ipv6_recv_error(struct sock *sk, struct msghdr *msg, int len)
 	sock_recv_timestamp(msg, sk, skb);
 
 	serr = SKB_EXT_ERR(skb);
+	zerocopy = serr->ee.ee_origin == SO_EE_ORIGIN_ZEROCOPY;
 
+	/* Zerocopy completions carry no packet to take an address from */
 	sin = (struct sockaddr_in6 *)msg->msg_name;
-	if (sin) {
+	if (sin && !zerocopy) {
 		const unsigned char *nh = skb_network_header(skb);
 		sin->sin6_family = AF_INET6;
 		sin->sin6_flowinfo = 0;
@@ -375,7 +378,7 @@ int ipv6_recv_error(struct sock *sk, struct msghdr *msg, int len)
 	memcpy(&errhdr.ee, &serr->ee, sizeof(struct sock_extended_err));
 	sin = &errhdr.offender;
 	sin->sin6_family = AF_UNSPEC;
-	if (serr->ee.ee_origin != SO_EE_ORIGIN_LOCAL) {
+	if (serr->ee.ee_origin != SO_EE_ORIGIN_LOCAL && !zerocopy) {
 		sin->sin6_family = AF_INET6;
 		sin->sin6_flowinfo = 0;
 		sin->sin6_scope_id = 0;
@@ -402,7 +405,9 @@ int ipv6_recv_error(struct sock *sk, struct msghdr *msg, int len)
 	msg->msg_flags |= MSG_ERRQUEUE;
 	err = copied;
 
-	/* Reset and regenerate socket error */
+	/* Reset and regenerate socket error, see ip_recv_error() */
+	if (zerocopy)
+		goto out_free_skb;
 	spin_lock_bh(&sk->sk_error_queue.lock);
 	sk->sk_err = 0;
 	if ((skb2 = skb_peek(&sk->sk_error_queue)) != NULL) {